@@ -23,6 +23,9 @@ static struct acpi_info g_info = {
     .madt = NULL,
     .fadt = NULL,
     .mcfg = NULL,
+    .pptt = NULL,
+    .srat = NULL,
+    .slit = NULL,
     .rsdp = NULL,
     .rsdt = NULL,
 
@@ -94,6 +97,16 @@ static inline void acpi_init_each_sdt(const struct acpi_sdt *const sdt) {
         return;
     }
 
+    if (memcmp(sdt->signature, "SRAT", sizeof(sdt->signature)) == 0) {
+        g_info.srat = (const struct acpi_srat *)sdt;
+        return;
+    }
+
+    if (memcmp(sdt->signature, "SLIT", sizeof(sdt->signature)) == 0) {
+        g_info.slit = (const struct acpi_slit *)sdt;
+        return;
+    }
+
 #if defined(__aarch64__)
     if (memcmp(sdt->signature, "GTDT", sizeof(sdt->signature)) == 0) {
         g_info.gtdt = (const struct acpi_gtdt *)sdt;
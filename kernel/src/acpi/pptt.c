@@ -5,12 +5,120 @@
 
 #include "dev/printk.h"
 #include "lib/util.h"
+#include "sched/topology.h"
 
 #include "pptt.h"
 
+// Guards walking up the hierarchy against a malformed table with a cycle.
+#define PPTT_MAX_DEPTH 16
+
+static const struct acpi_pptt_processor_hierarchy_node *
+get_processor_node(const struct acpi_pptt *const pptt, const uint32_t offset) {
+    const struct acpi_pptt_processor_hierarchy_node *node = NULL;
+    if (offset == 0 ||
+        !index_in_bounds(offset, pptt->sdt.length) ||
+        pptt->sdt.length - offset < sizeof(*node))
+    {
+        return NULL;
+    }
+
+    node = (const struct acpi_pptt_processor_hierarchy_node *)
+        ((uint64_t)pptt + offset);
+
+    if (node->base.kind != ACPI_PPTT_NODE_PROCESSOR_HIERARCHY ||
+        node->length < sizeof(*node) +
+            node->private_resource_count * sizeof(uint32_t))
+    {
+        return NULL;
+    }
+
+    return node;
+}
+
+// A cache listed as a private resource of a node is shared by every processor
+// below it.
+
+static bool
+node_has_cache(const struct acpi_pptt *const pptt,
+               const struct acpi_pptt_processor_hierarchy_node *const node)
+{
+    for (uint32_t i = 0; i != node->private_resource_count; i++) {
+        const uint32_t offset = node->private_resource_offsets[i];
+        if (!index_in_bounds(offset, pptt->sdt.length)) {
+            continue;
+        }
+
+        const struct acpi_pptt_node_base *const base =
+            (const struct acpi_pptt_node_base *)((uint64_t)pptt + offset);
+
+        if (base->kind == ACPI_PPTT_NODE_CACHE_TYPE) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// The core of a leaf is its parent if the leaf is a hardware thread, and the
+// leaf itself otherwise. Above the core, the first node with a cache is the
+// cache domain, and the node marked as a physical package is the package.
+// Offsets of nodes are unique, so they're used as the ids.
+
+static void
+add_cpu_topology(const struct acpi_pptt *const pptt,
+                 const struct acpi_pptt_processor_hierarchy_node *const leaf,
+                 const uint32_t leaf_offset)
+{
+    struct sched_topology topology = {
+        .id_list = {
+            [SCHED_TOPOLOGY_CORE] = leaf_offset,
+            [SCHED_TOPOLOGY_CACHE] = SCHED_TOPOLOGY_ID_NONE,
+            [SCHED_TOPOLOGY_PACKAGE] = SCHED_TOPOLOGY_ID_NONE
+        }
+    };
+
+    if (leaf->flags & __ACPI_PPTT_PROCESSOR_HIERARCHY_PROCESSOR_IS_THREAD) {
+        topology.id_list[SCHED_TOPOLOGY_CORE] =
+            get_processor_node(pptt, leaf->parent_offset) != NULL ?
+                leaf->parent_offset : SCHED_TOPOLOGY_ID_NONE;
+    }
+
+    const struct acpi_pptt_processor_hierarchy_node *node = leaf;
+    uint32_t offset = leaf_offset;
+
+    for (uint32_t depth = 0; depth != PPTT_MAX_DEPTH; depth++) {
+        if (topology.id_list[SCHED_TOPOLOGY_CACHE] == SCHED_TOPOLOGY_ID_NONE &&
+            offset != leaf_offset &&
+            offset != topology.id_list[SCHED_TOPOLOGY_CORE] &&
+            node_has_cache(pptt, node))
+        {
+            topology.id_list[SCHED_TOPOLOGY_CACHE] = offset;
+        }
+
+        // Without a node marked as a package, the root is used instead.
+        topology.id_list[SCHED_TOPOLOGY_PACKAGE] = offset;
+        if (node->flags & __ACPI_PPTT_PROCESSOR_HIERARCHY_NODE_PHYSICAL_PKG) {
+            break;
+        }
+
+        const struct acpi_pptt_processor_hierarchy_node *const parent =
+            get_processor_node(pptt, node->parent_offset);
+
+        if (parent == NULL) {
+            break;
+        }
+
+        offset = node->parent_offset;
+        node = parent;
+    }
+
+    sched_topology_add_cpu(leaf->acpi_processor_id, &topology);
+}
+
 void pptt_init(const struct acpi_pptt *const pptt) {
     uint32_t offset = offsetof(struct acpi_pptt, buffer);
     while (index_in_bounds(offset, pptt->sdt.length)) {
+        const uint32_t node_offset = offset;
         struct acpi_pptt_node_base *const base =
             (struct acpi_pptt_node_base *)((uint64_t)pptt + offset);
 
@@ -19,7 +127,13 @@ void pptt_init(const struct acpi_pptt *const pptt) {
                 struct acpi_pptt_processor_hierarchy_node *const node =
                     (struct acpi_pptt_processor_hierarchy_node *)base;
 
-                offset += sizeof(*node);
+                if (node->length < sizeof(*node)) {
+                    printk(LOGLEVEL_WARN,
+                           "pptt: processor-hierarchy node is too short\n");
+                    return;
+                }
+
+                offset += node->length;
                 if (!ordinal_in_bounds(offset, pptt->sdt.length)) {
                     printk(LOGLEVEL_WARN,
                            "pptt: processor-hierarchy node goes beyond end "
@@ -71,13 +185,27 @@ void pptt_init(const struct acpi_pptt *const pptt) {
                     }
                 }
 
+                const uint32_t leaf_flags =
+                    __ACPI_PPTT_PROCESSOR_HIERARCHY_ACPI_ID_VALID |
+                    __ACPI_PPTT_PROCESSOR_HIERARCHY_NODE_IS_LEAF;
+
+                if ((node->flags & leaf_flags) == leaf_flags) {
+                    add_cpu_topology(pptt, node, node_offset);
+                }
+
                 break;
             }
             case ACPI_PPTT_NODE_CACHE_TYPE: {
                 struct acpi_pptt_cache_type_node *const node =
                     (struct acpi_pptt_cache_type_node *)base;
 
-                offset += sizeof(*node);
+                if (node->length < sizeof(*node)) {
+                    printk(LOGLEVEL_WARN,
+                           "pptt: cache-type node is too short\n");
+                    return;
+                }
+
+                offset += node->length;
                 if (!ordinal_in_bounds(offset, pptt->sdt.length)) {
                     printk(LOGLEVEL_WARN,
                            "pptt: cache-type node goes beyond end of node\n");
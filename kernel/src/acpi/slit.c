@@ -0,0 +1,35 @@
+/*
+ * kernel/src/acpi/slit.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "mm/numa.h"
+
+#include "slit.h"
+
+void slit_init(const struct acpi_slit *const slit) {
+    if (slit->sdt.length < sizeof(*slit)) {
+        printk(LOGLEVEL_WARN, "slit: table too short\n");
+        return;
+    }
+
+    const uint64_t count = slit->locality_count;
+    const uint64_t entries_length = slit->sdt.length - sizeof(*slit);
+
+    if (count > UINT32_MAX || count * count > entries_length) {
+        printk(LOGLEVEL_WARN,
+               "slit: locality-count of %" PRIu64 " goes beyond end of "
+               "table\n",
+               count);
+        return;
+    }
+
+    for (uint64_t from = 0; from != count; from++) {
+        for (uint64_t to = 0; to != count; to++) {
+            numa_set_distance((uint32_t)from,
+                              (uint32_t)to,
+                              slit->entries[from * count + to]);
+        }
+    }
+}
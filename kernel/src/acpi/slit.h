@@ -0,0 +1,9 @@
+/*
+ * kernel/src/acpi/slit.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "structs.h"
+
+void slit_init(const struct acpi_slit *slit);
@@ -0,0 +1,146 @@
+/*
+ * kernel/src/acpi/srat.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "mm/numa.h"
+
+#include "srat.h"
+
+static void
+add_memory_affinity(const struct acpi_srat_entry_memory_affinity *const entry)
+{
+    if ((entry->flags & __ACPI_SRAT_ENTRY_MEMORY_AFFINITY_ENABLED) == 0) {
+        return;
+    }
+
+    const uint64_t base = (uint64_t)entry->base_high << 32 | entry->base_low;
+    const uint64_t length =
+        (uint64_t)entry->length_high << 32 | entry->length_low;
+
+    if (length == 0) {
+        return;
+    }
+
+    const struct range range = RANGE_INIT(base, length);
+    printk(LOGLEVEL_INFO,
+           "srat: memory at " RANGE_FMT " is in proximity-domain %" PRIu32
+           "\n",
+           RANGE_FMT_ARGS(range),
+           entry->proximity_domain);
+
+    numa_add_memory_range(entry->proximity_domain, range);
+}
+
+void srat_init(const struct acpi_srat *const srat) {
+    if (srat->sdt.length < sizeof(*srat)) {
+        printk(LOGLEVEL_WARN, "srat: table too short\n");
+        return;
+    }
+
+    const struct acpi_srat_entry_header *iter = NULL;
+    const uint32_t length = srat->sdt.length - sizeof(*srat);
+
+    for (uint32_t offset = 0, index = 0;
+         offset + sizeof(struct acpi_srat_entry_header) <= length;
+         offset += iter->length, index++)
+    {
+        iter = (const struct acpi_srat_entry_header *)&srat->entries[offset];
+        if (iter->length < sizeof(*iter) || offset + iter->length > length) {
+            printk(LOGLEVEL_WARN,
+                   "srat: entry at index %" PRIu32 " has an invalid length\n",
+                   index);
+            return;
+        }
+
+        switch (iter->kind) {
+            case ACPI_SRAT_ENTRY_KIND_CPU_LOCAL_APIC_AFFINITY: {
+                const struct acpi_srat_entry_cpu_lapic_affinity *const entry =
+                    (const struct acpi_srat_entry_cpu_lapic_affinity *)iter;
+
+                if (iter->length != sizeof(*entry)) {
+                    break;
+                }
+
+                if ((entry->flags &
+                        __ACPI_SRAT_ENTRY_CPU_AFFINITY_ENABLED) == 0)
+                {
+                    break;
+                }
+
+                const uint32_t domain =
+                    (uint32_t)entry->proximity_domain_high[2] << 24 |
+                    (uint32_t)entry->proximity_domain_high[1] << 16 |
+                    (uint32_t)entry->proximity_domain_high[0] << 8 |
+                    entry->proximity_domain_low;
+
+                numa_add_cpu(domain, NUMA_CPU_ID_APIC, entry->apic_id);
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_MEMORY_AFFINITY: {
+                const struct acpi_srat_entry_memory_affinity *const entry =
+                    (const struct acpi_srat_entry_memory_affinity *)iter;
+
+                if (iter->length != sizeof(*entry)) {
+                    break;
+                }
+
+                add_memory_affinity(entry);
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_CPU_LOCAL_X2APIC_AFFINITY: {
+                const struct acpi_srat_entry_cpu_x2apic_affinity *const entry =
+                    (const struct acpi_srat_entry_cpu_x2apic_affinity *)iter;
+
+                if (iter->length != sizeof(*entry)) {
+                    break;
+                }
+
+                if (entry->flags & __ACPI_SRAT_ENTRY_CPU_AFFINITY_ENABLED) {
+                    numa_add_cpu(entry->proximity_domain,
+                                 NUMA_CPU_ID_APIC,
+                                 entry->x2apic_id);
+                }
+
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_GICC_AFFINITY: {
+                const struct acpi_srat_entry_gicc_affinity *const entry =
+                    (const struct acpi_srat_entry_gicc_affinity *)iter;
+
+                if (iter->length != sizeof(*entry)) {
+                    break;
+                }
+
+                if (entry->flags & __ACPI_SRAT_ENTRY_CPU_AFFINITY_ENABLED) {
+                    numa_add_cpu(entry->proximity_domain,
+                                 NUMA_CPU_ID_ACPI_UID,
+                                 entry->acpi_processor_uid);
+                }
+
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_RINTC_AFFINITY: {
+                const struct acpi_srat_entry_rintc_affinity *const entry =
+                    (const struct acpi_srat_entry_rintc_affinity *)iter;
+
+                if (iter->length != sizeof(*entry)) {
+                    break;
+                }
+
+                if (entry->flags & __ACPI_SRAT_ENTRY_CPU_AFFINITY_ENABLED) {
+                    numa_add_cpu(entry->proximity_domain,
+                                 NUMA_CPU_ID_ACPI_UID,
+                                 entry->acpi_processor_uid);
+                }
+
+                break;
+            }
+            case ACPI_SRAT_ENTRY_KIND_GIC_ITS_AFFINITY:
+            case ACPI_SRAT_ENTRY_KIND_GENERIC_INITIATOR_AFFINITY:
+            case ACPI_SRAT_ENTRY_KIND_GENERIC_PORT_AFFINITY:
+                break;
+        }
+    }
+}
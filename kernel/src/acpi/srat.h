@@ -0,0 +1,9 @@
+/*
+ * kernel/src/acpi/srat.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "structs.h"
+
+void srat_init(const struct acpi_srat *srat);
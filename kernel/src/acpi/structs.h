@@ -876,6 +876,110 @@ struct acpi_pptt {
     char buffer[];
 };
 
+// srat = "System Resource Affinity Table"
+struct acpi_srat {
+    struct acpi_sdt sdt;
+
+    uint32_t reserved_1;
+    uint64_t reserved_2;
+
+    char entries[];
+} __packed;
+
+enum acpi_srat_entry_kind {
+    ACPI_SRAT_ENTRY_KIND_CPU_LOCAL_APIC_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_MEMORY_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_CPU_LOCAL_X2APIC_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GICC_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GIC_ITS_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GENERIC_INITIATOR_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_GENERIC_PORT_AFFINITY,
+    ACPI_SRAT_ENTRY_KIND_RINTC_AFFINITY,
+};
+
+struct acpi_srat_entry_header {
+    enum acpi_srat_entry_kind kind : 8;
+    uint8_t length;
+} __packed;
+
+enum acpi_srat_entry_cpu_affinity_flags {
+    __ACPI_SRAT_ENTRY_CPU_AFFINITY_ENABLED = 1 << 0,
+};
+
+struct acpi_srat_entry_cpu_lapic_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint8_t proximity_domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t local_sapic_eid;
+    uint8_t proximity_domain_high[3];
+    uint32_t clock_domain;
+} __packed;
+
+enum acpi_srat_entry_memory_affinity_flags {
+    __ACPI_SRAT_ENTRY_MEMORY_AFFINITY_ENABLED = 1 << 0,
+    __ACPI_SRAT_ENTRY_MEMORY_AFFINITY_HOT_PLUGGABLE = 1 << 1,
+    __ACPI_SRAT_ENTRY_MEMORY_AFFINITY_NON_VOLATILE = 1 << 2,
+};
+
+struct acpi_srat_entry_memory_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint32_t proximity_domain;
+    uint16_t reserved_1;
+
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t length_low;
+    uint32_t length_high;
+
+    uint32_t reserved_2;
+    uint32_t flags;
+    uint64_t reserved_3;
+} __packed;
+
+struct acpi_srat_entry_cpu_x2apic_affinity {
+    struct acpi_srat_entry_header header;
+    uint16_t reserved_1;
+
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved_2;
+} __packed;
+
+struct acpi_srat_entry_gicc_affinity {
+    struct acpi_srat_entry_header header;
+
+    uint32_t proximity_domain;
+    uint32_t acpi_processor_uid;
+    uint32_t flags;
+    uint32_t clock_domain;
+} __packed;
+
+struct acpi_srat_entry_rintc_affinity {
+    struct acpi_srat_entry_header header;
+    uint16_t reserved;
+
+    uint32_t proximity_domain;
+    uint32_t acpi_processor_uid;
+    uint32_t flags;
+    uint32_t clock_domain;
+} __packed;
+
+// slit = "System Locality Information Table"
+struct acpi_slit {
+    struct acpi_sdt sdt;
+    uint64_t locality_count;
+
+    // Matrix of locality_count * locality_count entries, where entry (i, j)
+    // is the relative distance from locality i to locality j.
+
+    uint8_t entries[];
+} __packed;
+
 enum acpi_spcr_interface_kind {
     ACPI_SPCR_INTERFACE_16550_COMPATIBLE,
     ACPI_SPCR_INTERFACE_16550_SUBSET,
@@ -0,0 +1,49 @@
+/*
+ * kernel/src/arch/aarch64/asm/esr.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "lib/macros.h"
+
+#define ESR_EC_SHIFT 26
+
+enum esr_exception_class {
+    ESR_EC_INSTR_ABORT_LOWER_EL = 0x20,
+    ESR_EC_INSTR_ABORT_SAME_EL = 0x21,
+    ESR_EC_DATA_ABORT_LOWER_EL = 0x24,
+    ESR_EC_DATA_ABORT_SAME_EL = 0x25,
+};
+
+enum esr_abort_iss {
+    // Fault Status Code, bits [5:2] give the kind and bits [1:0] the level.
+    __ESR_ABORT_FSC = 0x3f,
+
+    // Write not Read, only valid for data aborts.
+    __ESR_DATA_ABORT_WNR = 1 << 6,
+};
+
+#define ESR_FSC_KIND_MASK 0x3c
+
+enum esr_fault_status_kind {
+    ESR_FSC_ADDRESS_SIZE_FAULT = 0x0,
+    ESR_FSC_TRANSLATION_FAULT = 0x4,
+    ESR_FSC_ACCESS_FLAG_FAULT = 0x8,
+    ESR_FSC_PERMISSION_FAULT = 0xc,
+};
+
+__optimize(3) static inline uint64_t read_esr_el1() {
+    uint64_t result = 0;
+    asm volatile ("mrs %0, esr_el1" : "=r"(result));
+
+    return result;
+}
+
+__optimize(3) static inline uint64_t read_far_el1() {
+    uint64_t result = 0;
+    asm volatile ("mrs %0, far_el1" : "=r"(result));
+
+    return result;
+}
@@ -8,6 +8,11 @@
 #include <stdint.h>
 #include "lib/macros.h"
 
+// The ASID is in the upper 16 bits when TCR_EL1.A1 is 0. Only the lower 8 bits
+// are used unless TCR_EL1.AS is set.
+
+#define TTBR_ASID_SHIFT 48
+
 __optimize(3) static inline uint64_t read_ttbr0_el1() {
     uint64_t value = 0;
     asm volatile ("mrs %0, ttbr0_el1" : "=r" (value));
@@ -11,6 +11,7 @@
 
 #include "mm/kmalloc.h"
 #include "mm/mmio.h"
+#include "mm/numa.h"
 #include "mm/pagemap.h"
 
 #include "sched/thread.h"
@@ -23,6 +24,7 @@ __hidden struct cpu_info g_base_cpu_info = {
     .pagemap_node = LIST_INIT(g_base_cpu_info.pagemap_node),
 
     .cpu_list = LIST_INIT(g_base_cpu_info.cpu_list),
+    .numa_node = 0,
     .spur_int_count = 0,
 
     .cpu_interface_number = 0,
@@ -1464,8 +1466,15 @@ cpu_add_gic_interface(
 
         list_init(&cpu->cpu_list);
         list_add(&g_cpu_list, &cpu->cpu_list);
+
+        cpu->numa_node = 0;
+        cpu_page_cache_init(&cpu->page_cache);
     }
 
+    numa_find_cpu_node(NUMA_CPU_ID_ACPI_UID,
+                       intr->acpi_processor_id,
+                       &cpu->numa_node);
+
     cpu->spur_int_count = 0;
     cpu->acpi_processor_id = intr->acpi_processor_id;
     cpu->cpu_interface_number = intr->cpu_interface_number;
@@ -7,6 +7,11 @@
 #include "cpu/cpu_info.h"
 
 #include "acpi/structs.h"
+#include "mm/asid.h"
+#include "mm/cpu_page_cache.h"
+#include "mm/cpu_slab_cache.h"
+#include "sched/alarm.h"
+#include "sched/runqueue.h"
 #include "sched/thread.h"
 #include "sys/gic.h"
 
@@ -17,6 +22,11 @@ struct cpu_info {
     struct list pagemap_node;
     struct list cpu_list;
 
+    struct cpu_page_cache page_cache;
+    struct cpu_slab_cache slab_cache;
+    struct cpu_asid_cache asid_cache;
+    uint8_t numa_node;
+
     uint64_t spur_int_count;
 
     uint32_t cpu_interface_number;
@@ -24,6 +34,8 @@ struct cpu_info {
 
     uint64_t mpidr;
 
+    struct sched_runqueue runqueue;
+    struct sched_alarm_wheel alarm_wheel;
     struct thread *idle_thread;
     struct gic_cpu_info gic_cpu;
 
@@ -14,6 +14,10 @@ void cpu_halt() {
     }
 }
 
+void cpu_idle() {
+    asm volatile ("wfi");
+}
+
 void cpu_shutdown() {
     const enum psci_return_value result = psci_shutdown();
     panic("kernel: cpu_shutdown() failed with result=%d\n", result);
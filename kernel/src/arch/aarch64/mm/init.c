@@ -4,11 +4,13 @@
  */
 
 #include "asm/mair.h"
+#include "asm/tcr.h"
 #include "dev/printk.h"
 
 #include "lib/align.h"
 #include "lib/size.h"
 
+#include "mm/asid.h"
 #include "mm/early.h"
 #include "mm/memmap.h"
 #include "mm/pgmap.h"
@@ -254,8 +256,19 @@ static void setup_mair() {
     write_mair_el1(mair_value);
 }
 
+// Take the asid from ttbr0, which holds the lower-half pagemap that asids tag.
+// Every aarch64 cpu supports at least 8-bit asids.
+
+static void setup_asids() {
+    write_tcr_el1(read_tcr_el1() & ~(uint64_t)__TCR_ASID_DEFINED_BY_EL1);
+    asm volatile ("isb" ::: "memory");
+
+    asid_init(/*asid_count=*/1ull << 8);
+}
+
 void mm_arch_init() {
     setup_mair();
+    setup_asids();
 
     uint64_t kernel_memmap_size = 0;
     setup_kernel_pagemap(&kernel_memmap_size);
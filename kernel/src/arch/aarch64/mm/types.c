@@ -86,6 +86,28 @@ __optimize(3) bool pte_is_dirty(const pte_t pte) {
     return (pte & __PTE_DIRTY) != 0;
 }
 
+__optimize(3) bool pte_is_writable(const pte_t pte) {
+    return (pte & __PTE_RO) == 0;
+}
+
+// Clear the DBM bit too, otherwise the cpu is allowed to make the pte writable
+// again on a write.
+
+__optimize(3) pte_t pte_make_readonly(const pte_t pte) {
+    return (pte | __PTE_RO) & ~(pte_t)__PTE_DIRTY;
+}
+
+__optimize(3) pte_t pte_make_writable(const pte_t pte) {
+    return pte & ~(pte_t)__PTE_RO;
+}
+
+__optimize(3)
+pte_t pte_leaf_to_large_flags(const pte_t pte, const pgt_level_t level) {
+    // Blocks are told apart from pages by __PTE_PML1_PAGE being clear.
+    const pte_t mask = PTE_PHYS_MASK | __PTE_PML1_PAGE;
+    return (pte & ~mask) | (pte_t)PTE_LARGE_FLAGS(level);
+}
+
 __optimize(3) pte_t pte_read(const pte_t *const pte) {
     return *(volatile const pte_t *)pte;
 }
@@ -6,8 +6,18 @@
 #include "lib/macros.h"
 #include "sys/isr.h"
 
+struct cpu_info;
+
 __hidden isr_vector_t g_sched_vector = 0;
 
 void sched_init_irq() {
 
+}
+
+void sched_send_self_ipi() {
+
+}
+
+void sched_send_ipi(struct cpu_info *const cpu) {
+    (void)cpu;
 }
\ No newline at end of file
@@ -11,3 +11,7 @@ __optimize(3) struct thread *current_thread() {
 
     return thread;
 }
+
+__optimize(3) void set_current_thread(struct thread *const thread) {
+    asm volatile ("msr tpidr_el1, %0" :: "r"(thread));
+}
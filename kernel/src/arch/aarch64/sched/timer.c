@@ -9,6 +9,10 @@ void sched_timer_oneshot(const usec_t usec) {
     (void)usec;
 }
 
+void sched_timer_stop() {
+
+}
+
 void sched_irq_eoi() {
 
 }
\ No newline at end of file
@@ -3,9 +3,12 @@
  * © suhas pai
  */
 
+#include "asm/esr.h"
 #include "asm/irq_context.h"
+
 #include "cpu/isr.h"
 #include "dev/printk.h"
+#include "mm/fault.h"
 
 extern void *ivt_el1;
 
@@ -44,9 +47,53 @@ isr_assign_irq_to_cpu(struct cpu_info *const cpu,
     (void)masked;
 }
 
+static bool handle_abort(const uint64_t esr, const uint8_t exception_class) {
+    uint8_t flags = 0;
+    switch ((enum esr_exception_class)exception_class) {
+        case ESR_EC_INSTR_ABORT_LOWER_EL:
+            flags |= __PAGE_FAULT_USER;
+            [[fallthrough]];
+        case ESR_EC_INSTR_ABORT_SAME_EL:
+            flags |= __PAGE_FAULT_EXEC;
+            break;
+        case ESR_EC_DATA_ABORT_LOWER_EL:
+            flags |= __PAGE_FAULT_USER;
+            [[fallthrough]];
+        case ESR_EC_DATA_ABORT_SAME_EL:
+            if (esr & __ESR_DATA_ABORT_WNR) {
+                flags |= __PAGE_FAULT_WRITE;
+            }
+
+            break;
+        default:
+            return false;
+    }
+
+    switch (esr & __ESR_ABORT_FSC & ESR_FSC_KIND_MASK) {
+        case ESR_FSC_TRANSLATION_FAULT:
+            break;
+        case ESR_FSC_PERMISSION_FAULT:
+            flags |= __PAGE_FAULT_PRESENT;
+            break;
+        default:
+            return false;
+    }
+
+    return handle_page_fault(read_far_el1(), flags) == E_PAGE_FAULT_OK;
+}
+
 void handle_exception(irq_context_t *const context) {
-    (void)context;
-    printk(LOGLEVEL_INFO, "isr: got exception\n");
+    const uint64_t esr = read_esr_el1();
+    const uint8_t exception_class = (uint8_t)(esr >> ESR_EC_SHIFT) & 0x3f;
+
+    if (handle_abort(esr, exception_class)) {
+        return;
+    }
+
+    printk(LOGLEVEL_INFO,
+           "isr: got exception (class 0x%" PRIx8 ") at %p\n",
+           exception_class,
+           (void *)context->elr_el1);
 }
 
 void handle_interrupt(irq_context_t *const context) {
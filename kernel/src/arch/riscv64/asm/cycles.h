@@ -0,0 +1,19 @@
+/*
+ * kernel/src/arch/riscv64/asm/cycles.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "lib/macros.h"
+
+// Usable before any timer is setup, but the rate isn't known, so only useful
+// for comparing durations against each other.
+
+__optimize(3) static inline uint64_t read_cycle_count() {
+    uint64_t value = 0;
+    asm volatile ("rdtime %0" : "=r"(value) :: "memory");
+
+    return value;
+}
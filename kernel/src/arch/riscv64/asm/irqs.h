@@ -37,3 +37,11 @@ __optimize(3) static inline void enable_all_irqs_if_flag(const bool flag) {
         enable_all_irqs();
     }
 }
+
+// Wait for the next irq and then enable irqs. wfi ends on a pending irq even
+// while irqs are masked, so one that's already pending isn't missed.
+
+__optimize(3) static inline void enable_all_irqs_and_wait() {
+    asm volatile ("wfi" ::: "memory");
+    enable_all_irqs();
+}
@@ -8,6 +8,7 @@
 static struct cpu_info g_base_cpu_info = {
     .pagemap = &kernel_pagemap,
     .pagemap_node = LIST_INIT(g_base_cpu_info.pagemap_node),
+    .numa_node = 0,
     .spur_int_count = 0
 };
 
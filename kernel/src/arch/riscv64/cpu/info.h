@@ -7,13 +7,26 @@
 #include "cpu/cpu_info.h"
 
 #include "lib/list.h"
+
+#include "mm/asid.h"
+#include "mm/cpu_page_cache.h"
+#include "mm/cpu_slab_cache.h"
 #include "mm/pagemap.h"
+#include "sched/alarm.h"
+#include "sched/runqueue.h"
 
 struct pagemap;
 struct cpu_info {
     struct pagemap *pagemap;
     struct list pagemap_node;
 
+    struct cpu_page_cache page_cache;
+    struct cpu_slab_cache slab_cache;
+    struct cpu_asid_cache asid_cache;
+    uint8_t numa_node;
+
+    struct sched_runqueue runqueue;
+    struct sched_alarm_wheel alarm_wheel;
     struct thread *idle_thread;
     uint64_t spur_int_count;
 
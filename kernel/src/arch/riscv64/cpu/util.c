@@ -14,6 +14,10 @@ void cpu_halt() {
     }
 }
 
+void cpu_idle() {
+    asm volatile ("wfi");
+}
+
 void cpu_shutdown() {
     syscon_poweroff();
 }
@@ -8,6 +8,7 @@
 
 #include "dev/printk.h"
 
+#include "mm/asid.h"
 #include "mm/early.h"
 #include "mm/memmap.h"
 #include "mm/pgmap.h"
@@ -206,7 +207,28 @@ static void fill_kernel_pagemap_struct(const uint64_t kernel_memmap_size) {
         "mm: failed to setup kernel-pagemap");
 }
 
+// The asid field of satp is WARL, so the bits the cpu doesn't support read back
+// as zero.
+
+static void setup_asids() {
+    uint64_t satp = 0;
+    uint64_t probe = 0;
+
+    asm volatile ("csrr %0, satp" : "=r"(satp));
+    asm volatile ("csrw satp, %1; csrr %0, satp; csrw satp, %2; sfence.vma"
+                  : "=&r"(probe)
+                  : "r"(satp | SATP_ASID_MASK), "r"(satp)
+                  : "memory");
+
+    const uint64_t asid_bits =
+        (uint64_t)__builtin_popcountll(probe & SATP_ASID_MASK);
+
+    asid_init(/*asid_count=*/1ull << asid_bits);
+}
+
 void mm_arch_init() {
+    setup_asids();
+
     uint64_t kernel_memmap_size = 0;
     setup_kernel_pagemap(&kernel_memmap_size);
 
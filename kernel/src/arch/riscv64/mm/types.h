@@ -17,6 +17,9 @@
 #define PML5_SHIFT 48
 
 #define PAGE_SHIFT PML1_SHIFT
+
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK (0xffffull << SATP_ASID_SHIFT)
 #define PTE_PHYS_MASK 0x003ffffffffffc00
 
 #define PGT_LEVEL_COUNT 5
@@ -60,6 +60,29 @@ arch_make_mapping(struct pagemap *const pagemap,
     return pgmap_at(pagemap, phys_range, virt_addr, &options);
 }
 
+enum pgmap_alloc_result
+arch_alloc_mapping(struct pagemap *const pagemap,
+                   const struct range virt_range,
+                   const prot_t prot,
+                   const enum vma_cachekind cachekind,
+                   const struct pgmap_alloc_options *const alloc_options)
+{
+    const struct pgmap_options options = {
+        .pte_flags = flags_from_info(pagemap, prot, cachekind),
+
+        .alloc_pgtable_cb_info = NULL,
+        .free_pgtable_cb_info = NULL,
+
+        .supports_largepage_at_level_mask = 0,
+
+        .free_pages = true,
+        .is_in_early = false,
+        .is_overwrite = false
+    };
+
+    return pgmap_alloc_at(pagemap, virt_range, &options, alloc_options);
+}
+
 bool
 arch_unmap_mapping(struct pagemap *const pagemap,
                    const struct range virt_range,
@@ -3,7 +3,10 @@
  * © suhas pai
  */
 
+#include "cpu/info.h"
 #include "lib/size.h"
+
+#include "mm/numa.h"
 #include "mm/zone.h"
 
 static struct page_zone zone_low4g = {
@@ -11,36 +14,43 @@ static struct page_zone zone_low4g = {
     .name = "low4g",
 
     .section_list = LIST_INIT(zone_low4g.section_list),
-    .fallback_zone = NULL,
-};
-
-static struct page_zone zone_default = {
-    .lock = SPINLOCK_INIT(),
-    .name = "default",
 
-    .section_list = LIST_INIT(zone_default.section_list),
-    .fallback_zone = &zone_low4g,
+    .zeroed_lock = SPINLOCK_INIT(),
+    .zeroed_page_list = LIST_INIT(zone_low4g.zeroed_page_list),
 };
 
+// Memory above 4gib is split into a zone for each numa node.
+
 __optimize(3) struct page_zone *phys_to_zone(const uint64_t phys) {
     if (phys < gib(4)) {
         return &zone_low4g;
     }
 
-    return &zone_default;
+    return &phys_to_numa_node(phys)->zone;
 }
 
 __optimize(3) struct page_zone *page_zone_iterstart() {
-    return &zone_default;
+    return &numa_get_node(0)->zone;
 }
 
 __optimize(3)
 struct page_zone *page_zone_iternext(struct page_zone *const zone) {
-    return zone->fallback_zone;
+    if (zone == &zone_low4g) {
+        return NULL;
+    }
+
+    const struct numa_node *const node =
+        container_of(zone, struct numa_node, zone);
+
+    if (node->index + 1 != numa_node_count()) {
+        return &numa_get_node(node->index + 1)->zone;
+    }
+
+    return &zone_low4g;
 }
 
 __optimize(3) struct page_zone *page_zone_default() {
-    return &zone_default;
+    return &numa_get_node(this_cpu()->numa_node)->zone;
 }
 
 __optimize(3) struct page_zone *page_zone_low4g() {
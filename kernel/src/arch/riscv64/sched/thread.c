@@ -9,3 +9,8 @@
 __optimize(3) struct thread *current_thread() {
     verify_not_reached();
 }
+
+__optimize(3) void set_current_thread(struct thread *const thread) {
+    (void)thread;
+    verify_not_reached();
+}
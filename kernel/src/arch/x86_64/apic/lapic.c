@@ -186,8 +186,17 @@ lapic_timer_one_shot(const uint64_t microseconds, const isr_vector_t vector) {
     const uint64_t lapic_timer_freq_in_microseconds =
         this_cpu()->lapic_timer_frequency / MICRO_IN_SECONDS;
 
-    mmio_write(&lapic_regs->timer_initial_count,
-               lapic_timer_freq_in_microseconds * microseconds);
+    // The initial-count is only 32 bits, so a timer too far off fires early
+    // instead, and a count of zero would stop the timer.
+
+    uint64_t count = UINT32_MAX;
+    if (!check_mul(lapic_timer_freq_in_microseconds, microseconds, &count) ||
+        count > UINT32_MAX)
+    {
+        count = UINT32_MAX;
+    }
+
+    mmio_write(&lapic_regs->timer_initial_count, (uint32_t)max(count, 1ull));
     mmio_write(&lapic_regs->lvt_timer,
                setup_timer_register(LAPIC_TIMER_MODE_ONE_SHOT,
                                     /*masked=*/false,
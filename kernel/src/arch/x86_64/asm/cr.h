@@ -282,4 +282,12 @@ enum {
      * interrupts will be disabled.
      */
     __CR4_BIT_TPL = (1ull << 26),
+};
+
+enum {
+    // PCID of the current pagemap, when cr4.PCIDE is set.
+    __CR3_PCID = 0xfff,
+
+    // When writing cr3, keep the tlb entries of the new PCID.
+    __CR3_NOFLUSH = (1ull << 63),
 };
\ No newline at end of file
@@ -0,0 +1,16 @@
+/*
+ * kernel/src/arch/x86_64/asm/cycles.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "lib/macros.h"
+
+// Usable before any timer is setup, but the rate isn't known, so only useful
+// for comparing durations against each other.
+
+__optimize(3) static inline uint64_t read_cycle_count() {
+    return __builtin_ia32_rdtsc();
+}
@@ -38,4 +38,10 @@ __optimize(3) static inline void enable_all_irqs_if_flag(const bool flag) {
     }
 }
 
+// Enable irqs and wait for the next one. sti holds off irqs until after the
+// next instruction, so an irq that's already pending ends the hlt instead of
+// being taken before it.
 
+__optimize(3) static inline void enable_all_irqs_and_wait() {
+    asm volatile ("sti; hlt" ::: "memory");
+}
@@ -13,10 +13,15 @@ struct cpu_info g_base_cpu_info = {
 
     .pagemap = &kernel_pagemap,
     .pagemap_node = LIST_INIT(g_base_cpu_info.pagemap_node),
+    .cpu_list = LIST_INIT(g_base_cpu_info.cpu_list),
+    .tlb_shootdown_pending = false,
+    .numa_node = 0,
 
     .spur_int_count = 0
 };
 
+struct list g_cpu_list = LIST_INIT(g_cpu_list);
+
 __optimize(3) const struct cpu_info *get_base_cpu_info() {
     return &g_base_cpu_info;
 }
@@ -4,15 +4,23 @@
  */
 
 #pragma once
+
+#include <stdatomic.h>
 #include "cpu/cpu_info.h"
 
+#include "mm/asid.h"
+#include "mm/cpu_page_cache.h"
+#include "mm/cpu_slab_cache.h"
 #include "mm/pagemap.h"
+#include "sched/alarm.h"
+#include "sched/runqueue.h"
 #include "sched/thread.h"
 
 struct cpu_capabilities {
     bool supports_avx512 : 1;
     bool supports_x2apic : 1;
     bool supports_1gib_pages : 1;
+    bool supports_pcid : 1;
     bool has_compacted_xsave : 1;
 
     uint16_t xsave_user_size;
@@ -30,7 +38,22 @@ struct cpu_info {
     uint64_t timer_ticks;
 
     struct pagemap *pagemap;
+
     struct list pagemap_node;
+    struct list cpu_list;
+
+    // Set by a cpu shooting down our tlb entries, and cleared once we've
+    // flushed them.
+
+    _Atomic bool tlb_shootdown_pending;
+
+    struct cpu_page_cache page_cache;
+    struct cpu_slab_cache slab_cache;
+    struct cpu_asid_cache asid_cache;
+    uint8_t numa_node;
+
+    struct sched_runqueue runqueue;
+    struct sched_alarm_wheel alarm_wheel;
 
     // Keep track of spurious interrupts for every lapic.
     struct thread *idle_thread;
@@ -39,5 +62,7 @@ struct cpu_info {
     bool active : 1;
 };
 
+extern struct list g_cpu_list;
+
 void cpu_init();
 const struct cpu_capabilities *get_cpu_capabilities();
\ No newline at end of file
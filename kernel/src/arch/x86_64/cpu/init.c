@@ -19,6 +19,7 @@ static struct cpu_capabilities g_cpu_capabilities = {
     .supports_avx512 = false,
     .supports_x2apic = false,
     .supports_1gib_pages = false,
+    .supports_pcid = false,
     .has_compacted_xsave = false,
 
     .xsave_user_size = 0,
@@ -199,6 +200,7 @@ static void init_cpuid_features() {
 
         if (!g_base_cpu_init) {
             g_cpu_capabilities.supports_x2apic = ecx & __CPUID_FEAT_ECX_X2APIC;
+            g_cpu_capabilities.supports_pcid = ecx & __CPUID_FEAT_ECX_PCIDE;
         }
     }
     {
@@ -398,6 +400,13 @@ static void init_cpuid_features() {
         __CR4_BIT_OSXSAVE;
 
     write_cr4(read_cr4() | cr4_bits);
+    if (g_cpu_capabilities.supports_pcid) {
+        // cr4.PCIDE can only be set while the current PCID is 0.
+        write_cr3(read_cr3() & ~(uint64_t)__CR3_PCID);
+        write_cr4(read_cr4() | __CR4_BIT_PCIDE);
+
+        asid_init(/*asid_count=*/__CR3_PCID + 1);
+    }
 
     // Enable Syscalls
     msr_write(IA32_MSR_EFER, msr_read(IA32_MSR_EFER) | __IA32_MSR_EFER_BIT_SCE);
@@ -427,6 +436,7 @@ void cpu_init() {
 
     write_gsbase((uint64_t)&kernel_main_thread);
     list_add(&kernel_pagemap.cpu_list, &this_cpu_mut()->pagemap_node);
+    list_add(&g_cpu_list, &this_cpu_mut()->cpu_list);
 
     g_base_cpu_init = true;
 }
\ No newline at end of file
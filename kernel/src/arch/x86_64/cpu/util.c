@@ -10,4 +10,8 @@ void cpu_halt() {
     while (true) {
         asm("hlt");
     }
+}
+
+void cpu_idle() {
+    asm volatile ("hlt");
 }
\ No newline at end of file
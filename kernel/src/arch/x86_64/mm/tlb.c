@@ -3,11 +3,37 @@
  * © suhas pai
  */
 
+#include "apic/lapic.h"
+
+#include "asm/cr.h"
+#include "asm/irqs.h"
+#include "asm/pause.h"
 #include "asm/tlb.h"
+
+#include "cpu/isr.h"
 #include "mm/page_alloc.h"
 
 #include "tlb.h"
 
+struct tlb_shootdown {
+    struct pagemap *pagemap;
+
+    const struct range *range_list;
+    uint8_t range_count;
+
+    bool full_flush;
+    _Atomic uint32_t pending_count;
+};
+
+// Only one shootdown is in flight at a time. The cpu holding g_shootdown_lock
+// owns g_shootdown until every cpu it signaled has acknowledged.
+
+static struct tlb_shootdown g_shootdown = {0};
+static struct spinlock g_shootdown_lock = SPINLOCK_INIT();
+
+static isr_vector_t g_shootdown_vector = 0;
+static uint64_t g_full_flush_threshold = TLB_FULL_FLUSH_THRESHOLD_DEFAULT;
+
 __optimize(3) static void tlb_flush_range(const struct range range) {
     const uint64_t end = range_get_end_assert(range);
     for (uint64_t addr = range.front; addr < end; addr += PAGE_SIZE) {
@@ -15,15 +41,150 @@ __optimize(3) static void tlb_flush_range(const struct range range) {
     }
 }
 
+// Kernel mappings are global, and so survive a write to cr3. Toggling cr4.PGE
+// flushes them as well.
+
+__optimize(3) static void tlb_flush_all(const bool include_global) {
+    if (include_global) {
+        const uint64_t cr4 = read_cr4();
+
+        write_cr4(cr4 & ~(uint64_t)__CR4_BIT_PGE);
+        write_cr4(cr4);
+    } else {
+        write_cr3(read_cr3());
+    }
+}
+
+__optimize(3)
+static void flush_shootdown(const struct tlb_shootdown *const shootdown) {
+    if (shootdown->full_flush) {
+        tlb_flush_all(/*include_global=*/shootdown->pagemap == &kernel_pagemap);
+        return;
+    }
+
+    for (uint8_t i = 0; i != shootdown->range_count; i++) {
+        tlb_flush_range(shootdown->range_list[i]);
+    }
+}
+
+// Caller is required to have irqs disabled.
+
+__optimize(3) static void handle_pending_shootdown() {
+    struct cpu_info *const cpu = this_cpu_mut();
+    if (!atomic_exchange(&cpu->tlb_shootdown_pending, false)) {
+        return;
+    }
+
+    flush_shootdown(&g_shootdown);
+    atomic_fetch_sub_explicit(&g_shootdown.pending_count,
+                              1,
+                              memory_order_release);
+}
+
+__optimize(3)
+static void shootdown_isr(const uint64_t int_no, irq_context_t *const frame) {
+    (void)int_no;
+    (void)frame;
+
+    handle_pending_shootdown();
+}
+
+__optimize(3) static void signal_cpu(struct cpu_info *const cpu) {
+    if (cpu == this_cpu() || g_shootdown_vector == 0) {
+        return;
+    }
+
+    atomic_fetch_add_explicit(&g_shootdown.pending_count,
+                              1,
+                              memory_order_relaxed);
+
+    atomic_store(&cpu->tlb_shootdown_pending, true);
+    lapic_send_ipi(cpu->lapic_id, g_shootdown_vector);
+}
+
+// Signal every cpu that may hold entries of the shootdown's pagemap. Every cpu
+// may hold global kernel entries, regardless of its current pagemap.
+
+static void signal_cpus(struct pagemap *const pagemap) {
+    struct cpu_info *iter = NULL;
+    if (pagemap == &kernel_pagemap) {
+        list_foreach(iter, &g_cpu_list, cpu_list) {
+            signal_cpu(iter);
+        }
+
+        return;
+    }
+
+    spin_acquire(&pagemap->cpu_lock);
+    list_foreach(iter, &pagemap->cpu_list, pagemap_node) {
+        signal_cpu(iter);
+    }
+
+    spin_release(&pagemap->cpu_lock);
+}
+
 void tlb_flush_pageop(struct pageop *const pageop) {
-    tlb_flush_range(pageop->flush_range);
+    struct range range_list[PAGEOP_PENDING_RANGE_MAX + 1];
+    uint8_t range_count = 0;
+    uint64_t page_count = 0;
+
+    for (uint8_t i = 0; i != pageop->pending_range_count; i++) {
+        range_list[range_count] = pageop->pending_range_list[i];
+        page_count += range_list[range_count].size >> PAGE_SHIFT;
+
+        range_count++;
+    }
+
+    if (!range_empty(pageop->flush_range)) {
+        range_list[range_count] = pageop->flush_range;
+        page_count += pageop->flush_range.size >> PAGE_SHIFT;
+
+        range_count++;
+    }
 
-    struct page *page = NULL;
-    struct page *tmp = NULL;
+    struct pagemap *const pagemap = pageop->pagemap;
+    const bool flag = disable_all_irqs_if_not();
 
-    list_foreach_mut(page, tmp, &pageop->delayed_free, table.delayed_free_list)
+    // Another cpu may be holding the lock while waiting on us to acknowledge
+    // its shootdown, so keep handling shootdowns until we get the lock.
+
+    while (!spin_try_acquire(&g_shootdown_lock)) {
+        handle_pending_shootdown();
+        cpu_pause();
+    }
+
+    g_shootdown.pagemap = pagemap;
+    g_shootdown.range_list = range_list;
+    g_shootdown.range_count = range_count;
+    g_shootdown.full_flush = page_count > g_full_flush_threshold;
+
+    atomic_store_explicit(&g_shootdown.pending_count, 0, memory_order_relaxed);
+    signal_cpus(pagemap);
+
+    if (pagemap == &kernel_pagemap || this_cpu()->pagemap == pagemap) {
+        flush_shootdown(&g_shootdown);
+    }
+
+    while (atomic_load_explicit(&g_shootdown.pending_count,
+                                memory_order_acquire) != 0)
     {
-        list_delete(&page->table.delayed_free_list);
-        free_page(page);
+        cpu_pause();
     }
-}
\ No newline at end of file
+
+    spin_release(&g_shootdown_lock);
+    enable_all_irqs_if_flag(flag);
+
+    // Only now can no cpu still be using a translation to a page we're about
+    // to free.
+
+    free_page_list(&pageop->delayed_free);
+}
+
+void tlb_set_full_flush_threshold(const uint64_t page_count) {
+    g_full_flush_threshold = page_count;
+}
+
+void tlb_init() {
+    g_shootdown_vector = isr_alloc_vector();
+    isr_set_vector(g_shootdown_vector, shootdown_isr, &ARCH_ISR_INFO_NONE());
+}
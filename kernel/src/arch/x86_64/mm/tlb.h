@@ -6,4 +6,12 @@
 #pragma once
 #include "mm/pageop.h"
 
-void tlb_flush_pageop(struct pageop *pageop);
\ No newline at end of file
+// Shootdowns of more pages than this flush the entire tlb instead of flushing
+// one page at a time.
+
+#define TLB_FULL_FLUSH_THRESHOLD_DEFAULT 33
+
+void tlb_init();
+void tlb_set_full_flush_threshold(uint64_t page_count);
+
+void tlb_flush_pageop(struct pageop *pageop);
@@ -54,6 +54,23 @@ __optimize(3) bool pte_is_dirty(const pte_t pte) {
     return (pte & __PTE_DIRTY) != 0;
 }
 
+__optimize(3) bool pte_is_writable(const pte_t pte) {
+    return (pte & __PTE_WRITE) != 0;
+}
+
+__optimize(3) pte_t pte_make_readonly(const pte_t pte) {
+    return pte & ~(pte_t)__PTE_WRITE;
+}
+
+__optimize(3) pte_t pte_make_writable(const pte_t pte) {
+    return pte | __PTE_WRITE;
+}
+
+__optimize(3)
+pte_t pte_leaf_to_large_flags(const pte_t pte, const pgt_level_t level) {
+    return (pte & ~(pte_t)PTE_PHYS_MASK) | (pte_t)PTE_LARGE_FLAGS(level);
+}
+
 __optimize(3) pte_t pte_read(const pte_t *const pte) {
     return *pte;
 }
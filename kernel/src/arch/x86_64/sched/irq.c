@@ -3,10 +3,29 @@
  * © suhas pai
  */
 
+#include "apic/lapic.h"
+#include "cpu/info.h"
 #include "cpu/isr.h"
 
+#include "sched/irq.h"
+#include "sched/thread.h"
+
 __hidden isr_vector_t g_sched_vector = 0;
 
+static void sched_isr(const uint64_t int_no, irq_context_t *const frame) {
+    (void)int_no;
+    sched_next(current_thread()->sched_info.scheduler, frame);
+}
+
 void sched_init_irq() {
     g_sched_vector = isr_alloc_vector();
-}
\ No newline at end of file
+    isr_set_vector(g_sched_vector, sched_isr, &ARCH_ISR_INFO_NONE());
+}
+
+void sched_send_self_ipi() {
+    lapic_send_self_ipi(g_sched_vector);
+}
+
+void sched_send_ipi(struct cpu_info *const cpu) {
+    lapic_send_ipi(cpu->lapic_id, g_sched_vector);
+}
@@ -10,3 +10,6 @@ __optimize(3) struct thread *current_thread() {
     return (struct thread *)read_gsbase();
 }
 
+__optimize(3) void set_current_thread(struct thread *const thread) {
+    write_gsbase((uint64_t)thread);
+}
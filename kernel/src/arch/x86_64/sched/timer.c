@@ -11,6 +11,10 @@ void sched_timer_oneshot(const usec_t usec) {
     lapic_timer_one_shot(usec, g_sched_vector);
 }
 
+void sched_timer_stop() {
+    lapic_timer_stop();
+}
+
 void sched_irq_eoi() {
     lapic_eoi();
 }
\ No newline at end of file
@@ -46,13 +46,14 @@ idt_func_%1:
     %if %1 != 8 && %1 != 10 && %1 != 11 && %1 != 12 && %1 != 13 && %1 != 14 && %1 != 17 && %1 != 30
         push qword 0
     %endif
+    push qword %1
     push_all
     mov rdi, %1
     mov rsi, rsp
     call isr_handle_interrupt
     call lapic_eoi
     pop_all
-    add rsp, 8
+    add rsp, 16
     iretq
 %endmacro
 
@@ -10,6 +10,7 @@
 #include "cpu/util.h"
 
 #include "dev/printk.h"
+#include "mm/fault.h"
 
 #include "gdt.h"
 #include "pic.h"
@@ -110,6 +111,36 @@ void idt_init() {
     idt_load();
 }
 
+enum page_fault_error_code {
+    __PAGE_FAULT_ERROR_PRESENT = 1 << 0,
+    __PAGE_FAULT_ERROR_WRITE = 1 << 1,
+    __PAGE_FAULT_ERROR_USER = 1 << 2,
+    __PAGE_FAULT_ERROR_INSTR_FETCH = 1 << 4,
+};
+
+static bool handle_page_fault_exception(const irq_context_t *const context) {
+    const uint64_t err_code = context->err_code;
+    uint8_t flags = 0;
+
+    if (err_code & __PAGE_FAULT_ERROR_PRESENT) {
+        flags |= __PAGE_FAULT_PRESENT;
+    }
+
+    if (err_code & __PAGE_FAULT_ERROR_WRITE) {
+        flags |= __PAGE_FAULT_WRITE;
+    }
+
+    if (err_code & __PAGE_FAULT_ERROR_USER) {
+        flags |= __PAGE_FAULT_USER;
+    }
+
+    if (err_code & __PAGE_FAULT_ERROR_INSTR_FETCH) {
+        flags |= __PAGE_FAULT_EXEC;
+    }
+
+    return handle_page_fault(read_cr2(), flags) == E_PAGE_FAULT_OK;
+}
+
 void handle_exception(const uint64_t int_no, irq_context_t *const context) {
     switch ((enum exception)int_no) {
         case EXCEPTION_DIVIDE_BY_ZERO:
@@ -155,6 +186,10 @@ void handle_exception(const uint64_t int_no, irq_context_t *const context) {
             printk(LOGLEVEL_ERROR, "General protection fault exception\n");
             break;
         case EXCEPTION_PAGE_FAULT:
+            if (handle_page_fault_exception(context)) {
+                return;
+            }
+
             printk(LOGLEVEL_ERROR,
                    "Page Fault accessing %p from %p\n",
                    (void *)read_cr2(),
@@ -9,6 +9,7 @@
 #include "cpu/isr.h"
 
 #include "dev/printk.h"
+#include "mm/tlb.h"
 
 static isr_func_t g_funcs[256] = {0};
 
@@ -66,6 +67,8 @@ void isr_init() {
     g_spur_vector = isr_alloc_vector();
 
     isr_set_vector(g_spur_vector, spur_tick, &ARCH_ISR_INFO_NONE());
+
+    tlb_init();
     idt_register_exception_handlers();
 }
 
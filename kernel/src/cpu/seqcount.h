@@ -0,0 +1,64 @@
+/*
+ * kernel/src/cpu/seqcount.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "asm/pause.h"
+#include "lib/macros.h"
+
+// A seqcount lets readers access data without a lock, by retrying whenever a
+// writer ran concurrently. The count is odd while a write is in progress.
+// Writers must be serialized by a separate lock.
+
+struct seqcount {
+    _Atomic uint32_t seq;
+};
+
+#define SEQCOUNT_INIT() ((struct seqcount){ .seq = 0 })
+
+__optimize(3) static inline uint32_t
+seqcount_read_begin(const struct seqcount *const count) {
+    while (true) {
+        const uint32_t seq =
+            atomic_load_explicit(&count->seq, memory_order_acquire);
+
+        if ((seq & 1) == 0) {
+            return seq;
+        }
+
+        cpu_pause();
+    }
+}
+
+// Returns true if a writer ran since seqcount_read_begin() returned `seq`, in
+// which case everything read since must be discarded.
+
+__optimize(3) static inline bool
+seqcount_read_retry(const struct seqcount *const count, const uint32_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&count->seq, memory_order_relaxed) != seq;
+}
+
+__optimize(3)
+static inline void seqcount_write_begin(struct seqcount *const count) {
+    atomic_store_explicit(&count->seq,
+                          atomic_load_explicit(&count->seq,
+                                               memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+
+    atomic_thread_fence(memory_order_release);
+}
+
+__optimize(3)
+static inline void seqcount_write_end(struct seqcount *const count) {
+    atomic_store_explicit(&count->seq,
+                          atomic_load_explicit(&count->seq,
+                                               memory_order_relaxed) + 1,
+                          memory_order_release);
+}
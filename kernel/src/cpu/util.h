@@ -8,5 +8,8 @@
 
 __noreturn void cpu_halt();
 
+// Wait until the next interrupt arrives.
+void cpu_idle();
+
 __noreturn void cpu_shutdown();
 __noreturn void cpu_reboot();
\ No newline at end of file
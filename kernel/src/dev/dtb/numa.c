@@ -0,0 +1,185 @@
+/*
+ * kernel/src/dev/dtb/numa.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+#include "fdt/libfdt.h"
+#include "lib/string.h"
+#include "mm/numa.h"
+
+#include "numa.h"
+
+__optimize(3) static inline bool
+read_cells(const fdt32_t **const iter_ptr,
+           const fdt32_t *const end,
+           const int cell_count,
+           uint64_t *const result_out)
+{
+    const fdt32_t *const iter = *iter_ptr;
+    if (cell_count < 0 || cell_count > 2 || iter + cell_count > end) {
+        return false;
+    }
+
+    uint64_t result = 0;
+    for (int i = 0; i != cell_count; i++) {
+        result = result << 32 | fdt32_to_cpu(iter[i]);
+    }
+
+    *result_out = result;
+    *iter_ptr = iter + cell_count;
+
+    return true;
+}
+
+__optimize(3) static bool
+get_node_device_type_is(const void *const dtb,
+                        const int nodeoff,
+                        const char *const type,
+                        const int type_length)
+{
+    int length = 0;
+    const char *const prop = fdt_getprop(dtb, nodeoff, "device_type", &length);
+
+    return prop != NULL &&
+           length == type_length + 1 &&
+           strncmp(prop, type, (size_t)type_length) == 0;
+}
+
+__optimize(3) static bool
+get_numa_node_id(const void *const dtb,
+                 const int nodeoff,
+                 uint32_t *const id_out)
+{
+    int length = 0;
+    const fdt32_t *const prop =
+        fdt_getprop(dtb, nodeoff, "numa-node-id", &length);
+
+    if (prop == NULL || length != sizeof(fdt32_t)) {
+        return false;
+    }
+
+    *id_out = fdt32_to_cpu(*prop);
+    return true;
+}
+
+static void
+add_memory_node(const void *const dtb,
+                const int nodeoff,
+                const int addr_cells,
+                const int size_cells)
+{
+    uint32_t node_id = 0;
+    if (!get_numa_node_id(dtb, nodeoff, &node_id)) {
+        return;
+    }
+
+    int length = 0;
+    const fdt32_t *iter = fdt_getprop(dtb, nodeoff, "reg", &length);
+
+    if (iter == NULL ||
+        length < 0 ||
+        (uint32_t)length % sizeof(fdt32_t) != 0)
+    {
+        printk(LOGLEVEL_WARN, "devicetree: memory node has a malformed reg\n");
+        return;
+    }
+
+    const fdt32_t *const end = iter + (uint32_t)length / sizeof(fdt32_t);
+    while (iter != end) {
+        uint64_t address = 0;
+        uint64_t size = 0;
+
+        if (!read_cells(&iter, end, addr_cells, &address) ||
+            !read_cells(&iter, end, size_cells, &size))
+        {
+            printk(LOGLEVEL_WARN,
+                   "devicetree: memory node has a malformed reg\n");
+            return;
+        }
+
+        if (size != 0) {
+            numa_add_memory_range(node_id, RANGE_INIT(address, size));
+        }
+    }
+}
+
+static void add_cpu_nodes(const void *const dtb) {
+    const int cpus_off = fdt_path_offset(dtb, "/cpus");
+    if (cpus_off < 0) {
+        return;
+    }
+
+    const int addr_cells = fdt_address_cells(dtb, cpus_off);
+    int nodeoff = 0;
+
+    fdt_for_each_subnode(nodeoff, dtb, cpus_off) {
+        if (!get_node_device_type_is(dtb, nodeoff, "cpu", LEN_OF("cpu"))) {
+            continue;
+        }
+
+        uint32_t node_id = 0;
+        if (!get_numa_node_id(dtb, nodeoff, &node_id)) {
+            continue;
+        }
+
+        int length = 0;
+        const fdt32_t *iter = fdt_getprop(dtb, nodeoff, "reg", &length);
+
+        if (iter == NULL || length < 0) {
+            continue;
+        }
+
+        const fdt32_t *const end = iter + (uint32_t)length / sizeof(fdt32_t);
+        uint64_t cpu_id = 0;
+
+        if (read_cells(&iter, end, addr_cells, &cpu_id)) {
+            numa_add_cpu(node_id, NUMA_CPU_ID_DTB_REG, cpu_id);
+        }
+    }
+}
+
+static void add_distance_map(const void *const dtb) {
+    const int nodeoff =
+        fdt_node_offset_by_compatible(dtb, -1, "numa-distance-map-v1");
+
+    if (nodeoff < 0) {
+        return;
+    }
+
+    int length = 0;
+    const fdt32_t *iter =
+        fdt_getprop(dtb, nodeoff, "distance-matrix", &length);
+
+    if (iter == NULL ||
+        length < 0 ||
+        (uint32_t)length % (3 * sizeof(fdt32_t)) != 0)
+    {
+        printk(LOGLEVEL_WARN,
+               "devicetree: distance-map has a malformed distance-matrix\n");
+        return;
+    }
+
+    const fdt32_t *const end = iter + (uint32_t)length / sizeof(fdt32_t);
+    for (; iter != end; iter += 3) {
+        const uint32_t distance = fdt32_to_cpu(iter[2]);
+        numa_set_distance(fdt32_to_cpu(iter[0]),
+                          fdt32_to_cpu(iter[1]),
+                          (uint8_t)min(distance, (uint32_t)UINT8_MAX));
+    }
+}
+
+void dtb_init_numa(const void *const dtb) {
+    const int addr_cells = fdt_address_cells(dtb, /*nodeoffset=*/0);
+    const int size_cells = fdt_size_cells(dtb, /*nodeoffset=*/0);
+
+    int nodeoff = 0;
+    fdt_for_each_subnode(nodeoff, dtb, /*parent=*/0) {
+        if (get_node_device_type_is(dtb, nodeoff, "memory", LEN_OF("memory"))) {
+            add_memory_node(dtb, nodeoff, addr_cells, size_cells);
+        }
+    }
+
+    add_cpu_nodes(dtb);
+    add_distance_map(dtb);
+}
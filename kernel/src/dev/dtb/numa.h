@@ -0,0 +1,12 @@
+/*
+ * kernel/src/dev/dtb/numa.h
+ * © suhas pai
+ */
+
+#pragma once
+
+// Read the numa-node-id of memory and cpu nodes, and the distance-map node,
+// straight from the flattened devicetree. This runs before memory is set up,
+// so before the devicetree is parsed into a tree.
+
+void dtb_init_numa(const void *dtb);
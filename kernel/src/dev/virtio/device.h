@@ -4,7 +4,9 @@
  */
 
 #pragma once
+
 #include "lib/adt/array.h"
+#include "lib/list.h"
 
 #include "mm/mmio.h"
 #include "structs.h"
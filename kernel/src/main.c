@@ -17,8 +17,14 @@
 #include "dev/init.h"
 #include "dev/printk.h"
 
+#include "lib/align.h"
+
 #include "mm/early.h"
+#include "mm/idle.h"
 #include "mm/page_alloc.h"
+#include "mm/pgmap.h"
+#include "mm/vmalloc.h"
+#include "mm/walker.h"
 
 #include "sys/boot.h"
 
@@ -52,6 +58,44 @@ static void test_alloc_largepage() {
     }
 }
 
+// Unmap a range whose middle has no leaf table, which must go over the hole
+// without failing or allocating a table for it.
+
+static void test_unmap_hole() {
+    const uint64_t table_size = PAGE_SIZE_AT_LEVEL(2);
+    void *const buffer = vmalloc(table_size * 2 - PAGE_SIZE);
+
+    if (buffer == NULL) {
+        printk(LOGLEVEL_WARN, "kernel: failed to vmalloc for unmap test\n");
+        return;
+    }
+
+    const uint64_t hole = align_up_assert((uint64_t)buffer, table_size);
+    const struct pgunmap_options options = {
+        .free_pages = true,
+        .dont_split_large_pages = true
+    };
+
+    assert(
+        arch_unmap_mapping(&kernel_pagemap,
+                           RANGE_INIT(hole, table_size),
+                           /*map_options=*/NULL,
+                           &options));
+
+    // vfree() unmaps the whole buffer, including the hole.
+    vfree(buffer);
+
+    struct pt_walker walker;
+    ptwalker_default_for_pagemap(&walker, &kernel_pagemap, hole);
+
+    if (walker.level == 1) {
+        printk(LOGLEVEL_WARN, "kernel: unmap allocated a table for a hole\n");
+        return;
+    }
+
+    printk(LOGLEVEL_INFO, "kernel: unmapped a range with a hole\n");
+}
+
 void arch_init();
 void arch_early_init();
 void arch_post_mm_init();
@@ -88,6 +132,7 @@ void _start(void) {
     dev_init();
 
     test_alloc_largepage();
+    test_unmap_hole();
     printk(LOGLEVEL_INFO, "kernel: finished initializing\n");
 
     // We're done, just hang...
@@ -97,5 +142,8 @@ void _start(void) {
     sched_init(NULL);
 #endif
 
-    cpu_halt();
+    while (true) {
+        mm_idle();
+        cpu_idle();
+    }
 }
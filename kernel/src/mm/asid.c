@@ -0,0 +1,67 @@
+/*
+ * kernel/src/mm/asid.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "cpu/info.h"
+#include "dev/printk.h"
+
+#include "asid.h"
+#include "pagemap.h"
+
+static uint8_t g_asid_slot_count = 0;
+
+void asid_init(const uint64_t asid_count) {
+    if (asid_count <= 1) {
+        return;
+    }
+
+    g_asid_slot_count = (uint8_t)min(asid_count - 1, (uint64_t)ASID_SLOT_COUNT);
+    printk(LOGLEVEL_INFO,
+           "mm: using %" PRIu8 " asids per cpu\n",
+           g_asid_slot_count);
+}
+
+__optimize(3) uint16_t
+asid_for_pagemap(struct pagemap *const pagemap, bool *const flush_out) {
+    if (g_asid_slot_count == 0) {
+        *flush_out = true;
+        return 0;
+    }
+
+    // kernel_pagemap is shot down on every cpu, so its entries are never
+    // stale.
+
+    if (pagemap == &kernel_pagemap) {
+        *flush_out = false;
+        return 0;
+    }
+
+    struct cpu_asid_cache *const cache = &this_cpu_mut()->asid_cache;
+    const uint64_t generation = atomic_load(&pagemap->tlb_generation);
+
+    for (uint8_t i = 0; i != g_asid_slot_count; i++) {
+        struct asid_slot *const slot = &cache->slot_list[i];
+        if (slot->pagemap_id != pagemap->id) {
+            continue;
+        }
+
+        *flush_out = slot->tlb_generation != generation;
+        slot->tlb_generation = generation;
+
+        return i + 1;
+    }
+
+    const uint8_t index = cache->next_slot;
+    cache->next_slot = (index + 1) % g_asid_slot_count;
+
+    struct asid_slot *const slot = &cache->slot_list[index];
+
+    slot->pagemap_id = pagemap->id;
+    slot->tlb_generation = generation;
+
+    *flush_out = true;
+    return index + 1;
+}
@@ -0,0 +1,46 @@
+/*
+ * kernel/src/mm/asid.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// An asid (pcid on x86_64) tags a pagemap's tlb entries, so switching to
+// another pagemap doesn't flush them. Each cpu keeps the pagemaps it most
+// recently ran in a small set of slots, handing the oldest slot's asid to a
+// pagemap that isn't in any slot.
+// asid 0 always belongs to kernel_pagemap.
+
+#define ASID_SLOT_COUNT 8
+
+struct asid_slot {
+    uint64_t pagemap_id;
+
+    // The pagemap's tlb_generation when this cpu last flushed its entries. A
+    // pagemap's entries are shot down only on the cpus running it, so a cpu
+    // that ran the pagemap before has to flush its entries if the generation
+    // has since moved on.
+
+    uint64_t tlb_generation;
+};
+
+struct cpu_asid_cache {
+    struct asid_slot slot_list[ASID_SLOT_COUNT];
+    uint8_t next_slot;
+};
+
+struct pagemap;
+
+// Called by arch code with the amount of asids the hardware supports. Without
+// this call, every pagemap gets asid 0 and is flushed when switched to.
+
+void asid_init(uint64_t asid_count);
+
+// Returns the asid this cpu should use for the pagemap, and in `flush_out`
+// whether the asid's tlb entries have to be flushed first. Caller is required
+// to hold the pagemap's cpu_lock.
+
+uint16_t asid_for_pagemap(struct pagemap *pagemap, bool *flush_out);
@@ -0,0 +1,461 @@
+/*
+ * kernel/src/mm/compact.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "lib/align.h"
+#include "lib/string.h"
+#include "sys/boot.h"
+
+#include "compact.h"
+#include "pagemap.h"
+#include "walker.h"
+#include "zone.h"
+
+// Blocks needing more migrations than this are skipped when compacting in the
+// background, so that a single idle call stays cheap.
+
+#define COMPACT_IDLE_MAX_MIGRATE_COUNT 64
+
+// Amount of candidate blocks looked at in a single idle call.
+#define COMPACT_IDLE_SCAN_COUNT 8
+
+// Returns the amount of movable pages in [begin, end), or -1 if the range has a
+// page that can't be moved, or a free block extending past the range.
+// If `isolate` is true, free blocks are taken off their freelist as they're
+// found, and the caller is required to hold section's lock.
+// Isolated blocks belong to whichever compaction isolated them, so they're only
+// accepted with `accept_isolated`, by a compaction rescanning its own block.
+
+__optimize(3) static int64_t
+scan_block(struct page_section *const section,
+           struct page *const begin,
+           const struct page *const end,
+           const bool isolate,
+           const bool accept_isolated)
+{
+    int64_t movable_count = 0;
+    for (struct page *page = begin; page < end;) {
+        const enum page_state state = page_get_state(page);
+        if (state == PAGE_STATE_FREE_LIST_HEAD) {
+            const uint64_t count = 1ull << page->freelist_head.order;
+            if (count > (uint64_t)(end - page)) {
+                return -1;
+            }
+
+            if (isolate) {
+                isolate_free_block(section, page);
+            }
+
+            page += count;
+        } else if (state == PAGE_STATE_ISOLATED && accept_isolated) {
+            page += 1ull << page->freelist_head.order;
+        } else if (state == PAGE_STATE_USED && page_is_movable(page)) {
+            movable_count++;
+            page++;
+        } else {
+            return -1;
+        }
+    }
+
+    return movable_count;
+}
+
+// Return every isolated block in [begin, end) to the freelist. Caller is
+// required to hold section's lock.
+
+__optimize(3) static void
+release_isolated_range(struct page *const begin, const struct page *const end) {
+    for (struct page *page = begin; page < end;) {
+        if (page_get_state(page) != PAGE_STATE_ISOLATED) {
+            page++;
+            continue;
+        }
+
+        // Clear the isolated state of every block in the run so a stale state
+        // isn't mistaken for an isolated block later on.
+
+        struct page *const run = page;
+        do {
+            const uint64_t count = 1ull << page->freelist_head.order;
+            page_set_state(page, PAGE_STATE_IN_FREE_LIST);
+
+            page += count;
+        } while (page < end && page_get_state(page) == PAGE_STATE_ISOLATED);
+
+        free_amount_of_pages(run, (uint64_t)(page - run));
+    }
+}
+
+// Copy a movable page into a newly allocated page, and point the page's only
+// mapping at the copy. On success, the old page is left isolated.
+// Anonymous ptes are only changed with their vm_area's lock held, so the lock
+// is held across the swap to keep a fault from installing a page in between.
+
+static bool migrate_page(struct page *const page) {
+    if (!page_is_movable(page)) {
+        return false;
+    }
+
+    // The rmap shares its space with the delayed-free list, which deref_page()
+    // only writes to after clearing the movable flag, so the rmap we read is
+    // only valid if the page is still movable after.
+
+    struct pagemap *const pagemap = page->used.rmap.pagemap;
+    const uint64_t virt = page->used.rmap.virt;
+
+    atomic_thread_fence(memory_order_acquire);
+    if (!page_is_movable(page)) {
+        return false;
+    }
+
+    struct page *const new_page = alloc_page(PAGE_STATE_USED, /*flags=*/0);
+    if (__builtin_expect(new_page == NULL, 0)) {
+        return false;
+    }
+
+    // Keep the pagemap alive while we look through it.
+    ref_up(&pagemap->refcount);
+
+    int flag = 0;
+    struct vm_area *const vma = pagemap_find_vma_and_lock(pagemap, virt, &flag);
+
+    if (vma == NULL) {
+        ref_down(&pagemap->refcount);
+        free_page(new_page);
+
+        return false;
+    }
+
+    // Check again now that the page's mapping can't change underneath us.
+    if (!page_is_movable(page) ||
+        page->used.rmap.pagemap != pagemap ||
+        page->used.rmap.virt != virt)
+    {
+        goto fail;
+    }
+
+    struct pt_walker walker;
+    ptwalker_default_for_pagemap(&walker, pagemap, virt);
+
+    if (walker.level != 1) {
+        goto fail;
+    }
+
+    pte_t *const pte_ptr =
+        walker.tables[walker.level - 1] + walker.indices[walker.level - 1];
+
+    const pte_t pte = pte_read(pte_ptr);
+    if (!pte_is_present(pte) || pte_to_phys(pte) != page_to_phys(page)) {
+        goto fail;
+    }
+
+    // Unmap the page before copying it so no writes to the page are lost.
+    pte_write(pte_ptr, 0);
+
+    struct pageop pageop;
+    pageop_init(&pageop, pagemap, RANGE_INIT(virt, PAGE_SIZE));
+    pageop_finish(&pageop);
+
+    memcpy(page_to_virt(new_page), page_to_virt(page), PAGE_SIZE);
+    pte_write(pte_ptr,
+              phys_create_pte(page_to_phys(new_page)) |
+              (pte & ~(pte_t)PTE_PHYS_MASK));
+
+    page_set_movable(new_page, pagemap, virt);
+
+    spin_release_with_irq(&vma->lock, flag);
+    ref_down(&pagemap->refcount);
+
+    page_clear_flag(page, __PAGE_IS_MOVABLE);
+    page->freelist_head.order = 0;
+    page_set_state(page, PAGE_STATE_ISOLATED);
+
+    return true;
+
+fail:
+    spin_release_with_irq(&vma->lock, flag);
+    ref_down(&pagemap->refcount);
+
+    free_page(new_page);
+    return false;
+}
+
+// Isolate the free blocks of the naturally aligned block at `begin`, then
+// migrate its movable pages. Returns true if every page of the block ended up
+// isolated, otherwise the block's isolated pages are returned to the freelist.
+// Only one block of a section is compacted at a time, so every isolated page
+// found in the block while compacting it was isolated by us.
+
+static bool
+compact_block(struct page_section *const section,
+              struct page *const begin,
+              const uint8_t order)
+{
+    const struct page *const end = begin + (1ull << order);
+    int flag = spin_acquire_with_irq(&section->lock);
+
+    if (section->compacting ||
+        scan_block(section,
+                   begin,
+                   end,
+                   /*isolate=*/false,
+                   /*accept_isolated=*/false) < 0)
+    {
+        spin_release_with_irq(&section->lock, flag);
+        return false;
+    }
+
+    section->compacting = true;
+
+    bool result =
+        scan_block(section,
+                   begin,
+                   end,
+                   /*isolate=*/true,
+                   /*accept_isolated=*/false) >= 0;
+
+    spin_release_with_irq(&section->lock, flag);
+
+    if (result) {
+        for (struct page *page = begin; page < end;) {
+            if (page_get_state(page) == PAGE_STATE_ISOLATED) {
+                page += 1ull << page->freelist_head.order;
+                continue;
+            }
+
+            if (!migrate_page(page)) {
+                result = false;
+                break;
+            }
+
+            page++;
+        }
+    }
+
+    flag = spin_acquire_with_irq(&section->lock);
+
+    // Pages freed while we were migrating may have been put back on the
+    // freelist.
+
+    if (result) {
+        result =
+            scan_block(section,
+                       begin,
+                       end,
+                       /*isolate=*/true,
+                       /*accept_isolated=*/true) == 0;
+    }
+
+    if (!result) {
+        release_isolated_range(begin, end);
+    }
+
+    section->compacting = false;
+    spin_release_with_irq(&section->lock, flag);
+
+    return result;
+}
+
+struct compact_candidate {
+    struct page_section *section;
+    struct page *begin;
+
+    int64_t movable_count;
+};
+
+// Returns the naturally aligned block of `order` at or after `phys` in the
+// section, or NULL if the section has no such block left. `phys` is updated to
+// point past the returned block.
+
+__optimize(3) static struct page *
+next_block_in_section(struct page_section *const section,
+                      const uint8_t order,
+                      uint64_t *const phys_in_out)
+{
+    const uint64_t block_size = PAGE_SIZE << order;
+    uint64_t phys = max(*phys_in_out, section->range.front);
+
+    if (!align_up(phys, block_size, &phys)) {
+        return NULL;
+    }
+
+    const uint64_t section_end = range_get_end_assert(section->range);
+    if (phys >= section_end || section_end - phys < block_size) {
+        return NULL;
+    }
+
+    *phys_in_out = phys + block_size;
+    return pfn_to_page(section->pfn +
+                       ((phys - section->range.front) >> PAGE_SHIFT));
+}
+
+__optimize(3) static void
+find_best_block_in_section(struct page_section *const section,
+                           const uint8_t order,
+                           struct compact_candidate *const best)
+{
+    uint64_t phys = 0;
+    do {
+        struct page *const begin = next_block_in_section(section, order, &phys);
+        if (begin == NULL) {
+            break;
+        }
+
+        const int64_t movable_count =
+            scan_block(section,
+                       begin,
+                       begin + (1ull << order),
+                       /*isolate=*/false,
+                       /*accept_isolated=*/false);
+
+        if (movable_count < 0) {
+            continue;
+        }
+
+        if (best->section == NULL || movable_count < best->movable_count) {
+            best->section = section;
+            best->begin = begin;
+            best->movable_count = movable_count;
+
+            if (movable_count == 0) {
+                break;
+            }
+        }
+    } while (true);
+}
+
+struct page *
+compact_zone_for_order(struct page_zone *const zone, const uint8_t order) {
+    if (__builtin_expect(order >= MAX_ORDER, 0)) {
+        return NULL;
+    }
+
+    if (atomic_load(&zone->total_free) < (1ull << order)) {
+        return NULL;
+    }
+
+    struct compact_candidate best = {
+        .section = NULL,
+        .begin = NULL,
+        .movable_count = 0
+    };
+
+    struct page_section *iter = NULL;
+    list_foreach(iter, &zone->section_list, zone_list) {
+        find_best_block_in_section(iter, order, &best);
+        if (best.section != NULL && best.movable_count == 0) {
+            break;
+        }
+    }
+
+    if (best.section == NULL) {
+        return NULL;
+    }
+
+    if (!compact_block(best.section, best.begin, order)) {
+        return NULL;
+    }
+
+    return best.begin;
+}
+
+__optimize(3) static uint8_t idle_compact_order() {
+    for (uint8_t i = 0; i != countof(LARGEPAGE_LEVELS); i++) {
+        const struct largepage_level_info *const info =
+            &largepage_level_info_list[LARGEPAGE_LEVELS[i] - 1];
+
+        if (info->is_supported) {
+            return info->order;
+        }
+    }
+
+    return MAX_ORDER;
+}
+
+__optimize(3) static bool
+zone_needs_compaction(struct page_zone *const zone, const uint8_t order) {
+    if (atomic_load(&zone->total_free) < (2ull << order)) {
+        return false;
+    }
+
+    struct page_section *iter = NULL;
+    list_foreach(iter, &zone->section_list, zone_list) {
+        if (iter->order_mask >> order != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static _Atomic bool g_idle_compacting = false;
+
+static uint8_t g_idle_section_index = 0;
+static uint64_t g_idle_phys = 0;
+
+void compact_idle() {
+    const uint8_t order = idle_compact_order();
+    if (order >= MAX_ORDER) {
+        return;
+    }
+
+    const uint8_t section_count = mm_get_section_count();
+    if (section_count == 0) {
+        return;
+    }
+
+    // Only one cpu compacts in the background at a time.
+    if (atomic_exchange(&g_idle_compacting, true)) {
+        return;
+    }
+
+    struct page_section *const section_list = mm_get_page_section_list();
+    for (uint32_t i = 0; i != COMPACT_IDLE_SCAN_COUNT; i++) {
+        if (g_idle_section_index >= section_count) {
+            g_idle_section_index = 0;
+        }
+
+        struct page_section *const section =
+            &section_list[g_idle_section_index];
+
+        struct page *begin = NULL;
+        if (zone_needs_compaction(section->zone, order)) {
+            begin = next_block_in_section(section, order, &g_idle_phys);
+        }
+
+        if (begin == NULL) {
+            g_idle_section_index++;
+            g_idle_phys = 0;
+
+            continue;
+        }
+
+        const struct page *const end = begin + (1ull << order);
+        const int64_t movable_count =
+            scan_block(section,
+                       begin,
+                       end,
+                       /*isolate=*/false,
+                       /*accept_isolated=*/false);
+
+        if (movable_count < 0 ||
+            movable_count > COMPACT_IDLE_MAX_MIGRATE_COUNT)
+        {
+            continue;
+        }
+
+        if (compact_block(section, begin, order)) {
+            const int flag = spin_acquire_with_irq(&section->lock);
+
+            release_isolated_range(begin, end);
+            spin_release_with_irq(&section->lock, flag);
+        }
+
+        break;
+    }
+
+    atomic_store(&g_idle_compacting, false);
+}
@@ -0,0 +1,23 @@
+/*
+ * kernel/src/mm/compact.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "page.h"
+
+// Compaction migrates movable pages out of a naturally aligned block so the
+// block's free pages can be merged into a single block of the given order.
+
+struct page_zone;
+
+// Compact the block in `zone` needing the fewest migrations. On success, the
+// block's pages are returned isolated, ready to be handed out as a large page.
+
+struct page *compact_zone_for_order(struct page_zone *zone, uint8_t order);
+
+// Compact at most one block of the smallest supported large-page order, and
+// only when a zone has no free block of that order. Meant to be called when
+// the cpu goes idle.
+
+void compact_idle();
@@ -0,0 +1,75 @@
+/*
+ * kernel/src/mm/cpu_page_cache.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lib/list.h"
+
+// Blocks with an order below CPU_PAGE_CACHE_ORDER_COUNT are served from a
+// per-cpu cache that sits in front of the buddy allocator, so the common
+// single-page case doesn't need to take any section's lock.
+
+#define CPU_PAGE_CACHE_ORDER_COUNT 4
+
+// Amount of order-0 blocks moved between a cpu's cache and the buddy allocator
+// in one batch. Higher orders move proportionally fewer blocks.
+
+#define CPU_PAGE_CACHE_BATCH_COUNT 32
+
+// Amount of batches a list may hold before a batch is drained back to the
+// buddy allocator.
+
+#define CPU_PAGE_CACHE_HIGH_BATCH_COUNT 4
+
+struct cpu_page_list {
+    struct list page_list;
+    uint32_t count;
+};
+
+// Page-tables freed on a cpu are cleaned and kept in its cache for
+// alloc_table(), instead of going back to the buddy allocator. Each cpu keeps
+// at most `table_limit` tables, a limit that follows the amount of tables the
+// cpu freed between idle calls, clamped to [CPU_TABLE_CACHE_MIN_COUNT,
+// CPU_TABLE_CACHE_MAX_COUNT].
+
+#define CPU_TABLE_CACHE_MIN_COUNT 8
+#define CPU_TABLE_CACHE_MAX_COUNT 256
+
+struct cpu_page_cache {
+    struct cpu_page_list list[CPU_PAGE_CACHE_ORDER_COUNT];
+
+    struct cpu_page_list table_list;
+    uint32_t table_limit;
+
+    // Tables freed since the cache was last trimmed.
+    uint32_t table_free_count;
+
+    // Set by cpu_page_cache_init(). A cpu whose cache isn't ready yet uses the
+    // buddy allocator directly.
+
+    bool ready;
+};
+
+// Called wherever a cpu_info is created, before the cpu can allocate pages.
+void cpu_page_cache_init(struct cpu_page_cache *cache);
+
+// Initialize the boot cpu's cache. Caches aren't looked up before this is
+// called, as this_cpu() can't be used until the arch has set up the boot cpu.
+
+void cpu_page_cache_init_boot();
+
+// Return all blocks in the current cpu's cache to the buddy allocator. Returns
+// true if any blocks were returned.
+
+bool cpu_page_cache_drain();
+
+// Return blocks in the current cpu's cache so that each list holds at most one
+// batch, and resize the cpu's table cache. Meant to be called when the cpu goes
+// idle.
+
+void cpu_page_cache_trim();
@@ -0,0 +1,31 @@
+/*
+ * kernel/src/mm/cpu_slab_cache.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+
+// Slab allocators keep a pair of magazines, stacks of free objects, on every
+// cpu, so the common case of slab_alloc() and slab_free() only touches memory
+// local to the cpu, without taking any lock.
+
+// Amount of slab allocators that may have per-cpu magazines. Allocators made
+// after this limit is reached go directly to their slabs instead.
+
+#define CPU_SLAB_CACHE_MAX 32
+
+struct slab_magazine;
+struct cpu_slab_magazines {
+    // Magazine objects are allocated from and freed to.
+    struct slab_magazine *loaded;
+
+    // Magazine swapped with the loaded one once it's empty on alloc, or full
+    // on free, so that alternating allocs and frees don't go to the depot.
+
+    struct slab_magazine *previous;
+};
+
+struct cpu_slab_cache {
+    struct cpu_slab_magazines list[CPU_SLAB_CACHE_MAX];
+};
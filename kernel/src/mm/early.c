@@ -3,14 +3,21 @@
  * © suhas pai
  */
 
+#include <stdatomic.h>
+
+#include "asm/cycles.h"
+#include "cpu/info.h"
 #include "dev/printk.h"
 #include "lib/align.h"
+#include "lib/size.h"
 #include "sys/boot.h"
 
 #include "early.h"
 #include "kmalloc.h"
 #include "memmap.h"
+#include "numa.h"
 #include "pagemap.h"
+#include "vma.h"
 #include "walker.h"
 #include "zone.h"
 
@@ -633,126 +640,260 @@ static void mark_crucial_pages(const struct page_section *const memmap) {
     }
 }
 
-__optimize(3) static void
-set_section_for_pages(const struct page_section *const memmap,
-                      const page_section_t section)
-{
-    struct freepages_info *iter = NULL;
-    list_foreach(iter, &g_freepage_list, list) {
-        uint64_t iter_phys = virt_to_phys(iter);
-        uint64_t back_phys =
-            iter_phys + (iter->avail_page_count << PAGE_SHIFT) - PAGE_SIZE;
+// Free memory is handed to the buddy allocator in blocks, and only until
+// EARLY_INIT_PAGE_COUNT pages are free. The struct pages of the remaining free
+// memory are initialized later, in bounded chunks when the cpu is idle, or all
+// at once when an allocation would otherwise fail.
 
-        if (!range_has_loc(memmap->range, iter_phys)) {
-            if (!range_has_loc(memmap->range, back_phys)) {
-                continue;
-            }
+#define EARLY_INIT_PAGE_COUNT PAGE_COUNT(mib(256))
+
+// Amount of struct pages initialized in a single idle call.
+#define DEFERRED_INIT_IDLE_PAGE_COUNT 8192
+
+struct free_block_cursor {
+    // Free pages after the current block that haven't been initialized yet.
+    uint64_t phys;
+    uint64_t avail;
+
+    // Block whose struct pages are being initialized. The block is only freed
+    // once all of its struct pages are.
+
+    struct page_section *section;
+    struct page *block;
+
+    uint64_t init_count;
+    uint8_t order;
+};
+
+static struct free_block_cursor g_free_cursor = {
+    .phys = 0,
+    .avail = 0,
+    .section = NULL,
+    .block = NULL,
+    .init_count = 0,
+    .order = 0
+};
+
+static struct spinlock g_deferred_lock = SPINLOCK_INIT();
+static _Atomic bool g_deferred_init_done = false;
 
-            // This memmap has pages inside iter's range, but not starting at
-            // iter's range.
+static uint64_t g_early_init_cycles = 0;
+static uint64_t g_deferred_init_cycles = 0;
+static uint64_t g_deferred_page_count = 0;
 
-            iter_phys = memmap->range.front;
+/*
+ * Find the next block of free pages to initialize while ensuring
+ *  (1) The range of pages belong to the same section, and so the same zone.
+ *  (2) The buddies of the first page for each order from 0...order are
+ *      located after the first page.
+ *
+ * Areas are taken from the largest to the smallest, so that smaller areas are
+ * the ones left for last.
+ */
+
+__optimize(3) static bool cursor_next_block(const uint8_t max_order) {
+    struct free_block_cursor *const cursor = &g_free_cursor;
+    if (cursor->avail == 0) {
+        if (list_empty(&g_asc_freelist)) {
+            return false;
         }
 
-        back_phys =
-            min(range_get_end_assert(memmap->range) - PAGE_SIZE, back_phys);
+        // The freepages_info struct is stored in the area's first page, so it
+        // has to be taken off the list before any of the area is freed.
 
-        // Mark all usable pages that exist from in iter.
-        struct page *page = phys_to_page(iter_phys);
-        const struct page *const end = phys_to_page(back_phys) + 1;
+        struct freepages_info *const info =
+            list_tail(&g_asc_freelist, struct freepages_info, asc_list);
 
-        for (; page != end; page++) {
-            page->section = section;
+        cursor->phys = virt_to_phys(info);
+        cursor->avail = info->avail_page_count;
+
+        list_delete(&info->asc_list);
+    }
+
+    int8_t iorder = (int8_t)max_order - 1;
+    for (; iorder >= 0; iorder--) {
+        if (cursor->avail >= (1ull << iorder)) {
+            break;
         }
     }
+
+    // jorder is the order of pages that all fit in the same section.
+    // jorder should be equal to iorder in most cases, except in the case where
+    // an area crosses the boundary of two sections.
+
+    struct page_section *const section = phys_to_section(cursor->phys);
+
+    int8_t jorder = iorder;
+    for (; jorder > 0; jorder--) {
+        const uint64_t back_phys =
+            cursor->phys + (((1ull << jorder) - 1) << PAGE_SHIFT);
+
+        if (range_has_loc(section->range, back_phys)) {
+            break;
+        }
+    }
+
+    const uint64_t count = 1ull << jorder;
+
+    cursor->section = section;
+    cursor->block = phys_to_page(cursor->phys);
+    cursor->init_count = 0;
+    cursor->order = (uint8_t)jorder;
+
+    cursor->phys += count << PAGE_SHIFT;
+    cursor->avail -= count;
+
+    return true;
 }
 
-__optimize(3) static uint64_t free_all_pages() {
-    struct freepages_info *iter = NULL;
-    struct freepages_info *tmp = NULL;
+// Initialize the struct pages of at most `limit` free pages, freeing each block
+// once all of its struct pages are initialized. Returns the amount of pages
+// freed.
 
-    /*
-     * Free pages into the buddy allocator while ensuring
-     *  (1) The range of pages belong to the same zone.
-     *  (2) The buddies of the first page for each order from 0...order are
-     *      located after the first page.
-     */
+__optimize(3)
+static uint64_t init_free_pages(uint64_t limit, const uint8_t max_order) {
+    struct free_block_cursor *const cursor = &g_free_cursor;
+    struct page_section *const section_list = mm_get_page_section_list();
 
     uint64_t free_page_count = 0;
-    list_foreach_reverse_mut(iter, tmp, &g_asc_freelist, asc_list) {
-        uint64_t phys = virt_to_phys(iter);
-        uint64_t avail = iter->avail_page_count;
+    while (limit != 0) {
+        if (cursor->block == NULL && !cursor_next_block(max_order)) {
+            break;
+        }
 
-        struct page *page = phys_to_page(phys);
-        struct page_section *section = page_to_section(page);
+        const uint64_t block_count = 1ull << cursor->order;
+        const uint64_t count = min(block_count - cursor->init_count, limit);
 
-        // iorder is log2() of the count of available pages, here we use a for
-        // loop to calculate log2(), but in the future, it may be worth it to
-        // directly use log2() if available.
-        // Because the count of available pages only decreases, we only perform
-        // a log2() operation once.
+        // Start section-numbers at one so we can see if there's any pages
+        // missing a section, which would have a section of 0.
 
-        int8_t iorder = MAX_ORDER - 1;
+        const page_section_t number =
+            (page_section_t)(cursor->section - section_list) + 1;
 
-        do {
-            for (; iorder >= 0; iorder--) {
-                if (avail >= (1ull << iorder)) {
-                    break;
-                }
-            }
+        struct page *page = cursor->block + cursor->init_count;
+        const struct page *const end = page + count;
 
-            // jorder is the order of pages that all fit in the same zone.
-            // jorder should be equal to iorder in most cases, except in the
-            // case where a section crosses the boundary of two zones.
+        for (; page != end; page++) {
+            page->section = number;
+        }
 
-            int8_t jorder = iorder;
-            for (; jorder >= 0; jorder--) {
-                const struct page *const back_page =
-                    page + ((1ull << jorder) - 1);
+        cursor->init_count += count;
+        limit -= count;
 
-                if (section == page_to_section(back_page)) {
-                    break;
-                }
-            }
+        if (cursor->init_count != block_count) {
+            break;
+        }
 
-            const uint8_t highest_jorder = (uint8_t)jorder;
-            if (section->max_order <= highest_jorder) {
-                section->max_order = highest_jorder + 1;
-            }
+        struct page_section *const section = cursor->section;
+        const int flag = spin_acquire_with_irq(&section->lock);
 
-            const uint64_t free_count = 1ull << jorder;
-            early_free_pages_from_section(page, section, (uint8_t)jorder);
+        early_free_pages_from_section(cursor->block, section, cursor->order);
+        spin_release_with_irq(&section->lock, flag);
 
-            if (section->min_order > (uint8_t)jorder) {
-                section->min_order = (uint8_t)jorder;
-            }
+        const struct range freed_range =
+            RANGE_INIT(page_to_phys(cursor->block), block_count << PAGE_SHIFT);
+
+        printk(LOGLEVEL_INFO,
+               "mm: freed %" PRIu64 " pages at " RANGE_FMT " to zone %s\n",
+               block_count,
+               RANGE_FMT_ARGS(freed_range),
+               section->zone->name);
 
-            const struct range freed_range =
-                RANGE_INIT(phys, free_count << PAGE_SHIFT);
+        free_page_count += block_count;
+        cursor->block = NULL;
+    }
 
-            printk(LOGLEVEL_INFO,
-                   "mm: freed %" PRIu64 " pages at " RANGE_FMT " to zone %s\n",
-                   free_count,
-                   RANGE_FMT_ARGS(freed_range),
-                   section->zone->name);
+    return free_page_count;
+}
 
-            avail -= free_count;
-            if (avail == 0) {
-                break;
-            }
+// Blocks freed at boot are kept to at most EARLY_INIT_PAGE_COUNT pages, so a
+// single large block doesn't have to be fully initialized before boot finishes.
+
+__optimize(3) static uint8_t early_init_max_order() {
+    uint8_t order = 1;
+    while (order != MAX_ORDER && (1ull << order) <= EARLY_INIT_PAGE_COUNT) {
+        order++;
+    }
+
+    return order;
+}
+
+__optimize(3) static uint64_t free_early_pages() {
+    const uint64_t begin_cycles = read_cycle_count();
+    const uint8_t max_order = early_init_max_order();
 
-            page += free_count;
-            phys += freed_range.size;
-            section = page_to_section(page);
-        } while (true);
+    uint64_t free_page_count = 0;
+    while (free_page_count < EARLY_INIT_PAGE_COUNT) {
+        const uint64_t count = init_free_pages(UINT64_MAX, max_order);
+        if (count == 0) {
+            break;
+        }
 
-        list_delete(&iter->list);
-        free_page_count += iter->avail_page_count;
+        free_page_count += count;
+    }
+
+    g_early_init_cycles = read_cycle_count() - begin_cycles;
+    g_deferred_page_count = g_total_free_pages_remaining - free_page_count;
+
+    if (g_deferred_page_count == 0) {
+        atomic_store(&g_deferred_init_done, true);
     }
 
     return free_page_count;
 }
 
+// Caller is required to hold g_deferred_lock.
+
+__optimize(3) static bool init_deferred_pages(const uint64_t limit) {
+    if (atomic_load(&g_deferred_init_done)) {
+        return false;
+    }
+
+    const uint64_t begin_cycles = read_cycle_count();
+    const uint64_t free_page_count = init_free_pages(limit, MAX_ORDER);
+
+    g_deferred_init_cycles += read_cycle_count() - begin_cycles;
+    if (g_free_cursor.block == NULL && g_free_cursor.avail == 0 &&
+        list_empty(&g_asc_freelist))
+    {
+        atomic_store(&g_deferred_init_done, true);
+        printk(LOGLEVEL_INFO,
+               "mm: finished deferred init of %" PRIu64 " pages in %" PRIu64
+               " cycles, %" PRIu64 " cycles were spent at boot\n",
+               g_deferred_page_count,
+               g_deferred_init_cycles,
+               g_early_init_cycles);
+    }
+
+    return free_page_count != 0;
+}
+
+void mm_deferred_init_idle() {
+    if (atomic_load(&g_deferred_init_done)) {
+        return;
+    }
+
+    int flag = 0;
+    if (!spin_try_acquire_with_irq(&g_deferred_lock, &flag)) {
+        return;
+    }
+
+    init_deferred_pages(DEFERRED_INIT_IDLE_PAGE_COUNT);
+    spin_release_with_irq(&g_deferred_lock, flag);
+}
+
+bool mm_finish_deferred_init() {
+    if (atomic_load(&g_deferred_init_done)) {
+        return false;
+    }
+
+    const int flag = spin_acquire_with_irq(&g_deferred_lock);
+    const bool result = init_deferred_pages(UINT64_MAX);
+
+    spin_release_with_irq(&g_deferred_lock, flag);
+    return result;
+}
+
 extern struct page_section *boot_add_section_at(struct page_section *section);
 
 __optimize(3) static inline void
@@ -770,6 +911,16 @@ split_section_at_boundary(struct page_section *const section,
 
     struct page_section *const new_section = boot_add_section_at(section);
     page_section_init(new_section, zone, new_section_range, new_section_pfn);
+
+    // Sections after the new one were moved up, breaking their lists, which
+    // are all still empty at this point.
+
+    struct page_section *const end =
+        mm_get_page_section_list() + mm_get_section_count();
+
+    for (struct page_section *iter = new_section + 1; iter != end; iter++) {
+        page_section_init(iter, iter->zone, iter->range, iter->pfn);
+    }
 }
 
 __optimize(3) static inline
@@ -845,11 +996,10 @@ void mm_post_arch_init() {
         }
     }
 
-    // Iterate over the usable-memmaps (sections)  times:
-    //  1. Iterate to mark used-pages first. This must be done first because
-    //     it needs to be done before memmaps are merged, as before the merge,
-    //     its obvious which pages are used.
-    //  2. Set the section field in page->flags.
+    // Iterate over the usable-memmaps (sections) to mark used-pages first.
+    // This must be done first because it needs to be done before memmaps are
+    // merged, as before the merge, its obvious which pages are used.
+    // The section field of free pages is set later, as they're freed.
 
     struct page_section *const begin = mm_get_page_section_list();
     const struct page_section *const end = begin + mm_get_section_count();
@@ -859,21 +1009,31 @@ void mm_post_arch_init() {
     }
 
     boot_merge_usable_memmaps();
+
+    // Zones for memory above 4gib are per numa node, so the nodes have to be
+    // found before sections are split across zones.
+
+    numa_init();
     split_sections_for_zones();
     setup_zone_section_list();
 
-    // Start section-numbers at one so we can see if there's any pages missing
-    // a section, which would have a section of 0.
+    // The address-ordered list is only needed to mark crucial pages, and its
+    // entries are stored in pages that are freed out of address order from
+    // here on.
 
-    uint64_t number = 1;
-    for (__auto_type section = begin; section != end; section++, number++) {
-        set_section_for_pages(section, /*section=*/number);
-    }
-
-    printk(LOGLEVEL_INFO, "mm: finished setting up structpage table\n");
+    list_init(&g_freepage_list);
     pagezones_init();
 
-    const uint64_t free_page_count = free_all_pages();
+    const uint64_t free_page_count = free_early_pages();
+    cpu_page_cache_init_boot();
+
+    printk(LOGLEVEL_INFO,
+           "mm: initialized %" PRIu64 " pages in %" PRIu64 " cycles, "
+           "deferred %" PRIu64 " pages\n",
+           free_page_count,
+           g_early_init_cycles,
+           g_deferred_page_count);
+
     for_each_page_zone(zone) {
         printk(LOGLEVEL_INFO,
                "mm: zone %s has %" PRIu64 " pages\n",
@@ -883,7 +1043,10 @@ void mm_post_arch_init() {
 
     printk(LOGLEVEL_INFO,
            "mm: system has %" PRIu64 " free pages\n",
-           free_page_count);
+           free_page_count + g_deferred_page_count);
+
+    numa_print_stats();
 
     kmalloc_init();
+    vma_cache_init();
 }
\ No newline at end of file
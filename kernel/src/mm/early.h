@@ -12,6 +12,15 @@ void mm_early_init();
 void mm_post_arch_init();
 
 void mm_init();
+
+// Free memory beyond what's needed to boot has its struct pages initialized
+// after boot. mm_deferred_init_idle() does a bounded amount of this work, while
+// mm_finish_deferred_init() does the rest, returning true if any pages were
+// freed.
+
+void mm_deferred_init_idle();
+bool mm_finish_deferred_init();
+
 void mm_early_refcount_alloced_map(uint64_t virt_addr, uint64_t length);
 
 void
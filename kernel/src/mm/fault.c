@@ -0,0 +1,415 @@
+/*
+ * kernel/src/mm/fault.c
+ * © suhas pai
+ */
+
+#include "cpu/info.h"
+
+#include "lib/align.h"
+#include "lib/string.h"
+
+#include "fault.h"
+#include "page_alloc.h"
+#include "pageop.h"
+#include "pgmap.h"
+#include "walker.h"
+
+_Static_assert(FAULT_AROUND_PAGE_COUNT <= sizeof_bits(uint32_t),
+               "FAULT_AROUND_PAGE_COUNT must fit in a uint32_t bitmap");
+
+// Tracks how many pages were handed to pgmap, which maps them in order from the
+// front of the range, so every page can be marked movable at its address, and
+// a failed mapping can be undone.
+
+struct fault_fill_info {
+    struct pagemap *pagemap;
+
+    uint64_t front;
+    uint64_t page_count;
+};
+
+__optimize(3) static inline void
+record_page(struct fault_fill_info *const info, struct page *const page) {
+    const uint64_t virt = info->front + (info->page_count << PAGE_SHIFT);
+
+    page_set_movable(page, info->pagemap, virt);
+    info->page_count++;
+}
+
+__optimize(3) static uint64_t alloc_page_cb(void *const cb_info) {
+    struct page *const page = alloc_page(PAGE_STATE_USED, __ALLOC_ZERO);
+    if (__builtin_expect(page == NULL, 0)) {
+        return INVALID_PHYS;
+    }
+
+    record_page((struct fault_fill_info *)cb_info, page);
+    return page_to_phys(page);
+}
+
+__optimize(3) static uint64_t
+alloc_pages_bulk_cb(uint64_t *const phys_list,
+                    const uint64_t count,
+                    void *const cb_info)
+{
+    struct page *page_list[PGMAP_ALLOC_BULK_COUNT];
+    const uint64_t alloc_count =
+        alloc_pages_bulk(PAGE_STATE_USED,
+                         __ALLOC_ZERO,
+                         /*order=*/0,
+                         page_list,
+                         count);
+
+    struct fault_fill_info *const info = (struct fault_fill_info *)cb_info;
+    for (uint64_t i = 0; i != alloc_count; i++) {
+        record_page(info, page_list[i]);
+        phys_list[i] = page_to_phys(page_list[i]);
+    }
+
+    return alloc_count;
+}
+
+// Caller is required to hold vma->lock.
+
+static bool
+populate_range(struct pagemap *const pagemap,
+               const struct vm_area *const vma,
+               const struct range range)
+{
+    struct fault_fill_info info = {
+        .pagemap = pagemap,
+        .front = range.front,
+        .page_count = 0
+    };
+
+    const struct pgmap_alloc_options alloc_options = {
+        .alloc_page = alloc_page_cb,
+        .alloc_large_page = NULL,
+        .alloc_pages_bulk = alloc_pages_bulk_cb,
+
+        .alloc_page_cb_info = &info,
+        .alloc_large_page_cb_info = NULL
+    };
+
+    const enum pgmap_alloc_result result =
+        arch_alloc_mapping(pagemap,
+                           range,
+                           vma->prot,
+                           vma->cachekind,
+                           &alloc_options);
+
+    if (__builtin_expect(result == E_PGMAP_ALLOC_OK, 1)) {
+        return true;
+    }
+
+    if (info.page_count != 0) {
+        const struct pgunmap_options unmap_options = {
+            .free_pages = true,
+            .dont_split_large_pages = true
+        };
+
+        assert(
+            arch_unmap_mapping(pagemap,
+                               RANGE_INIT(range.front,
+                                          info.page_count << PAGE_SHIFT),
+                               /*map_options=*/NULL,
+                               &unmap_options));
+    }
+
+    return false;
+}
+
+// Returns a bitmap of which pages in `window` are already mapped. `window` must
+// not cross a leaf page-table.
+
+static uint32_t
+get_present_bitmap(struct pagemap *const pagemap, const struct range window) {
+    struct pt_walker walker;
+    ptwalker_default_for_pagemap(&walker, pagemap, window.front);
+
+    const pte_t *const table = walker.tables[walker.level - 1];
+    if (walker.level != 1) {
+        // Either the leaf table doesn't exist, and nothing in the window is
+        // mapped, or a large page maps the entire window.
+
+        if (table != NULL &&
+            pte_is_present(pte_read(table + walker.indices[walker.level - 1])))
+        {
+            return UINT32_MAX;
+        }
+
+        return 0;
+    }
+
+    const uint64_t count = PAGE_COUNT(window.size);
+    const pgt_index_t index = walker.indices[0];
+
+    uint32_t result = 0;
+    for (uint64_t i = 0; i != count; i++) {
+        if (pte_is_present(pte_read(table + index + i))) {
+            result |= 1ul << i;
+        }
+    }
+
+    return result;
+}
+
+__optimize(3) static bool
+access_allowed(const struct vm_area *const vma, const uint8_t flags) {
+    if ((flags & __PAGE_FAULT_USER) != 0 && (vma->prot & PROT_USER) == 0) {
+        return false;
+    }
+
+    if (flags & __PAGE_FAULT_WRITE) {
+        return vma->prot & PROT_WRITE;
+    }
+
+    if (flags & __PAGE_FAULT_EXEC) {
+        return vma->prot & PROT_EXEC;
+    }
+
+    return vma->prot & PROT_READ;
+}
+
+// Map every unmapped page of the fault-around window containing `addr`, one run
+// of unmapped pages at a time. Pages around `addr` are populated on a
+// best-effort basis; only failing to map `addr` itself is reported.
+
+static enum page_fault_result
+populate_around(struct pagemap *const pagemap,
+                const struct vm_area *const vma,
+                const uint64_t addr)
+{
+    const uint64_t window_size = FAULT_AROUND_PAGE_COUNT * PAGE_SIZE;
+    const uint64_t window_front = align_down(addr, window_size);
+
+    const uint64_t front = max(window_front, vma->node.range.front);
+    const uint64_t end =
+        min(window_front + window_size,
+            range_get_end_assert(vma->node.range));
+
+    const struct range window = range_create_end(front, end);
+    const uint32_t present = get_present_bitmap(pagemap, window);
+
+    uint64_t virt = front;
+    while (virt != end) {
+        if (present & (1ul << PAGE_COUNT(virt - front))) {
+            virt += PAGE_SIZE;
+            continue;
+        }
+
+        const uint64_t run_front = virt;
+        do {
+            virt += PAGE_SIZE;
+        } while (virt != end &&
+                 (present & (1ul << PAGE_COUNT(virt - front))) == 0);
+
+        const struct range run = range_create_end(run_front, virt);
+        if (!populate_range(pagemap, vma, run)) {
+            // Only the page at `addr` is required, so failing to populate any
+            // other run just makes the fault-around partial. The run with
+            // `addr` may still come after a run before it that failed.
+
+            if (range_has_loc(run, addr)) {
+                return E_PAGE_FAULT_NO_MEM;
+            }
+
+            if (addr < run_front) {
+                break;
+            }
+        }
+    }
+
+    return E_PAGE_FAULT_OK;
+}
+
+__optimize(3) static bool
+page_is_shared(struct page *const page, const pgt_level_t level) {
+    if (level == 1) {
+        return ref_get(&page->used.refcount) != 1;
+    }
+
+    // Large pages that aren't a single allocation are refcounted per page, and
+    // are always copied.
+
+    return page_get_state(page) != PAGE_STATE_LARGE_HEAD ||
+           ref_get(&page->largehead.refcount) != 1;
+}
+
+// A page allocated to break copy-on-write into, which is allocated without
+// holding vma->lock.
+
+struct cow_copy {
+    struct page *page;
+    pgt_level_t level;
+};
+
+static void free_cow_copy(struct cow_copy *const copy) {
+    if (copy->page == NULL) {
+        return;
+    }
+
+    if (copy->level == 1) {
+        free_page(copy->page);
+    } else {
+        free_large_page(copy->page);
+    }
+
+    copy->page = NULL;
+}
+
+// Handle a write to a read-only pte of an anonymous vm_area, which was shared
+// by pagemap_clone(). The page is copied unless every other pagemap has already
+// dropped it. Returns false if the page has to be copied but `copy` doesn't
+// hold a page of its level, with the level put in `level_out`. Caller is
+// required to hold vma->lock.
+
+static bool
+break_cow(struct pagemap *const pagemap,
+          const uint64_t addr,
+          struct cow_copy *const copy,
+          pgt_level_t *const level_out)
+{
+    struct pt_walker walker;
+    ptwalker_default_for_pagemap(&walker, pagemap, addr);
+
+    pte_t *const table = walker.tables[walker.level - 1];
+    if (table == NULL) {
+        // The page was unmapped since the fault, so retry the access.
+        return true;
+    }
+
+    const pgt_level_t level = (pgt_level_t)walker.level;
+    pte_t *const pte = table + walker.indices[level - 1];
+
+    const pte_t entry = pte_read(pte);
+    if (!pte_is_present(entry) || pte_is_writable(entry)) {
+        return true;
+    }
+
+    const uint64_t size = 1ull << PAGE_SHIFTS[level - 1];
+    const uint64_t front = align_down(addr, size);
+
+    struct page *const page = pte_to_page(entry);
+    struct pageop pageop;
+
+    pageop_init(&pageop, pagemap, RANGE_INIT(front, size));
+    if (!page_is_shared(page, level)) {
+        pte_write(pte, pte_make_writable(entry));
+        if (level == 1) {
+            page_set_movable(page, pagemap, front);
+        }
+
+        pageop_finish(&pageop);
+        return true;
+    }
+
+    if (copy->page == NULL || copy->level != level) {
+        *level_out = level;
+        return false;
+    }
+
+    struct page *const copy_page = copy->page;
+    copy->page = NULL;
+
+    memcpy(page_to_virt(copy_page), page_to_virt(page), size);
+    pte_write(pte,
+              pte_make_writable(phys_create_pte(page_to_phys(copy_page)) |
+                                (entry & ~(pte_t)PTE_PHYS_MASK)));
+
+    if (level == 1) {
+        deref_page(page, &pageop);
+        page_set_movable(copy_page, pagemap, front);
+    } else {
+        deref_large_page(page, &pageop, level);
+    }
+
+    pageop_finish(&pageop);
+    return true;
+}
+
+// Returns false if breaking copy-on-write needs a page of the level put in
+// `level_out` that `copy` doesn't have yet.
+
+static bool
+try_handle_page_fault(const uint64_t addr,
+                      const uint8_t flags,
+                      struct cow_copy *const copy,
+                      pgt_level_t *const level_out,
+                      enum page_fault_result *const result_out)
+{
+    struct pagemap *pagemap = this_cpu()->pagemap;
+    if (pagemap == NULL) {
+        pagemap = &kernel_pagemap;
+    }
+
+    int flag = 0;
+    struct vm_area *vma = pagemap_find_vma_and_lock(pagemap, addr, &flag);
+
+    if (vma == NULL && pagemap != &kernel_pagemap) {
+        pagemap = &kernel_pagemap;
+        vma = pagemap_find_vma_and_lock(pagemap, addr, &flag);
+    }
+
+    if (vma == NULL) {
+        *result_out = E_PAGE_FAULT_NO_VMA;
+        return true;
+    }
+
+    bool done = true;
+    enum page_fault_result result = E_PAGE_FAULT_OK;
+
+    if ((vma->flags & __VMA_ANONYMOUS) == 0) {
+        result = E_PAGE_FAULT_NO_VMA;
+    } else if (!access_allowed(vma, flags)) {
+        result = E_PAGE_FAULT_BAD_ACCESS;
+    } else if (flags & __PAGE_FAULT_PRESENT) {
+        // A write to a present page of a writable vm_area can only be to a
+        // page shared with a clone.
+
+        if (flags & __PAGE_FAULT_WRITE) {
+            done =
+                break_cow(pagemap,
+                          align_down(addr, PAGE_SIZE),
+                          copy,
+                          level_out);
+        } else {
+            result = E_PAGE_FAULT_BAD_ACCESS;
+        }
+    } else {
+        result = populate_around(pagemap, vma, align_down(addr, PAGE_SIZE));
+    }
+
+    spin_release_with_irq(&vma->lock, flag);
+
+    *result_out = result;
+    return done;
+}
+
+enum page_fault_result
+handle_page_fault(const uint64_t addr, const uint8_t flags) {
+    struct cow_copy copy = { .page = NULL, .level = 0 };
+    enum page_fault_result result = E_PAGE_FAULT_OK;
+    pgt_level_t level = 0;
+
+    // Allocate the copy without holding vma->lock, as allocating a large page
+    // can compact, which takes the lock of every vm_area it migrates pages out
+    // of. The vm_area and pte are looked up again after, as they may have
+    // changed in the meantime.
+
+    while (!try_handle_page_fault(addr, flags, &copy, &level, &result)) {
+        free_cow_copy(&copy);
+
+        copy.page =
+            level == 1 ?
+                alloc_page(PAGE_STATE_USED, /*flags=*/0) :
+                alloc_large_page(level, /*flags=*/0);
+        copy.level = level;
+
+        if (__builtin_expect(copy.page == NULL, 0)) {
+            return E_PAGE_FAULT_NO_MEM;
+        }
+    }
+
+    free_cow_copy(&copy);
+    return result;
+}
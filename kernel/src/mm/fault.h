@@ -0,0 +1,39 @@
+/*
+ * kernel/src/mm/fault.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+
+enum page_fault_flags {
+    // The faulting access found a present pte, i.e. it was a protection fault.
+    __PAGE_FAULT_PRESENT = 1 << 0,
+
+    __PAGE_FAULT_WRITE = 1 << 1,
+    __PAGE_FAULT_EXEC = 1 << 2,
+    __PAGE_FAULT_USER = 1 << 3,
+};
+
+enum page_fault_result {
+    E_PAGE_FAULT_OK,
+
+    // The address isn't in any vm_area, or in one that isn't demand-paged.
+    E_PAGE_FAULT_NO_VMA,
+
+    // The vm_area's protection doesn't allow the access.
+    E_PAGE_FAULT_BAD_ACCESS,
+    E_PAGE_FAULT_NO_MEM,
+};
+
+// Number of pages around the faulting address that are populated along with
+// it, so a sequential access pattern takes one fault per window instead of one
+// per page. Must be a power of two.
+
+#define FAULT_AROUND_PAGE_COUNT 16
+
+// Called by each arch's page-fault handler. Populates the anonymous vm_area
+// containing `addr`, looking first in the current cpu's pagemap and then in
+// the kernel's.
+
+enum page_fault_result handle_page_fault(uint64_t addr, uint8_t flags);
@@ -0,0 +1,20 @@
+/*
+ * kernel/src/mm/idle.c
+ * © suhas pai
+ */
+
+#include "cpu/info.h"
+
+#include "compact.h"
+#include "early.h"
+#include "idle.h"
+#include "page_alloc.h"
+#include "promote.h"
+
+void mm_idle() {
+    cpu_page_cache_trim();
+    refill_zeroed_page_pools();
+    compact_idle();
+    promote_idle();
+    mm_deferred_init_idle();
+}
@@ -0,0 +1,11 @@
+/*
+ * kernel/src/mm/idle.h
+ * © suhas pai
+ */
+
+#pragma once
+
+// Background memory-management work, done by a cpu when it has nothing else to
+// do. Each call only does a bounded amount of work.
+
+void mm_idle();
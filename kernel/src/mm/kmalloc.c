@@ -5,12 +5,36 @@
 
 #include "dev/printk.h"
 #include "mm/slab.h"
+#include "mm/vmalloc.h"
 
 #include "kmalloc.h"
 
 static struct slab_allocator kmalloc_slabs[16] = {0};
 static bool kmalloc_is_initialized = false;
 
+// Every size-class is a multiple of KMALLOC_SIZE_STEP, so a lookup for the
+// smallest size-class fitting a size is a single index into this table.
+
+#define KMALLOC_SIZE_STEP 16
+static uint8_t kmalloc_size_index[KMALLOC_MAX / KMALLOC_SIZE_STEP] = {0};
+
+__optimize(3) static inline
+struct slab_allocator *allocator_for_size(const uint32_t size) {
+    return &kmalloc_slabs[kmalloc_size_index[(size - 1) / KMALLOC_SIZE_STEP]];
+}
+
+static void setup_size_index() {
+    uint8_t index = 0;
+    for (uint16_t i = 0; i != countof(kmalloc_size_index); i++) {
+        const uint32_t size = (uint32_t)(i + 1) * KMALLOC_SIZE_STEP;
+        while (kmalloc_slabs[index].object_size < size) {
+            index++;
+        }
+
+        kmalloc_size_index[i] = index;
+    }
+}
+
 __optimize(3) bool kmalloc_initialized() {
     return kmalloc_is_initialized;
 }
@@ -21,6 +45,7 @@ __optimize(3) bool kmalloc_initialized() {
     index++;
 
 void kmalloc_init() {
+    slab_init();
     uint8_t index = 0;
 
     SLAB_ALLOC_INIT(16, /*alloc_flags=*/0, /*flags=*/0);
@@ -37,9 +62,10 @@ void kmalloc_init() {
     SLAB_ALLOC_INIT(1536, /*alloc_flags=*/0, /*flags=*/0);
     SLAB_ALLOC_INIT(2048, /*alloc_flags=*/0, /*flags=*/0);
     SLAB_ALLOC_INIT(4096, /*alloc_flags=*/0, /*flags=*/0);
-    SLAB_ALLOC_INIT(6102, /*alloc_flags=*/0, /*flags=*/0);
+    SLAB_ALLOC_INIT(6144, /*alloc_flags=*/0, /*flags=*/0);
     SLAB_ALLOC_INIT(8192, /*alloc_flags=*/0, /*flags=*/0);
 
+    setup_size_index();
     kmalloc_is_initialized = true;
 }
 
@@ -54,20 +80,10 @@ void *kmalloc(const uint32_t size) {
     }
 
     if (__builtin_expect(size > KMALLOC_MAX, 0)) {
-        printk(LOGLEVEL_WARN,
-               "mm: kmalloc() can't allocate %" PRIu32 " bytes, max is %d "
-               "bytes\n",
-               size,
-               KMALLOC_MAX);
-        return NULL;
+        return vmalloc(size);
     }
 
-    struct slab_allocator *allocator = &kmalloc_slabs[0];
-    while (allocator->object_size < size) {
-        allocator++;
-    }
-
-    return slab_alloc(allocator);
+    return slab_alloc(allocator_for_size(size));
 }
 
 __optimize(3) __malloclike __malloc_dealloc(kfree, 1)
@@ -81,19 +97,17 @@ void *kmalloc_size(const uint32_t size, uint32_t *const size_out) {
     }
 
     if (__builtin_expect(size > KMALLOC_MAX, 0)) {
-        printk(LOGLEVEL_WARN,
-               "mm: kmalloc_size() can't allocate %" PRIu32 " bytes, max is %d "
-               "bytes\n",
-               size,
-               KMALLOC_MAX);
-        return NULL;
-    }
+        void *const result = vmalloc(size);
+        if (__builtin_expect(result != NULL, 1)) {
+            *size_out =
+                (uint32_t)min(vmalloc_size(result), (uint64_t)UINT32_MAX);
+            return result;
+        }
 
-    struct slab_allocator *allocator = &kmalloc_slabs[0];
-    while (allocator->object_size < size) {
-        allocator++;
+        return NULL;
     }
 
+    struct slab_allocator *const allocator = allocator_for_size(size);
     void *const result = slab_alloc(allocator);
     if (__builtin_expect(result != NULL, 1)) {
         *size_out = allocator->object_size;
@@ -124,6 +138,10 @@ __optimize(3) void *krealloc(void *const buffer, const uint32_t size) {
         return NULL;
     }
 
+    if (is_vmalloc_addr(buffer)) {
+        return vrealloc(buffer, size);
+    }
+
     const uint64_t buffer_size = slab_object_size(buffer);
     if (size <= buffer_size) {
         return buffer;
@@ -143,5 +161,11 @@ __optimize(3) void *krealloc(void *const buffer, const uint32_t size) {
 __optimize(3) void kfree(void *const buffer) {
     assert_msg(kmalloc_is_initialized,
                "mm: kfree() called before kmalloc_init()");
+
+    if (is_vmalloc_addr(buffer)) {
+        vfree(buffer);
+        return;
+    }
+
     slab_free(buffer);
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 #include "lib/macros.h"
 
+// Allocations larger than KMALLOC_MAX are passed on to vmalloc().
 #define KMALLOC_MAX 8192
 
 void kmalloc_init();
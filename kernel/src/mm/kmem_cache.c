@@ -0,0 +1,68 @@
+/*
+ * kernel/src/mm/kmem_cache.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+
+#include "kmalloc.h"
+#include "kmem_cache.h"
+#include "page.h"
+
+bool
+kmem_cache_init(struct kmem_cache *const cache,
+                const char *const name,
+                const uint32_t size,
+                const uint32_t align,
+                void (*const ctor)(void *object),
+                const uint16_t flags)
+{
+    if (!slab_allocator_init_with_ctor(&cache->allocator,
+                                       size,
+                                       align,
+                                       ctor,
+                                       /*alloc_flags=*/0,
+                                       flags))
+    {
+        printk(LOGLEVEL_WARN,
+               "mm: failed to init kmem-cache %s with size %" PRIu32 ", "
+               "align %" PRIu32 "\n",
+               name,
+               size,
+               align);
+        return false;
+    }
+
+    cache->name = name;
+    return true;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *const name,
+                  const uint32_t size,
+                  const uint32_t align,
+                  void (*const ctor)(void *object),
+                  const uint16_t flags)
+{
+    struct kmem_cache *const cache = kmalloc(sizeof(*cache));
+    if (__builtin_expect(cache == NULL, 0)) {
+        return NULL;
+    }
+
+    if (!kmem_cache_init(cache, name, size, align, ctor, flags)) {
+        kfree(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+__optimize(3) void *kmem_cache_alloc(struct kmem_cache *const cache) {
+    return slab_alloc(&cache->allocator);
+}
+
+__optimize(3)
+void kmem_cache_free(struct kmem_cache *const cache, void *const object) {
+    assert(virt_to_page(object)->slab.allocator == &cache->allocator);
+    slab_free(object);
+}
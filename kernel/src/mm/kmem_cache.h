@@ -0,0 +1,38 @@
+/*
+ * kernel/src/mm/kmem_cache.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "slab.h"
+
+// A kmem_cache is a slab allocator for a single type of object. Slabs are
+// sized for the type instead of for a kmalloc() size-class, and the optional
+// constructor only runs when a slab is created. Objects are expected to be
+// freed in their constructed state. `flags` are passed on to the slab
+// allocator, see enum slab_allocator_flags.
+
+struct kmem_cache {
+    struct slab_allocator allocator;
+    const char *name;
+};
+
+bool
+kmem_cache_init(struct kmem_cache *cache,
+                const char *name,
+                uint32_t size,
+                uint32_t align,
+                void (*ctor)(void *object),
+                uint16_t flags);
+
+struct kmem_cache *
+kmem_cache_create(const char *name,
+                  uint32_t size,
+                  uint32_t align,
+                  void (*ctor)(void *object),
+                  uint16_t flags);
+
+void kmem_cache_free(struct kmem_cache *cache, void *object);
+
+__malloclike __malloc_dealloc(kmem_cache_free, 2)
+void *kmem_cache_alloc(struct kmem_cache *cache);
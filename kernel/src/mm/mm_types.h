@@ -56,6 +56,15 @@ bool pte_is_present(pte_t pte);
 bool pte_level_can_have_large(pgt_level_t level);
 bool pte_is_large(pte_t pte);
 bool pte_is_dirty(pte_t pte);
+bool pte_is_writable(pte_t pte);
+
+pte_t pte_make_readonly(pte_t pte);
+pte_t pte_make_writable(pte_t pte);
+
+// Returns the flags of the leaf pte `pte`, without its physical address,
+// converted so they can be used by a large pte at `level`.
+
+pte_t pte_leaf_to_large_flags(pte_t pte, pgt_level_t level);
 
 #define pte_to_pfn(pte) phys_to_pfn(pte_to_phys(pte))
 #define pte_to_virt(pte) phys_to_virt(pte_to_phys(pte))
@@ -78,6 +87,12 @@ extern const uint64_t PAGE_OFFSET;
 extern const uint64_t VMAP_BASE;
 extern const uint64_t VMAP_END;
 
+// mmio is mapped into the lower half of the vmap range, and vmalloc() into the
+// upper half.
+
+#define VMALLOC_BASE (VMAP_BASE + (VMAP_END - VMAP_BASE) / 2)
+#define VMALLOC_END VMAP_END
+
 extern uint64_t PAGE_END;
 extern uint64_t PAGING_MODE;
 
@@ -5,6 +5,7 @@
 
 #include "dev/printk.h"
 
+#include "lib/adt/range_tree.h"
 #include "lib/align.h"
 #include "lib/size.h"
 
@@ -14,7 +15,7 @@
 #include "kmalloc.h"
 #include "mmio.h"
 
-static struct address_space mmio_space = ADDRSPACE_INIT(mmio_space);
+static struct range_tree mmio_space = RANGE_TREE_INIT();
 static struct spinlock mmio_space_lock = SPINLOCK_INIT();
 
 enum mmio_region_flags {
@@ -44,9 +45,12 @@ __optimize(3) static inline enum prot_fail verify_prot(const prot_t prot) {
     return PROT_FAIL_NONE;
 }
 
+// Caller is required to hold mmio_space_lock.
+
 __optimize(3) static uint64_t
 find_virt_addr(const struct range phys_range,
                const struct range in_range,
+               const uint64_t size,
                struct mmio_region *const mmio)
 {
     for (int8_t i = PGT_LEVEL_COUNT - 1; i > 1; i--) {
@@ -66,21 +70,23 @@ find_virt_addr(const struct range phys_range,
         }
 
         const uint64_t virt_addr =
-            addrspace_find_space_and_add_node(&mmio_space,
-                                              in_range,
-                                              &mmio->node,
-                                              level_info->order);
+            range_tree_find_space_and_insert(&mmio_space,
+                                             in_range,
+                                             size,
+                                             level_info->size,
+                                             mmio);
 
-        if (virt_addr != ADDRSPACE_INVALID_ADDR) {
+        if (virt_addr != RANGE_TREE_INVALID_ADDR) {
             return virt_addr;
         }
     }
 
     return
-        addrspace_find_space_and_add_node(&mmio_space,
-                                          in_range,
-                                          &mmio->node,
-                                          /*pagesize_order=*/0);
+        range_tree_find_space_and_insert(&mmio_space,
+                                         in_range,
+                                         size,
+                                         PAGE_SIZE,
+                                         mmio);
 }
 
 // 16kib of guard pages
@@ -92,7 +98,7 @@ map_mmio_region(const struct range phys_range,
                 const uint64_t flags)
 {
     const struct range in_range =
-        range_create_end(VMAP_BASE + GUARD_PAGE_SIZE, VMAP_END);
+        range_create_end(VMAP_BASE + GUARD_PAGE_SIZE, VMALLOC_BASE);
 
     struct mmio_region *const mmio = kmalloc(sizeof(*mmio));
     if (mmio == NULL) {
@@ -103,13 +109,14 @@ map_mmio_region(const struct range phys_range,
         return NULL;
     }
 
-    mmio->node = ADDRSPACE_NODE_INIT(mmio->node, &mmio_space);
-    mmio->node.range.size = phys_range.size + GUARD_PAGE_SIZE;
-
     const int flag = spin_acquire_with_irq(&mmio_space_lock);
-    const uint64_t virt_addr = find_virt_addr(phys_range, in_range, mmio);
+    const uint64_t virt_addr =
+        find_virt_addr(phys_range,
+                       in_range,
+                       phys_range.size + GUARD_PAGE_SIZE,
+                       mmio);
 
-    if (virt_addr == ADDRSPACE_INVALID_ADDR) {
+    if (virt_addr == RANGE_TREE_INVALID_ADDR) {
         spin_release_with_irq(&mmio_space_lock, flag);
         kfree(mmio);
 
@@ -131,8 +138,10 @@ map_mmio_region(const struct range phys_range,
                             VMA_CACHEKIND_WRITETHROUGH : VMA_CACHEKIND_MMIO,
                           /*is_overwrite=*/false);
 
-    spin_release_with_irq(&mmio_space_lock, flag);
     if (!map_success) {
+        range_tree_remove(&mmio_space, virt_addr);
+        spin_release_with_irq(&mmio_space_lock, flag);
+
         kfree(mmio);
         printk(LOGLEVEL_WARN,
                "vmap_mmio(): failed to map phys-range " RANGE_FMT " to virtual "
@@ -143,6 +152,8 @@ map_mmio_region(const struct range phys_range,
         return NULL;
     }
 
+    spin_release_with_irq(&mmio_space_lock, flag);
+
     mmio->base = (volatile void *)virt_addr;
     mmio->size = phys_range.size;
 
@@ -263,7 +274,7 @@ bool vunmap_mmio(struct mmio_region *const region) {
         return false;
     }
 
-    addrspace_remove_node(&region->node);
+    assert(range_tree_remove(&mmio_space, (uint64_t)region->base) == region);
     spin_release_with_irq(&mmio_space_lock, flag);
     kfree(region);
 
@@ -5,12 +5,10 @@
 
 #pragma once
 
-#include "lib/adt/addrspace.h"
+#include "lib/adt/range.h"
 #include "mm/mm_types.h"
 
 struct mmio_region {
-    struct addrspace_node node;
-
     volatile void *base;
     uint32_t size;
 
@@ -0,0 +1,294 @@
+/*
+ * kernel/src/mm/numa.c
+ * © suhas pai
+ */
+
+#include <limine.h>
+#include <stdatomic.h>
+
+#include "acpi/api.h"
+#include "acpi/slit.h"
+#include "acpi/srat.h"
+
+#include "cpu/info.h"
+#include "dev/dtb/numa.h"
+#include "dev/printk.h"
+#include "sys/boot.h"
+
+#include "numa.h"
+
+struct numa_memory_range {
+    struct range range;
+    uint8_t node_index;
+};
+
+struct numa_cpu_affinity {
+    uint64_t cpu_id;
+    enum numa_cpu_id_kind kind;
+
+    uint8_t node_index;
+};
+
+static struct numa_node g_node_list[NUMA_NODE_MAX];
+static uint8_t g_node_count = 0;
+
+static struct numa_memory_range g_memory_range_list[NUMA_MEMORY_RANGE_MAX];
+static uint8_t g_memory_range_count = 0;
+
+static struct numa_cpu_affinity g_cpu_affinity_list[NUMA_CPU_AFFINITY_MAX];
+static uint16_t g_cpu_affinity_count = 0;
+
+static const char *const g_zone_name_list[NUMA_NODE_MAX] = {
+    "node0", "node1", "node2", "node3", "node4", "node5", "node6", "node7",
+    "node8", "node9", "node10", "node11", "node12", "node13", "node14", "node15"
+};
+
+__optimize(3) static struct numa_node *find_node(const uint32_t id) {
+    for (uint8_t i = 0; i != g_node_count; i++) {
+        if (g_node_list[i].id == id) {
+            return &g_node_list[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct numa_node *find_or_add_node(const uint32_t id) {
+    struct numa_node *node = find_node(id);
+    if (node != NULL) {
+        return node;
+    }
+
+    if (__builtin_expect(g_node_count == NUMA_NODE_MAX, 0)) {
+        printk(LOGLEVEL_WARN,
+               "numa: too many nodes, ignoring node %" PRIu32 "\n",
+               id);
+        return NULL;
+    }
+
+    const uint8_t index = g_node_count;
+
+    node = &g_node_list[index];
+    node->id = id;
+    node->index = index;
+
+    page_zone_init(&node->zone, g_zone_name_list[index]);
+
+    // Nodes are assumed to be remote to each other until we're told their
+    // actual distance.
+
+    for (uint8_t i = 0; i != index; i++) {
+        node->distance_list[i] = NUMA_REMOTE_DISTANCE;
+        g_node_list[i].distance_list[index] = NUMA_REMOTE_DISTANCE;
+    }
+
+    node->distance_list[index] = NUMA_LOCAL_DISTANCE;
+    g_node_count++;
+
+    return node;
+}
+
+bool numa_add_memory_range(const uint32_t node_id, const struct range range) {
+    if (__builtin_expect(g_memory_range_count == NUMA_MEMORY_RANGE_MAX, 0)) {
+        printk(LOGLEVEL_WARN,
+               "numa: too many memory ranges, ignoring range " RANGE_FMT "\n",
+               RANGE_FMT_ARGS(range));
+        return false;
+    }
+
+    const struct numa_node *const node = find_or_add_node(node_id);
+    if (node == NULL) {
+        return false;
+    }
+
+    g_memory_range_list[g_memory_range_count] = (struct numa_memory_range){
+        .range = range,
+        .node_index = node->index
+    };
+
+    g_memory_range_count++;
+    return true;
+}
+
+bool
+numa_add_cpu(const uint32_t node_id,
+             const enum numa_cpu_id_kind kind,
+             const uint64_t cpu_id)
+{
+    if (__builtin_expect(g_cpu_affinity_count == NUMA_CPU_AFFINITY_MAX, 0)) {
+        printk(LOGLEVEL_WARN,
+               "numa: too many cpus, ignoring cpu %" PRIu64 "\n",
+               cpu_id);
+        return false;
+    }
+
+    const struct numa_node *const node = find_or_add_node(node_id);
+    if (node == NULL) {
+        return false;
+    }
+
+    g_cpu_affinity_list[g_cpu_affinity_count] = (struct numa_cpu_affinity){
+        .cpu_id = cpu_id,
+        .kind = kind,
+        .node_index = node->index
+    };
+
+    g_cpu_affinity_count++;
+    return true;
+}
+
+void
+numa_set_distance(const uint32_t from_id,
+                  const uint32_t to_id,
+                  const uint8_t distance)
+{
+    struct numa_node *const from = find_node(from_id);
+    const struct numa_node *const to = find_node(to_id);
+
+    // Ignore distances to nodes that don't have any memory or cpus.
+    if (from == NULL || to == NULL) {
+        return;
+    }
+
+    from->distance_list[to->index] = distance;
+}
+
+// Order zones by distance from the node, keeping the node itself first and
+// breaking ties by node index.
+
+static void setup_zone_list(struct numa_node *const node) {
+    bool used[NUMA_NODE_MAX] = {0};
+    uint8_t zone_count = 0;
+
+    node->zone_list[zone_count++] = &node->zone;
+    used[node->index] = true;
+
+    for (uint8_t i = 1; i != g_node_count; i++) {
+        uint8_t best = 0;
+        bool found = false;
+
+        for (uint8_t j = 0; j != g_node_count; j++) {
+            if (used[j]) {
+                continue;
+            }
+
+            if (!found || node->distance_list[j] < node->distance_list[best]) {
+                best = j;
+                found = true;
+            }
+        }
+
+        node->zone_list[zone_count++] = &g_node_list[best].zone;
+        used[best] = true;
+    }
+
+    node->zone_list[zone_count++] = page_zone_low4g();
+    node->zone_list[zone_count] = NULL;
+}
+
+__optimize(3) static void setup_boot_cpu_node() {
+    const struct limine_smp_response *const smp = boot_get_smp();
+    if (smp == NULL) {
+        return;
+    }
+
+#if defined(__x86_64__)
+    numa_find_cpu_node(NUMA_CPU_ID_APIC,
+                       smp->bsp_lapic_id,
+                       &this_cpu_mut()->numa_node);
+#elif defined(__aarch64__)
+    numa_find_cpu_node(NUMA_CPU_ID_DTB_REG,
+                       smp->bsp_mpidr,
+                       &this_cpu_mut()->numa_node);
+#elif defined(__riscv64)
+    numa_find_cpu_node(NUMA_CPU_ID_DTB_REG,
+                       smp->bsp_hartid,
+                       &this_cpu_mut()->numa_node);
+#endif /* defined(__x86_64__) */
+}
+
+void numa_init() {
+    const struct acpi_info *const acpi_info = get_acpi_info();
+    if (acpi_info->srat != NULL) {
+        srat_init(acpi_info->srat);
+        if (acpi_info->slit != NULL) {
+            slit_init(acpi_info->slit);
+        }
+    } else {
+        const void *const dtb = boot_get_dtb();
+        if (dtb != NULL) {
+            dtb_init_numa(dtb);
+        }
+    }
+
+    if (g_node_count == 0) {
+        find_or_add_node(/*id=*/0);
+    }
+
+    for (uint8_t i = 0; i != g_node_count; i++) {
+        setup_zone_list(&g_node_list[i]);
+    }
+
+    setup_boot_cpu_node();
+    printk(LOGLEVEL_INFO,
+           "numa: found %" PRIu8 " node(s), cpu is on node %" PRIu32 "\n",
+           g_node_count,
+           g_node_list[this_cpu()->numa_node].id);
+}
+
+void numa_print_stats() {
+    for (uint8_t i = 0; i != g_node_count; i++) {
+        struct numa_node *const node = &g_node_list[i];
+        printk(LOGLEVEL_INFO,
+               "numa: node %" PRIu32 " has %" PRIu64 " free pages, "
+               "%" PRIu64 " local allocs, %" PRIu64 " remote allocs\n",
+               node->id,
+               atomic_load(&node->zone.total_free),
+               atomic_load(&node->zone.local_alloc_count),
+               atomic_load(&node->zone.remote_alloc_count));
+
+        for (uint8_t j = 0; j != g_node_count; j++) {
+            printk(LOGLEVEL_INFO,
+                   "\tdistance to node %" PRIu32 ": %" PRIu8 "\n",
+                   g_node_list[j].id,
+                   node->distance_list[j]);
+        }
+    }
+}
+
+__optimize(3) uint8_t numa_node_count() {
+    return g_node_count;
+}
+
+__optimize(3) struct numa_node *numa_get_node(const uint8_t index) {
+    assert(index < g_node_count);
+    return &g_node_list[index];
+}
+
+__optimize(3) struct numa_node *phys_to_numa_node(const uint64_t phys) {
+    for (uint8_t i = 0; i != g_memory_range_count; i++) {
+        const struct numa_memory_range *const iter = &g_memory_range_list[i];
+        if (range_has_loc(iter->range, phys)) {
+            return &g_node_list[iter->node_index];
+        }
+    }
+
+    // Memory not described by any node goes to the first node.
+    return &g_node_list[0];
+}
+
+__optimize(3) bool
+numa_find_cpu_node(const enum numa_cpu_id_kind kind,
+                   const uint64_t cpu_id,
+                   uint8_t *const index_out)
+{
+    for (uint16_t i = 0; i != g_cpu_affinity_count; i++) {
+        const struct numa_cpu_affinity *const iter = &g_cpu_affinity_list[i];
+        if (iter->kind == kind && iter->cpu_id == cpu_id) {
+            *index_out = iter->node_index;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,71 @@
+/*
+ * kernel/src/mm/numa.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "lib/adt/range.h"
+#include "zone.h"
+
+#define NUMA_NODE_MAX 16
+#define NUMA_MEMORY_RANGE_MAX 64
+#define NUMA_CPU_AFFINITY_MAX 256
+
+// Distances follow the convention of ACPI's SLIT, where a node's distance to
+// itself is 10.
+
+#define NUMA_LOCAL_DISTANCE 10
+#define NUMA_REMOTE_DISTANCE 20
+
+enum numa_cpu_id_kind {
+    // Local apic or x2apic id, from SRAT.
+    NUMA_CPU_ID_APIC,
+
+    // ACPI processor uid of a GICC or RINTC entry, from SRAT.
+    NUMA_CPU_ID_ACPI_UID,
+
+    // 'reg' of a devicetree cpu node, i.e. the mpidr or hart-id.
+    NUMA_CPU_ID_DTB_REG,
+};
+
+struct numa_node {
+    // Proximity-domain from SRAT, or numa-node-id from the devicetree.
+    uint32_t id;
+    uint8_t index;
+
+    // Zone for this node's memory above 4gib. Memory below 4gib always goes to
+    // the low4g zone.
+
+    struct page_zone zone;
+
+    // Zones to allocate from, nearest first, starting with this node's zone and
+    // ending with the low4g zone. Terminated by NULL.
+
+    struct page_zone *zone_list[NUMA_NODE_MAX + 2];
+    uint8_t distance_list[NUMA_NODE_MAX];
+};
+
+// The following are called by the SRAT, SLIT and devicetree parsers from
+// numa_init(), before any zones are populated.
+
+bool numa_add_memory_range(uint32_t node_id, struct range range);
+bool
+numa_add_cpu(uint32_t node_id, enum numa_cpu_id_kind kind, uint64_t cpu_id);
+
+void numa_set_distance(uint32_t from_id, uint32_t to_id, uint8_t distance);
+
+// Find the nodes from SRAT and SLIT if present, otherwise from the devicetree.
+// A system without either has a single node holding all memory.
+
+void numa_init();
+void numa_print_stats();
+
+uint8_t numa_node_count();
+struct numa_node *numa_get_node(uint8_t index);
+struct numa_node *phys_to_numa_node(uint64_t phys);
+
+bool
+numa_find_cpu_node(enum numa_cpu_id_kind kind,
+                   uint64_t cpu_id,
+                   uint8_t *index_out);
@@ -162,6 +162,26 @@ void set_pages_dirty(struct page *const page, const uint64_t amount) {
     } while (avail != 0);
 }
 
+__optimize(3) void
+page_set_movable(struct page *const page,
+                 struct pagemap *const pagemap,
+                 const uint64_t virt)
+{
+    page->used.rmap.pagemap = pagemap;
+    page->used.rmap.virt = virt;
+
+    page_set_flag(page, __PAGE_IS_MOVABLE);
+}
+
+// A page shared between mappings, or one whose last reference was just dropped,
+// can't be moved.
+
+__optimize(3) bool page_is_movable(struct page *const page) {
+    return page_get_state(page) == PAGE_STATE_USED &&
+           page_has_flag(page, __PAGE_IS_MOVABLE) &&
+           ref_get(&page->used.refcount) == 1;
+}
+
 __optimize(3) enum page_state page_get_state(const struct page *const page) {
     return atomic_load_explicit(&page->state, memory_order_relaxed);
 }
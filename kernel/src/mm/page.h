@@ -18,6 +18,12 @@ enum page_state {
     PAGE_STATE_FREE_LIST_HEAD,
     PAGE_STATE_FREE_LIST_TAIL,
 
+    // Free pages held off the freelist while their range is being compacted.
+    // The first page of each isolated block stores the block's order in
+    // freelist_head.order.
+
+    PAGE_STATE_ISOLATED,
+
     PAGE_STATE_SYSTEM_CRUCIAL,
 
     PAGE_STATE_LRU_CACHE,
@@ -42,6 +48,10 @@ struct page {
         struct {
             _Atomic uint16_t flags;
         } largepage_head;
+        struct {
+            // Offset of the slab's first object from the start of the slab.
+            uint16_t color_offset;
+        } slab_head;
 
         uint16_t bits;
     } extra;
@@ -95,7 +105,15 @@ struct page {
         } largetail;
         struct {
             struct refcount refcount;
-            struct list delayed_free_list;
+            union {
+                struct list delayed_free_list;
+
+                // Only valid for movable pages, which are mapped exactly once.
+                struct {
+                    struct pagemap *pagemap;
+                    uint64_t virt;
+                } rmap;
+            };
         } used;
     };
 };
@@ -105,6 +123,9 @@ _Static_assert(sizeof(struct page) == SIZEOF_STRUCTPAGE,
 
 enum struct_page_flags {
     __PAGE_IS_DIRTY = 1 << 0,
+
+    // Page can be migrated by compaction, see page_set_movable().
+    __PAGE_IS_MOVABLE = 1 << 1,
 };
 
 enum struct_page_largehead_flags {
@@ -120,6 +141,17 @@ void page_clear_flag(struct page *page, enum struct_page_flags flag);
 
 void set_pages_dirty(struct page *page, uint64_t amount);
 
+struct pagemap;
+
+// Mark a used page as movable, recording its only mapping so compaction can
+// copy it elsewhere and update the pte. The flag is cleared when the page is
+// allocated again.
+
+void
+page_set_movable(struct page *page, struct pagemap *pagemap, uint64_t virt);
+
+bool page_is_movable(struct page *page);
+
 enum page_state page_get_state(const struct page *page);
 void page_set_state(struct page *page, enum page_state state);
 
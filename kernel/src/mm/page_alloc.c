@@ -5,14 +5,41 @@
 
 #include <stdatomic.h>
 
+#include "asm/irqs.h"
+#include "cpu/info.h"
+
 #include "dev/printk.h"
 #include "lib/align.h"
+#include "lib/bits.h"
 #include "sys/boot.h"
 
+#include "compact.h"
+#include "early.h"
+#include "numa.h"
 #include "page.h"
+#include "shrinker.h"
 #include "zone.h"
 
-// Caller is required to set section->min_order
+__optimize(3) static inline void
+inc_freelist_count(struct page_section *const section, const uint8_t order) {
+    struct page_freelist *const freelist = &section->freelist_list[order];
+    if (freelist->count == 0) {
+        section->order_mask |= 1u << order;
+    }
+
+    freelist->count++;
+}
+
+__optimize(3) static inline void
+dec_freelist_count(struct page_section *const section, const uint8_t order) {
+    struct page_freelist *const freelist = &section->freelist_list[order];
+
+    freelist->count--;
+    if (freelist->count == 0) {
+        section->order_mask &= ~(1u << order);
+    }
+}
+
 __optimize(3) static void
 add_to_freelist_order(struct page_section *const section,
                       const uint8_t freelist_order,
@@ -37,7 +64,7 @@ add_to_freelist_order(struct page_section *const section,
     atomic_fetch_add(&section->zone->total_free, 1ull << freelist_order);
 
     section->total_free += 1ull << freelist_order;
-    freelist->count++;
+    inc_freelist_count(section, freelist_order);
 }
 
 // Add pages from the tail pages of a higher order into a lower order
@@ -62,7 +89,7 @@ add_to_freelist_order_from_higher(struct page_section *const section,
         back->freelist_tail.head = page;
     }
 
-    freelist->count++;
+    inc_freelist_count(section, freelist_order);
 }
 
 __optimize(3) struct page *
@@ -71,38 +98,16 @@ take_off_freelist_to_add_later(struct page_section *const section,
                                struct page *const page)
 {
     list_delete(&page->freelist_head.freelist);
-    struct page_freelist *const freelist =
-        &section->freelist_list[freelist_order];
+    dec_freelist_count(section, freelist_order);
 
-    freelist->count--;
-    if (freelist->count == 0) {
-        if (section->min_order == freelist_order) {
-            const struct page_freelist *iter = freelist;
-            const struct page_freelist *const end =
-                carr_end(section->freelist_list);
-
-            for (; iter != end; iter++) {
-                if (iter->count != 0) {
-                    break;
-                }
-            }
-
-            section->min_order = iter - section->freelist_list;
-        }
-
-        if (section->max_order == freelist_order) {
-            const struct page_freelist *const end = section->freelist_list - 1;
-            const struct page_freelist *iter =
-                (section->freelist_list + freelist_order) - 1;
-
-            for (; iter != end; iter--) {
-                if (iter->count != 0) {
-                    break;
-                }
-            }
+    // Clear the head and tail states so compaction, which scans ranges of
+    // pages, never mistakes a block that was merged or allocated for one still
+    // on a freelist.
 
-            section->max_order = (iter - section->freelist_list) + 1;
-        }
+    page_set_state(page, PAGE_STATE_IN_FREE_LIST);
+    if (freelist_order != 0) {
+        page_set_state(page + (1ull << freelist_order) - 1,
+                       PAGE_STATE_IN_FREE_LIST);
     }
 
     return page;
@@ -115,20 +120,7 @@ take_off_freelist_order(struct page_section *const section,
                         const uint8_t remove_page_order)
 {
     atomic_fetch_sub(&section->zone->total_free, 1ull << remove_page_order);
-
     section->total_free -= 1ull << remove_page_order;
-    if (section->total_free == 0) {
-        section->min_order = 0;
-        section->max_order = 0;
-
-        struct page_freelist *const freelist =
-            &section->freelist_list[freelist_order];
-
-        list_delete(&page->freelist_head.freelist);
-        freelist->count--;
-
-        return page;
-    }
 
     return take_off_freelist_to_add_later(section, freelist_order, page);
 }
@@ -149,6 +141,17 @@ get_from_freelist_order(struct page_section *const section,
     return take_off_freelist_order(section, order, page, page_remove_order);
 }
 
+// Caller is required to hold section's lock.
+
+__optimize(3) void
+isolate_free_block(struct page_section *const section, struct page *const page)
+{
+    const uint8_t order = page->freelist_head.order;
+
+    take_off_freelist_order(section, order, page, order);
+    page_set_state(page, PAGE_STATE_ISOLATED);
+}
+
 __optimize(3) static void
 free_range_of_pages(struct page *page,
                     struct page_section *const section,
@@ -165,14 +168,6 @@ free_range_of_pages(struct page *page,
         }
     }
 
-    // max_order in section is one plus the highest order that has at least one
-    // page in its freelist.
-
-    uint8_t highest_order = (uint8_t)order;
-    if (section->max_order <= highest_order) {
-        section->max_order = highest_order + 1;
-    }
-
     do {
         add_to_freelist_order(section, (uint8_t)order, page);
 
@@ -180,10 +175,6 @@ free_range_of_pages(struct page *page,
         avail -= page_count;
 
         if (avail == 0) {
-            if (section->min_order > (uint8_t)order) {
-                section->min_order = (uint8_t)order;
-            }
-
             break;
         }
 
@@ -212,7 +203,7 @@ setup_pages_off_freelist(struct page *const page,
         case PAGE_STATE_USED: {
             const struct page *const end = page + (1ull << order);
             for (struct page *iter = page; iter != end; iter++) {
-                page_set_state(page, state);
+                page_set_state(iter, state);
             }
 
             return;
@@ -220,6 +211,7 @@ setup_pages_off_freelist(struct page *const page,
         case PAGE_STATE_IN_FREE_LIST:
         case PAGE_STATE_FREE_LIST_HEAD:
         case PAGE_STATE_FREE_LIST_TAIL:
+        case PAGE_STATE_ISOLATED:
         case PAGE_STATE_LRU_CACHE:
             verify_not_reached();
         case PAGE_STATE_SLAB_HEAD: {
@@ -258,36 +250,6 @@ setup_pages_off_freelist(struct page *const page,
     verify_not_reached();
 }
 
-static void
-place_head_range_of_free_pages_lower(struct page *page,
-                                     struct page_section *const section,
-                                     const uint64_t amount,
-                                     const uint8_t orig_order)
-{
-    int8_t order = orig_order - 1;
-    uint64_t avail = amount;
-
-    for (uint8_t order_i = 0; order_i <= orig_order; order_i++) {
-        if (avail < (1ull << order_i)) {
-            order = order_i - 1;
-            break;
-        }
-    }
-
-    list_remove(&page->freelist_head.freelist);
-    list_add(&section->freelist_list[order].page_list,
-             &page->freelist_head.freelist);
-
-    page->freelist_head.order = (uint8_t)order;
-    avail -= 1ull << order;
-
-    if (avail == 0) {
-        return;
-    }
-
-    free_range_of_pages(page + (1ull << order), section, avail, (uint8_t)order);
-}
-
 __optimize(3) static struct page *
 get_large_from_freelist_order(struct page_section *const section,
                               const uint8_t freelist_order,
@@ -323,10 +285,7 @@ get_large_from_freelist_order(struct page_section *const section,
             page_phys = new_phys;
 
             const uint64_t free_amount = (uint64_t)(page - head);
-            place_head_range_of_free_pages_lower(head,
-                                                 section,
-                                                 free_amount,
-                                                 freelist_order);
+            free_range_of_pages(head, section, free_amount, freelist_order);
         }
 
         setup_pages_off_freelist(page, largepage_order, PAGE_STATE_LARGE_HEAD);
@@ -367,12 +326,71 @@ get_large_from_freelist_order(struct page_section *const section,
     return page;
 }
 
+__optimize(3) static void
+split_alloced_block(struct page_section *const section,
+                    struct page *const page,
+                    uint8_t alloced_order,
+                    const uint8_t order)
+{
+    while (alloced_order > order) {
+        alloced_order--;
+
+        struct page *const buddy_page = page + (1ull << alloced_order);
+        add_to_freelist_order_from_higher(section, alloced_order, buddy_page);
+    }
+}
+
+// Caller is required to hold section's lock.
+
+__optimize(3) static struct page *
+take_block_from_section(struct page_section *const section, const uint8_t order)
+{
+    // The first non-empty order at or above the one we want is the smallest
+    // block we can split.
+
+    const uint8_t alloced_order = find_lsb_one_bit(section->order_mask, order);
+    if (alloced_order >= MAX_ORDER) {
+        return NULL;
+    }
+
+    struct page *const page =
+        get_from_freelist_order(section, alloced_order, order);
+
+    split_alloced_block(section, page, alloced_order, order);
+    return page;
+}
+
+// Count an allocation against the zone of `page`. The allocation is local if
+// the page's memory is on the current cpu's numa node. A node's zone only holds
+// that node's memory, but the low4g zone holds memory of every node below 4gib,
+// so the node has to be looked up per page.
+
+__optimize(3) static inline void
+count_zone_alloc(struct page *const page, const uint64_t page_count) {
+    struct page_zone *const zone = page_to_section(page)->zone;
+    struct page_zone *const local_zone = page_zone_default();
+
+    const bool is_local =
+        zone == local_zone ||
+        (zone == page_zone_low4g() &&
+         &phys_to_numa_node(page_to_phys(page))->zone == local_zone);
+
+    if (is_local) {
+        atomic_fetch_add_explicit(&zone->local_alloc_count,
+                                  page_count,
+                                  memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&zone->remote_alloc_count,
+                                  page_count,
+                                  memory_order_relaxed);
+    }
+}
+
 __optimize(3) static struct page *
 try_alloc_pages_from_zone(struct page_zone *const zone,
                           const uint8_t order,
                           const enum page_state state)
 {
-    struct page *page = NULL;
     if (__builtin_expect(atomic_load(&zone->total_free) < (1ull << order), 0)) {
         return NULL;
     }
@@ -383,7 +401,6 @@ try_alloc_pages_from_zone(struct page_zone *const zone,
     int flag = 0;
 
     uint8_t section_index = 0;
-    uint8_t alloced_order = 0;
     uint8_t locked_section_mask = 0;
 
     struct page_section *iter =
@@ -404,18 +421,14 @@ try_alloc_pages_from_zone(struct page_zone *const zone,
             continue;
         }
 
-        alloced_order = max(order, iter->min_order);
-        const uint8_t max_order = iter->max_order;
+        struct page *const page = take_block_from_section(iter, order);
+        spin_release_with_irq(&iter->lock, flag);
 
-        for (; alloced_order < max_order; alloced_order++) {
-            page = get_from_freelist_order(iter, alloced_order, order);
-            if (page != NULL) {
-                goto done;
-            }
+        if (page != NULL) {
+            setup_pages_off_freelist(page, order, state);
+            return page;
         }
 
-        spin_release_with_irq(&iter->lock, flag);
-
         iter = list_next(iter, zone_list);
         if (&iter->zone_list == &zone->section_list) {
             break;
@@ -426,39 +439,248 @@ try_alloc_pages_from_zone(struct page_zone *const zone,
     } while (true);
 
     return NULL;
+}
 
-done:
-    if (alloced_order > order) {
-        const uint8_t highest_freed_order = alloced_order - 1;
-        if (iter->max_order <= highest_freed_order) {
-            iter->max_order = highest_freed_order + 1;
-        }
+// Set once the boot cpu's cache is ready. Until then, this_cpu() can't be used
+// to find any cpu's cache.
 
-        do {
-            alloced_order--;
+static bool g_cpu_page_cache_ready = false;
+
+// Returns the current cpu's cache, or NULL if it isn't ready. Caller is
+// required to have disabled irqs.
+
+__optimize(3) static inline struct cpu_page_cache *this_cpu_page_cache() {
+    if (!g_cpu_page_cache_ready) {
+        return NULL;
+    }
 
-            struct page *const buddy_page = page + (1ull << alloced_order);
-            add_to_freelist_order_from_higher(iter, alloced_order, buddy_page);
-        } while (alloced_order > order);
+    struct cpu_page_cache *const cache = &this_cpu_mut()->page_cache;
+    return cache->ready ? cache : NULL;
+}
+
+__optimize(3) static inline uint32_t cpu_page_cache_batch(const uint8_t order) {
+    return CPU_PAGE_CACHE_BATCH_COUNT >> order;
+}
+
+__optimize(3) static inline uint32_t cpu_page_cache_high(const uint8_t order) {
+    return cpu_page_cache_batch(order) * CPU_PAGE_CACHE_HIGH_BATCH_COUNT;
+}
+
+// Blocks held outside a section's freelist, in a cpu's cache or a zone's zeroed
+// pool, are marked as in-free-list so that find_nearby_free_pages() never tries
+// merging them into a section's freelist.
 
-        if (iter->min_order > order) {
-            iter->min_order = order;
+__optimize(3) static inline void
+mark_block_as_cached(struct page *const page, const uint8_t order) {
+    page_set_state(page, PAGE_STATE_IN_FREE_LIST);
+    page->freelist_head.order = order;
+
+    if (order != 0) {
+        page_set_state(page + (1ull << order) - 1, PAGE_STATE_IN_FREE_LIST);
+    }
+}
+
+// Take up to `count` blocks of the given order from the zone's sections,
+// taking each section's lock at most once.
+
+__optimize(3) static uint64_t
+take_blocks_from_zone(struct page_zone *const zone,
+                      const uint8_t order,
+                      struct page **const pages,
+                      const uint64_t count)
+{
+    if (atomic_load(&zone->total_free) < (1ull << order)) {
+        return 0;
+    }
+
+    uint64_t taken = 0;
+    struct page_section *section = NULL;
+
+    list_foreach(section, &zone->section_list, zone_list) {
+        const int flag = spin_acquire_with_irq(&section->lock);
+        for (; taken != count; taken++) {
+            struct page *const page = take_block_from_section(section, order);
+            if (page == NULL) {
+                break;
+            }
+
+            pages[taken] = page;
         }
+
+        spin_release_with_irq(&section->lock, flag);
+        if (taken == count) {
+            break;
+        }
+    }
+
+    return taken;
+}
+
+__optimize(3) static uint64_t
+take_blocks_from_zones(const uint8_t order,
+                       struct page **const pages,
+                       const uint64_t count)
+{
+    uint64_t taken = 0;
+
+    struct page_zone *zone = page_zone_default();
+    for (; zone != NULL && taken != count; zone = page_zone_fallback(zone)) {
+        taken +=
+            take_blocks_from_zone(zone, order, pages + taken, count - taken);
+    }
+
+    return taken;
+}
+
+// Move a batch of blocks from the buddy allocator into a cpu's list. Caller is
+// required to have disabled irqs.
+
+__optimize(3) static uint32_t
+refill_cpu_page_list(struct cpu_page_list *const list, const uint8_t order) {
+    struct page *pages[CPU_PAGE_CACHE_BATCH_COUNT];
+    const uint32_t count =
+        (uint32_t)take_blocks_from_zones(order,
+                                         pages,
+                                         cpu_page_cache_batch(order));
+
+    for (uint32_t i = 0; i != count; i++) {
+        mark_block_as_cached(pages[i], order);
+        list_radd(&list->page_list, &pages[i]->freelist_head.freelist);
+    }
+
+    list->count += count;
+    return count;
+}
+
+// Take up to `count` blocks already sitting in the current cpu's list,
+// without refilling the list.
+
+__optimize(3) static uint64_t
+take_blocks_from_cpu_cache(const uint8_t order,
+                           struct page **const pages,
+                           const uint64_t count)
+{
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return 0;
     }
 
-    spin_release_with_irq(&iter->lock, flag);
-    setup_pages_off_freelist(page, order, state);
+    struct cpu_page_list *const list = &cache->list[order];
+    const uint64_t taken = min(count, (uint64_t)list->count);
+    for (uint64_t i = 0; i != taken; i++) {
+        struct page *const page =
+            list_head(&list->page_list, struct page, freelist_head.freelist);
 
+        list_delete(&page->freelist_head.freelist);
+        pages[i] = page;
+    }
+
+    list->count -= taken;
+    enable_all_irqs_if_flag(flag);
+
+    return taken;
+}
+
+__optimize(3) static struct page *
+alloc_pages_from_cpu_cache(const uint8_t order) {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return NULL;
+    }
+
+    struct cpu_page_list *const list = &cache->list[order];
+    if (list->count == 0 && refill_cpu_page_list(list, order) == 0) {
+        enable_all_irqs_if_flag(flag);
+        return NULL;
+    }
+
+    struct page *const page =
+        list_head(&list->page_list, struct page, freelist_head.freelist);
+
+    list_delete(&page->freelist_head.freelist);
+    list->count--;
+
+    enable_all_irqs_if_flag(flag);
     return page;
 }
 
+// Every zone keeps up to ZEROED_POOL_MAX_COUNT zeroed pages ready, refilled
+// ZEROED_POOL_REFILL_COUNT pages at a time while idle, but only while the zone
+// has more than ZEROED_POOL_MIN_ZONE_FREE pages free.
+
+#define ZEROED_POOL_MAX_COUNT 256
+#define ZEROED_POOL_REFILL_COUNT 32
+#define ZEROED_POOL_MIN_ZONE_FREE 4096
+
+__optimize(3) static inline bool
+alloc_needs_zero(const enum page_state state, const uint64_t alloc_flags) {
+    return (alloc_flags & __ALLOC_ZERO) != 0 ||
+           state == PAGE_STATE_SLAB_HEAD ||
+           state == PAGE_STATE_TABLE;
+}
+
+// Take up to `count` zeroed pages from the zone's pool, or its fallbacks' pools
+// if allowed. Hits and misses are accounted to the zone that was asked for.
+
+__optimize(3) static uint64_t
+take_zeroed_pages(struct page_zone *const zone,
+                  const bool allow_fallback,
+                  struct page **const pages,
+                  const uint64_t count)
+{
+    uint64_t taken = 0;
+    struct page_zone *iter = zone;
+
+    do {
+        if (iter->zeroed_page_count != 0) {
+            const int flag = spin_acquire_with_irq(&iter->zeroed_lock);
+            for (; taken != count && iter->zeroed_page_count != 0; taken++) {
+                struct page *const page =
+                    list_head(&iter->zeroed_page_list,
+                              struct page,
+                              freelist_head.freelist);
+
+                list_delete(&page->freelist_head.freelist);
+                iter->zeroed_page_count--;
+
+                pages[taken] = page;
+            }
+
+            spin_release_with_irq(&iter->zeroed_lock, flag);
+        }
+
+        if (taken == count || !allow_fallback) {
+            break;
+        }
+
+        iter = page_zone_fallback(iter);
+    } while (iter != NULL);
+
+    atomic_fetch_add(&zone->zeroed_hit_count, taken);
+    atomic_fetch_add(&zone->zeroed_miss_count, count - taken);
+
+    return taken;
+}
+
 __optimize(3) struct page *
 setup_alloced_page(struct page *const page,
                    const enum page_state state,
                    const uint64_t alloc_flags,
                    const uint8_t order,
-                   const struct largepage_level_info *const largeinfo)
+                   const struct largepage_level_info *const largeinfo,
+                   const bool is_zeroed)
 {
+    // Blocks moved into a cpu's cache or a zeroed pool are only counted once
+    // they're handed out here.
+
+    count_zone_alloc(page, 1ull << order);
+
     switch (state) {
         case PAGE_STATE_SYSTEM_CRUCIAL:
             verify_not_reached();
@@ -467,11 +689,13 @@ setup_alloced_page(struct page *const page,
             const struct page *const end = page + page_count;
 
             for (struct page *iter = page; iter != end; iter++) {
-                list_init(&page->used.delayed_free_list);
-                refcount_init(&page->used.refcount);
+                page_clear_flag(iter, __PAGE_IS_MOVABLE);
+
+                list_init(&iter->used.delayed_free_list);
+                refcount_init(&iter->used.refcount);
             }
 
-            if (alloc_flags & __ALLOC_ZERO) {
+            if ((alloc_flags & __ALLOC_ZERO) && !is_zeroed) {
                 zero_multiple_pages(page_to_virt(page), page_count);
             }
 
@@ -480,17 +704,24 @@ setup_alloced_page(struct page *const page,
         case PAGE_STATE_IN_FREE_LIST:
         case PAGE_STATE_FREE_LIST_HEAD:
         case PAGE_STATE_FREE_LIST_TAIL:
+        case PAGE_STATE_ISOLATED:
         case PAGE_STATE_LRU_CACHE:
             verify_not_reached();
         case PAGE_STATE_SLAB_HEAD:
-            zero_multiple_pages(page_to_virt(page), 1ull << order);
+            if (!is_zeroed) {
+                zero_multiple_pages(page_to_virt(page), 1ull << order);
+            }
+
             list_init(&page->slab.head.slab_list);
 
             return page;
         case PAGE_STATE_SLAB_TAIL:
             verify_not_reached();
         case PAGE_STATE_TABLE:
-            zero_page(page_to_virt(page));
+            if (!is_zeroed) {
+                zero_page(page_to_virt(page));
+            }
+
             list_init(&page->table.delayed_free_list);
 
             page->table.refcount = REFCOUNT_EMPTY();
@@ -502,7 +733,7 @@ setup_alloced_page(struct page *const page,
             list_init(&page->largehead.delayed_free_list);
             page->largehead.level = largeinfo->level;
 
-            if (alloc_flags & __ALLOC_ZERO) {
+            if ((alloc_flags & __ALLOC_ZERO) && !is_zeroed) {
                 zero_multiple_pages(page_to_virt(page), 1ull << order);
             }
 
@@ -514,6 +745,24 @@ setup_alloced_page(struct page *const page,
     verify_not_reached();
 }
 
+// Return pages held outside the buddy allocator so they can merge into larger
+// blocks. Only once none are left is the free memory deferred at boot added,
+// and after that, the pages held by caches such as empty slabs are released.
+// Returns true if any pages were returned.
+
+__optimize(3) static inline bool reclaim_cached_pages() {
+    const bool drained_cpu_cache = cpu_page_cache_drain();
+    if (release_zeroed_page_pools() || drained_cpu_cache) {
+        return true;
+    }
+
+    if (mm_finish_deferred_init()) {
+        return true;
+    }
+
+    return shrinkers_run(UINT64_MAX) != 0;
+}
+
 struct page *
 alloc_pages(const enum page_state state,
             const uint64_t alloc_flags,
@@ -524,27 +773,65 @@ alloc_pages(const enum page_state state,
         return NULL;
     }
 
-    struct page_zone *zone = page_zone_default();
     struct page *page = NULL;
+    if (order == 0 && alloc_needs_zero(state, alloc_flags)) {
+        if (take_zeroed_pages(page_zone_default(),
+                              /*allow_fallback=*/true,
+                              &page,
+                              /*count=*/1) != 0)
+        {
+            setup_pages_off_freelist(page, order, state);
+            return setup_alloced_page(page,
+                                      state,
+                                      alloc_flags,
+                                      order,
+                                      /*largeinfo=*/NULL,
+                                      /*is_zeroed=*/true);
+        }
+    }
 
-    while (zone != NULL) {
-        page = try_alloc_pages_from_zone(zone, order, state);
+    if (order < CPU_PAGE_CACHE_ORDER_COUNT) {
+        page = alloc_pages_from_cpu_cache(order);
         if (page != NULL) {
+            setup_pages_off_freelist(page, order, state);
             return setup_alloced_page(page,
                                       state,
                                       alloc_flags,
                                       order,
-                                      /*largeinfo=*/NULL);
+                                      /*largeinfo=*/NULL,
+                                      /*is_zeroed=*/false);
         }
+    } else {
+        struct page_zone *zone = page_zone_default();
+        while (zone != NULL) {
+            page = try_alloc_pages_from_zone(zone, order, state);
+            if (page != NULL) {
+                return setup_alloced_page(page,
+                                          state,
+                                          alloc_flags,
+                                          order,
+                                          /*largeinfo=*/NULL,
+                                          /*is_zeroed=*/false);
+            }
+
+            zone = page_zone_fallback(zone);
+        }
+    }
 
-        zone = zone->fallback_zone;
+    // Pages held in our cpu's cache or in the zeroed pools may merge with free
+    // pages into a block we can use. Reclaiming empties both, and finishes
+    // deferred init once both are empty, so we only retry a bounded number of
+    // times.
+
+    if (reclaim_cached_pages()) {
+        return alloc_pages(state, alloc_flags, order);
     }
 
     return NULL;
 }
 
 struct page *
-alloc_pages_from_zone(struct page_zone *zone,
+alloc_pages_from_zone(struct page_zone *const zone,
                       const enum page_state state,
                       const uint64_t alloc_flags,
                       const uint8_t order,
@@ -555,36 +842,99 @@ alloc_pages_from_zone(struct page_zone *zone,
         return NULL;
     }
 
-    struct page *page = try_alloc_pages_from_zone(zone, order, state);
-    if (page != NULL) {
-    setup:
-        return setup_alloced_page(page,
-                                  state,
-                                  alloc_flags,
-                                  order,
-                                  /*largeinfo=*/NULL);
-    }
-
-    if (!allow_fallback) {
-        return NULL;
+    if (order == 0 && alloc_needs_zero(state, alloc_flags)) {
+        struct page *page = NULL;
+        if (take_zeroed_pages(zone, allow_fallback, &page, /*count=*/1) != 0) {
+            setup_pages_off_freelist(page, order, state);
+            return setup_alloced_page(page,
+                                      state,
+                                      alloc_flags,
+                                      order,
+                                      /*largeinfo=*/NULL,
+                                      /*is_zeroed=*/true);
+        }
     }
 
+    struct page_zone *iter = zone;
     do {
-        zone = zone->fallback_zone;
-        if (zone == NULL) {
-            break;
+        struct page *const page = try_alloc_pages_from_zone(iter, order, state);
+        if (page != NULL) {
+            return setup_alloced_page(page,
+                                      state,
+                                      alloc_flags,
+                                      order,
+                                      /*largeinfo=*/NULL,
+                                      /*is_zeroed=*/false);
         }
 
-        page = try_alloc_pages_from_zone(zone, order, state);
-        if (page != NULL) {
-            goto setup;
+        if (!allow_fallback) {
+            break;
         }
 
-    } while (true);
+        iter = page_zone_fallback(iter);
+    } while (iter != NULL);
+
+    if (reclaim_cached_pages()) {
+        return alloc_pages_from_zone(zone,
+                                     state,
+                                     alloc_flags,
+                                     order,
+                                     allow_fallback);
+    }
 
     return NULL;
 }
 
+uint64_t
+alloc_pages_bulk(const enum page_state state,
+                 const uint64_t alloc_flags,
+                 const uint8_t order,
+                 struct page **const pages,
+                 const uint64_t count)
+{
+    if (__builtin_expect(order >= MAX_ORDER, 0)) {
+        printk(LOGLEVEL_WARN,
+               "mm: alloc_pages_bulk() got order >= MAX_ORDER\n");
+        return 0;
+    }
+
+    uint64_t zeroed = 0;
+    if (order == 0 && alloc_needs_zero(state, alloc_flags)) {
+        zeroed = take_zeroed_pages(page_zone_default(),
+                                   /*allow_fallback=*/true,
+                                   pages,
+                                   count);
+    }
+
+    uint64_t alloced = zeroed;
+    if (alloced != count && order < CPU_PAGE_CACHE_ORDER_COUNT) {
+        alloced +=
+            take_blocks_from_cpu_cache(order, pages + alloced, count - alloced);
+    }
+
+    if (alloced != count) {
+        alloced +=
+            take_blocks_from_zones(order, pages + alloced, count - alloced);
+
+        if (alloced != count && reclaim_cached_pages()) {
+            alloced +=
+                take_blocks_from_zones(order, pages + alloced, count - alloced);
+        }
+    }
+
+    for (uint64_t i = 0; i != alloced; i++) {
+        setup_pages_off_freelist(pages[i], order, state);
+        setup_alloced_page(pages[i],
+                           state,
+                           alloc_flags,
+                           order,
+                           /*largeinfo=*/NULL,
+                           /*is_zeroed=*/i < zeroed);
+    }
+
+    return alloced;
+}
+
 __optimize(3) static struct page *
 try_alloc_large_page_from_zone(struct page_zone *const zone,
                                const struct largepage_level_info *const info)
@@ -601,10 +951,11 @@ try_alloc_large_page_from_zone(struct page_zone *const zone,
             continue;
         }
 
-        uint8_t alloced_order = max(order, iter->min_order);
-        const uint8_t max_order = iter->max_order;
-
-        for (; alloced_order < max_order; alloced_order++) {
+        const uint32_t order_mask = iter->order_mask;
+        for (uint8_t alloced_order = find_lsb_one_bit(order_mask, order);
+             alloced_order < MAX_ORDER;
+             alloced_order = find_lsb_one_bit(order_mask, alloced_order + 1))
+        {
             struct page *const page =
                 get_large_from_freelist_order(iter,
                                               alloced_order,
@@ -622,9 +973,40 @@ try_alloc_large_page_from_zone(struct page_zone *const zone,
     return NULL;
 }
 
+// Large-page allocations that fail even after reclaiming cached pages fall back
+// to compacting a block of the large-page's order.
+
+__optimize(3) static struct page *
+alloc_large_page_by_compacting(struct page_zone *zone,
+                               const uint64_t alloc_flags,
+                               const struct largepage_level_info *const info,
+                               const bool fallback)
+{
+    do {
+        struct page *const page = compact_zone_for_order(zone, info->order);
+        if (page != NULL) {
+            setup_pages_off_freelist(page, info->order, PAGE_STATE_LARGE_HEAD);
+            return setup_alloced_page(page,
+                                      PAGE_STATE_LARGE_HEAD,
+                                      alloc_flags,
+                                      info->order,
+                                      info,
+                                      /*is_zeroed=*/false);
+        }
+
+        if (!fallback) {
+            break;
+        }
+
+        zone = page_zone_fallback(zone);
+    } while (zone != NULL);
+
+    return NULL;
+}
+
 struct page *
 alloc_large_page(const pgt_level_t level, const uint64_t alloc_flags) {
-    struct page_zone *zone = page_zone_iterstart();
+    struct page_zone *zone = page_zone_default();
     const struct largepage_level_info *const info =
         &largepage_level_info_list[level - 1];
 
@@ -651,17 +1033,25 @@ alloc_large_page(const pgt_level_t level, const uint64_t alloc_flags) {
                                       PAGE_STATE_LARGE_HEAD,
                                       alloc_flags,
                                       order,
-                                      info);
+                                      info,
+                                      /*is_zeroed=*/false);
         }
 
-        zone = zone->fallback_zone;
+        zone = page_zone_fallback(zone);
     }
 
-    return NULL;
+    if (reclaim_cached_pages()) {
+        return alloc_large_page(level, alloc_flags);
+    }
+
+    return alloc_large_page_by_compacting(page_zone_default(),
+                                          alloc_flags,
+                                          info,
+                                          /*fallback=*/true);
 }
 
 struct page *
-alloc_large_page_from_zone(struct page_zone *zone,
+alloc_large_page_from_zone(struct page_zone *const zone,
                            const uint64_t alloc_flags,
                            const pgt_level_t level,
                            const bool fallback)
@@ -684,33 +1074,30 @@ alloc_large_page_from_zone(struct page_zone *zone,
         return NULL;
     }
 
-    struct page *page = try_alloc_large_page_from_zone(zone, info);
-    if (page != NULL) {
-    setup:
-        return setup_alloced_page(page,
-                                  PAGE_STATE_LARGE_HEAD,
-                                  alloc_flags,
-                                  order,
-                                  info);
-    }
-
-    if (!fallback) {
-        return NULL;
-    }
-
+    struct page_zone *iter = zone;
     do {
-        zone = zone->fallback_zone;
-        if (zone == NULL) {
-            break;
+        struct page *const page = try_alloc_large_page_from_zone(iter, info);
+        if (page != NULL) {
+            return setup_alloced_page(page,
+                                      PAGE_STATE_LARGE_HEAD,
+                                      alloc_flags,
+                                      order,
+                                      info,
+                                      /*is_zeroed=*/false);
         }
 
-        page = try_alloc_large_page_from_zone(zone, info);
-        if (page != NULL) {
-            goto setup;
+        if (!fallback) {
+            break;
         }
-    } while (true);
 
-    return NULL;
+        iter = page_zone_fallback(iter);
+    } while (iter != NULL);
+
+    if (reclaim_cached_pages()) {
+        return alloc_large_page_from_zone(zone, alloc_flags, level, fallback);
+    }
+
+    return alloc_large_page_by_compacting(zone, alloc_flags, info, fallback);
 }
 
 __optimize(3) void
@@ -736,7 +1123,7 @@ early_free_pages_from_section(struct page *const page,
     section->zone->total_free += 1ull << order;
     section->total_free += 1ull << order;
 
-    freelist->count++;
+    inc_freelist_count(section, order);
 }
 
 __optimize(3) bool
@@ -861,6 +1248,362 @@ void free_large_page(struct page *head) {
     spin_release_with_irq(&section->lock, flag);
 }
 
+// Caller is required to hold section's lock.
+
+__optimize(3) static void
+free_pages_to_section(struct page_section *const section,
+                      struct page *page,
+                      const uint8_t order)
+{
+    uint64_t amount = 1ull << order;
+    if (find_nearby_free_pages(page, amount, &page, &amount)) {
+        free_range_of_pages(page, section, amount, MAX_ORDER);
+        return;
+    }
+
+    add_to_freelist_order(section, order, page);
+}
+
+// Frees runs of physically contiguous blocks, holding a section's lock for as
+// long as consecutive blocks come from that section.
+
+struct free_pages_batch {
+    struct page_section *section;
+    struct page *run;
+
+    uint64_t run_count;
+    int flag;
+};
+
+#define FREE_PAGES_BATCH_INIT() \
+    ((struct free_pages_batch){ \
+        .section = NULL, \
+        .run = NULL, \
+        .run_count = 0, \
+        .flag = 0 \
+    })
+
+__optimize(3) static inline void
+free_pages_batch_flush_run(struct free_pages_batch *const batch) {
+    if (batch->run_count != 0) {
+        free_amount_of_pages(batch->run, batch->run_count);
+        batch->run_count = 0;
+    }
+}
+
+__optimize(3) static void
+free_pages_batch_add(struct free_pages_batch *const batch,
+                     struct page *const page,
+                     const uint64_t count)
+{
+    struct page_section *const section = page_to_section(page);
+    if (section == batch->section) {
+        if (batch->run + batch->run_count == page) {
+            batch->run_count += count;
+            return;
+        }
+
+        free_pages_batch_flush_run(batch);
+    } else {
+        free_pages_batch_flush_run(batch);
+        if (batch->section != NULL) {
+            spin_release_with_irq(&batch->section->lock, batch->flag);
+        }
+
+        batch->flag = spin_acquire_with_irq(&section->lock);
+        batch->section = section;
+    }
+
+    batch->run = page;
+    batch->run_count = count;
+}
+
+__optimize(3)
+static void free_pages_batch_finish(struct free_pages_batch *const batch) {
+    free_pages_batch_flush_run(batch);
+    if (batch->section != NULL) {
+        spin_release_with_irq(&batch->section->lock, batch->flag);
+        batch->section = NULL;
+    }
+}
+
+// Return the coldest `count` blocks of a cpu's list to the buddy allocator.
+// Caller is required to have disabled irqs.
+
+__optimize(3) static void
+drain_cpu_page_list(struct cpu_page_list *const list,
+                    const uint8_t order,
+                    const uint32_t count)
+{
+    struct free_pages_batch batch = FREE_PAGES_BATCH_INIT();
+    for (uint32_t i = 0; i != count; i++) {
+        struct page *const page =
+            list_tail(&list->page_list, struct page, freelist_head.freelist);
+
+        list_delete(&page->freelist_head.freelist);
+        free_pages_batch_add(&batch, page, 1ull << order);
+    }
+
+    free_pages_batch_finish(&batch);
+    list->count -= count;
+}
+
+// Returns false if the current cpu's cache isn't ready.
+
+__optimize(3) static bool
+free_pages_to_cpu_cache(struct page *const page, const uint8_t order) {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return false;
+    }
+
+    struct cpu_page_list *const list = &cache->list[order];
+    mark_block_as_cached(page, order);
+
+    list_add(&list->page_list, &page->freelist_head.freelist);
+    list->count++;
+
+    if (list->count > cpu_page_cache_high(order)) {
+        drain_cpu_page_list(list, order, cpu_page_cache_batch(order));
+    }
+
+    enable_all_irqs_if_flag(flag);
+    return true;
+}
+
+// Return the coldest `count` tables of a cpu's table cache to the buddy
+// allocator. Caller is required to have disabled irqs.
+
+__optimize(3) static void
+drain_cpu_table_list(struct cpu_page_list *const list, const uint32_t count) {
+    struct free_pages_batch batch = FREE_PAGES_BATCH_INIT();
+    for (uint32_t i = 0; i != count; i++) {
+        struct page *const page =
+            list_tail(&list->page_list, struct page, table.delayed_free_list);
+
+        list_delete(&page->table.delayed_free_list);
+        free_pages_batch_add(&batch, page, /*count=*/1);
+    }
+
+    free_pages_batch_finish(&batch);
+    list->count -= count;
+}
+
+// Keep a freed table in the current cpu's table cache if there's room for it.
+// Present ptes leave their table's refcount above zero, so a table with a
+// refcount of zero is already clean, while one torn down with its entries
+// still in place, see pageop_flush_pte_in_current_range(), is zeroed here.
+
+__optimize(3) static bool free_table_to_cpu_cache(struct page *const page) {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return false;
+    }
+
+    cache->table_free_count++;
+    if (cache->table_list.count >= cache->table_limit) {
+        enable_all_irqs_if_flag(flag);
+        return false;
+    }
+
+    if (ref_get(&page->table.refcount) != 0) {
+        zero_page(page_to_virt(page));
+    }
+
+    list_add(&cache->table_list.page_list, &page->table.delayed_free_list);
+    cache->table_list.count++;
+
+    enable_all_irqs_if_flag(flag);
+    return true;
+}
+
+__optimize(3) static struct page *alloc_table_from_cpu_cache() {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return NULL;
+    }
+
+    struct cpu_page_list *const list = &cache->table_list;
+    if (list->count == 0) {
+        enable_all_irqs_if_flag(flag);
+        return NULL;
+    }
+
+    struct page *const page =
+        list_head(&list->page_list, struct page, table.delayed_free_list);
+
+    list_delete(&page->table.delayed_free_list);
+    list->count--;
+
+    enable_all_irqs_if_flag(flag);
+
+    list_init(&page->table.delayed_free_list);
+    page->table.refcount = REFCOUNT_EMPTY();
+
+    return page;
+}
+
+void cpu_page_cache_init(struct cpu_page_cache *const cache) {
+    for (uint8_t order = 0; order != countof(cache->list); order++) {
+        list_init(&cache->list[order].page_list);
+        cache->list[order].count = 0;
+    }
+
+    list_init(&cache->table_list.page_list);
+
+    cache->table_list.count = 0;
+    cache->table_limit = CPU_TABLE_CACHE_MIN_COUNT;
+    cache->table_free_count = 0;
+    cache->ready = true;
+}
+
+void cpu_page_cache_init_boot() {
+    cpu_page_cache_init(&this_cpu_mut()->page_cache);
+    g_cpu_page_cache_ready = true;
+}
+
+bool cpu_page_cache_drain() {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return false;
+    }
+
+    bool drained = false;
+    for (uint8_t order = 0; order != countof(cache->list); order++) {
+        struct cpu_page_list *const list = &cache->list[order];
+        if (list->count != 0) {
+            drain_cpu_page_list(list, order, list->count);
+            drained = true;
+        }
+    }
+
+    if (cache->table_list.count != 0) {
+        drain_cpu_table_list(&cache->table_list, cache->table_list.count);
+        drained = true;
+    }
+
+    enable_all_irqs_if_flag(flag);
+    return drained;
+}
+
+void cpu_page_cache_trim() {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_page_cache *const cache = this_cpu_page_cache();
+
+    if (cache == NULL) {
+        enable_all_irqs_if_flag(flag);
+        return;
+    }
+
+    for (uint8_t order = 0; order != countof(cache->list); order++) {
+        struct cpu_page_list *const list = &cache->list[order];
+        const uint32_t batch = cpu_page_cache_batch(order);
+
+        if (list->count > batch) {
+            drain_cpu_page_list(list, order, list->count - batch);
+        }
+    }
+
+    // Move the limit a quarter of the way towards the amount of tables freed
+    // since the last trim, so a cpu that churns through page-tables keeps more
+    // of them around, while an idle cpu slowly gives them back.
+
+    const uint32_t limit =
+        (cache->table_limit * 3 + cache->table_free_count) / 4;
+
+    cache->table_limit =
+        min(max(limit, (uint32_t)CPU_TABLE_CACHE_MIN_COUNT),
+            (uint32_t)CPU_TABLE_CACHE_MAX_COUNT);
+    cache->table_free_count = 0;
+
+    if (cache->table_list.count > cache->table_limit) {
+        drain_cpu_table_list(&cache->table_list,
+                             cache->table_list.count - cache->table_limit);
+    }
+
+    enable_all_irqs_if_flag(flag);
+}
+
+bool release_zeroed_page_pools() {
+    bool released = false;
+    for_each_page_zone(zone) {
+        if (zone->zeroed_page_count == 0) {
+            continue;
+        }
+
+        struct free_pages_batch batch = FREE_PAGES_BATCH_INIT();
+        struct page *page = NULL;
+        struct page *tmp = NULL;
+
+        const int flag = spin_acquire_with_irq(&zone->zeroed_lock);
+        list_foreach_mut(page,
+                         tmp,
+                         &zone->zeroed_page_list,
+                         freelist_head.freelist)
+        {
+            list_delete(&page->freelist_head.freelist);
+            free_pages_batch_add(&batch, page, /*count=*/1);
+        }
+
+        free_pages_batch_finish(&batch);
+        list_init(&zone->zeroed_page_list);
+
+        zone->zeroed_page_count = 0;
+        spin_release_with_irq(&zone->zeroed_lock, flag);
+
+        released = true;
+    }
+
+    return released;
+}
+
+void refill_zeroed_page_pools() {
+    for_each_page_zone(zone) {
+        if (zone->zeroed_page_count >= ZEROED_POOL_MAX_COUNT ||
+            atomic_load(&zone->total_free) < ZEROED_POOL_MIN_ZONE_FREE)
+        {
+            continue;
+        }
+
+        struct page *pages[ZEROED_POOL_REFILL_COUNT];
+        const uint64_t wanted =
+            min((uint64_t)ZEROED_POOL_REFILL_COUNT,
+                ZEROED_POOL_MAX_COUNT - zone->zeroed_page_count);
+
+        const uint64_t count =
+            take_blocks_from_zone(zone, /*order=*/0, pages, wanted);
+
+        // Zero outside of any lock, this is the expensive part we're moving off
+        // of the allocation path.
+
+        for (uint64_t i = 0; i != count; i++) {
+            zero_page(page_to_virt(pages[i]));
+            mark_block_as_cached(pages[i], /*order=*/0);
+        }
+
+        const int flag = spin_acquire_with_irq(&zone->zeroed_lock);
+        for (uint64_t i = 0; i != count; i++) {
+            list_add(&zone->zeroed_page_list,
+                     &pages[i]->freelist_head.freelist);
+        }
+
+        zone->zeroed_page_count += count;
+        spin_release_with_irq(&zone->zeroed_lock, flag);
+    }
+}
+
 void free_pages(struct page *page, const uint8_t order) {
     if (__builtin_expect(order >= MAX_ORDER, 0)) {
         printk(LOGLEVEL_WARN, "mm: free_pages() got order >= MAX_ORDER\n");
@@ -879,17 +1622,82 @@ void free_pages(struct page *page, const uint8_t order) {
         return;
     }
 
-    uint64_t amount = 1ull << order;
-    if (find_nearby_free_pages(page, amount, &page, &amount)) {
-        free_range_of_pages(page, page_to_section(page), amount, MAX_ORDER);
-    } else {
-        add_to_freelist_order(page_to_section(page), order, page);
+    if (order < CPU_PAGE_CACHE_ORDER_COUNT &&
+        free_pages_to_cpu_cache(page, order))
+    {
+        return;
+    }
+
+    struct page_section *const section = page_to_section(page);
+    const int flag = spin_acquire_with_irq(&section->lock);
+
+    free_pages_to_section(section, page, order);
+    spin_release_with_irq(&section->lock, flag);
+}
+
+void
+free_pages_bulk(struct page *const *const pages,
+                const uint64_t count,
+                const uint8_t order)
+{
+    if (__builtin_expect(order >= MAX_ORDER, 0)) {
+        printk(LOGLEVEL_WARN, "mm: free_pages_bulk() got order >= MAX_ORDER\n");
+        return;
+    }
+
+    struct free_pages_batch batch = FREE_PAGES_BATCH_INIT();
+    for (uint64_t i = 0; i != count; i++) {
+        struct page *const page = pages[i];
+        if (page_get_state(page) == PAGE_STATE_LARGE_HEAD) {
+            free_pages_batch_finish(&batch);
+            free_large_page(page);
+
+            continue;
+        }
+
+        free_pages_batch_add(&batch, page, 1ull << order);
+    }
+
+    free_pages_batch_finish(&batch);
+}
+
+void free_page_list(struct list *const list) {
+    struct free_pages_batch batch = FREE_PAGES_BATCH_INIT();
+    struct page *page = NULL;
+    struct page *tmp = NULL;
+
+    list_foreach_mut(page, tmp, list, used.delayed_free_list) {
+        list_delete(&page->used.delayed_free_list);
+        if (page_get_state(page) == PAGE_STATE_TABLE &&
+            free_table_to_cpu_cache(page))
+        {
+            continue;
+        }
+
+        if (page_get_state(page) == PAGE_STATE_LARGE_HEAD) {
+            free_pages_batch_finish(&batch);
+            free_large_page(page);
+
+            continue;
+        }
+
+        free_pages_batch_add(&batch, page, /*count=*/1);
     }
+
+    free_pages_batch_finish(&batch);
+    list_init(list);
 }
 
 __optimize(3)
 struct page *deref_page(struct page *page, struct pageop *const pageop) {
     if (ref_down(&page->used.refcount)) {
+        // Compaction reads a movable page's rmap without a lock, and the
+        // delayed-free list overwrites it, so stop the page being movable
+        // first.
+
+        page_clear_flag(page, __PAGE_IS_MOVABLE);
+        atomic_thread_fence(memory_order_release);
+
         list_add(&pageop->delayed_free, &page->used.delayed_free_list);
         return NULL;
     }
@@ -922,5 +1730,10 @@ deref_large_page(struct page *const page,
 }
 
 struct page *alloc_table() {
+    struct page *const page = alloc_table_from_cpu_cache();
+    if (page != NULL) {
+        return page;
+    }
+
     return alloc_page(PAGE_STATE_TABLE, __ALLOC_ZERO);
 }
\ No newline at end of file
@@ -21,6 +21,15 @@ enum page_alloc_flags {
 void free_pages(struct page *page, uint8_t order);
 void free_large_page(struct page *page);
 
+// Bulk variants take each section's lock once for all the blocks they touch,
+// and free physically contiguous blocks as a single range so buddies coalesce
+// in one pass.
+
+void free_pages_bulk(struct page *const *pages, uint64_t count, uint8_t order);
+
+// Free every page on a pageop's delayed-free list, leaving the list empty.
+void free_page_list(struct list *list);
+
 struct page *deref_page(struct page *page, struct pageop *pageop);
 
 // We may not be necessarily derefing a large page, just a continuous set of
@@ -32,6 +41,16 @@ deref_large_page(struct page *page, struct pageop *pageop, pgt_level_t level);
 struct page *
 alloc_pages(enum page_state state, uint64_t alloc_flags, uint8_t order);
 
+// Returns the number of blocks allocated into `pages`, which may be less than
+// `count` if memory is running low.
+
+uint64_t
+alloc_pages_bulk(enum page_state state,
+                 uint64_t alloc_flags,
+                 uint8_t order,
+                 struct page **pages,
+                 uint64_t count);
+
 struct page_zone;
 
 struct page *
@@ -49,3 +68,17 @@ alloc_large_page_in_zone(struct page_zone *zone,
                          bool allow_fallback);
 
 struct page *alloc_table();
+
+// Used by compaction. Callers are required to hold the page's section's lock.
+
+struct page_section;
+
+void isolate_free_block(struct page_section *section, struct page *page);
+void free_amount_of_pages(struct page *page, uint64_t amount);
+
+// Zeroing order-0 allocations are served from a per-zone pool of pages zeroed
+// ahead of time. The pools are refilled while idle, and released back to the
+// buddy allocator when memory runs low.
+
+void refill_zeroed_page_pools();
+bool release_zeroed_page_pools();
@@ -4,7 +4,7 @@
  */
 
 #if defined(__x86_64__)
-    #include "asm/regs.h"
+    #include "asm/cr.h"
 #elif defined(__aarch64__)
     #include "asm/ttbr.h"
     #if defined(AARCH64_USE_16K_PAGES)
@@ -13,6 +13,13 @@
 #endif /* defined(__x86_64__) */
 
 #include "cpu/info.h"
+#include "lib/align.h"
+#include "lib/string.h"
+
+#include "asid.h"
+#include "kmalloc.h"
+#include "page_alloc.h"
+#include "pageop.h"
 #include "pgmap.h"
 
 __hidden struct pagemap kernel_pagemap = {
@@ -27,18 +34,31 @@ __hidden struct pagemap kernel_pagemap = {
     .cpu_lock = SPINLOCK_INIT(),
     .addrspace = ADDRSPACE_INIT(kernel_pagemap.addrspace),
     .addrspace_lock = SPINLOCK_INIT(),
+    .addrspace_seq = SEQCOUNT_INIT(),
     .refcount = REFCOUNT_CREATE_MAX(),
+
+    .id = PAGEMAP_KERNEL_ID,
+    .tlb_generation = 0
 };
 
+static _Atomic uint64_t g_next_pagemap_id = PAGEMAP_KERNEL_ID + 1;
+
 #if defined(__aarch64__)
     struct pagemap
     pagemap_create(pte_t *const lower_root, pte_t *const higher_root) {
         struct pagemap result = {
             .lower_root = lower_root,
             .higher_root = higher_root,
-            .addrspace = ADDRSPACE_INIT(result.addrspace)
+            .cpu_lock = SPINLOCK_INIT(),
+            .addrspace = ADDRSPACE_INIT(result.addrspace),
+            .addrspace_lock = SPINLOCK_INIT(),
+            .addrspace_seq = SEQCOUNT_INIT(),
+            .id = atomic_fetch_add(&g_next_pagemap_id, 1),
+            .tlb_generation = 0
         };
 
+        list_init(&result.cpu_list);
+
         refcount_init(&result.refcount);
         return result;
     }
@@ -46,14 +66,58 @@ __hidden struct pagemap kernel_pagemap = {
     struct pagemap pagemap_create(pte_t *const root) {
         struct pagemap result = {
             .root = root,
-            .addrspace = ADDRSPACE_INIT(result.addrspace)
+            .cpu_lock = SPINLOCK_INIT(),
+            .addrspace = ADDRSPACE_INIT(result.addrspace),
+            .addrspace_lock = SPINLOCK_INIT(),
+            .addrspace_seq = SEQCOUNT_INIT(),
+            .id = atomic_fetch_add(&g_next_pagemap_id, 1),
+            .tlb_generation = 0
         };
 
+        list_init(&result.cpu_list);
+
         refcount_init(&result.refcount);
         return result;
     }
 #endif /* defined(__aarch64__) */
 
+#if defined(__aarch64__)
+    void
+    pagemap_init(struct pagemap *const pagemap,
+                 pte_t *const lower_root,
+                 pte_t *const higher_root)
+    {
+        pagemap->lower_root = lower_root;
+        pagemap->higher_root = higher_root;
+
+        list_init(&pagemap->cpu_list);
+
+        pagemap->cpu_lock = SPINLOCK_INIT();
+        pagemap->addrspace = ADDRSPACE_INIT(pagemap->addrspace);
+        pagemap->addrspace_lock = SPINLOCK_INIT();
+        pagemap->addrspace_seq = SEQCOUNT_INIT();
+        pagemap->id = atomic_fetch_add(&g_next_pagemap_id, 1);
+        pagemap->tlb_generation = 0;
+
+        refcount_init(&pagemap->refcount);
+    }
+#else
+    void pagemap_init(struct pagemap *const pagemap, pte_t *const root) {
+        pagemap->root = root;
+
+        list_init(&pagemap->cpu_list);
+
+        pagemap->cpu_lock = SPINLOCK_INIT();
+        pagemap->addrspace = ADDRSPACE_INIT(pagemap->addrspace);
+        pagemap->addrspace_lock = SPINLOCK_INIT();
+        pagemap->addrspace_seq = SEQCOUNT_INIT();
+        pagemap->id = atomic_fetch_add(&g_next_pagemap_id, 1);
+        pagemap->tlb_generation = 0;
+
+        refcount_init(&pagemap->refcount);
+    }
+#endif /* defined(__aarch64__) */
+
 bool
 pagemap_find_space_and_add_vma(struct pagemap *const pagemap,
                                struct vm_area *const vma,
@@ -62,19 +126,22 @@ pagemap_find_space_and_add_vma(struct pagemap *const pagemap,
                                const uint64_t align)
 {
     const int flag = spin_acquire_with_irq(&pagemap->addrspace_lock);
+
+    seqcount_write_begin(&pagemap->addrspace_seq);
     const uint64_t addr =
         addrspace_find_space_and_add_node(&pagemap->addrspace,
                                           in_range,
                                           &vma->node,
                                           align);
 
+    seqcount_write_end(&pagemap->addrspace_seq);
 
     if (addr == ADDRSPACE_INVALID_ADDR) {
         spin_release_with_irq(&pagemap->addrspace_lock, flag);
         return false;
     }
 
-    if (vma->prot == PROT_NONE) {
+    if (vma->prot == PROT_NONE || (vma->flags & __VMA_ANONYMOUS) != 0) {
         spin_release_with_irq(&pagemap->addrspace_lock, flag);
         return true;
     }
@@ -100,12 +167,17 @@ pagemap_add_vma(struct pagemap *const pagemap,
                 uint64_t phys_addr)
 {
     const int flag = spin_acquire_with_irq(&pagemap->addrspace_lock);
-    if (!addrspace_add_node(&pagemap->addrspace, &vma->node)) {
+
+    seqcount_write_begin(&pagemap->addrspace_seq);
+    const bool added = addrspace_add_node(&pagemap->addrspace, &vma->node);
+    seqcount_write_end(&pagemap->addrspace_seq);
+
+    if (!added) {
         spin_release_with_irq(&pagemap->addrspace_lock, flag);
         return false;
     }
 
-    if (vma->prot == PROT_NONE) {
+    if (vma->prot == PROT_NONE || (vma->flags & __VMA_ANONYMOUS) != 0) {
         spin_release_with_irq(&pagemap->addrspace_lock, flag);
         return true;
     }
@@ -125,6 +197,132 @@ pagemap_add_vma(struct pagemap *const pagemap,
     return map_result;
 }
 
+// Bounds the lockless walk, as a walk racing with a rotation can follow a
+// pointer back up the tree. An avltree of 2^32 nodes is at most 46 levels deep.
+
+#define LOCKLESS_WALK_MAX_DEPTH 48
+#define LOCKLESS_LOOKUP_MAX_TRY_COUNT 4
+
+// Walk the pagemap's avltree without holding the addrspace-lock. The result is
+// only meaningful if the addrspace's seqcount didn't change during the walk.
+// vm_areas are type-stable, so every node reached is a vm_area, even if it was
+// freed under us.
+
+__optimize(3) static struct vm_area *
+lockless_find_vma(struct pagemap *const pagemap,
+                  const uint64_t addr,
+                  bool *const done_out)
+{
+    struct avlnode *avlnode = pagemap->addrspace.avltree.root;
+    for (uint8_t depth = 0; depth != LOCKLESS_WALK_MAX_DEPTH; depth++) {
+        if (avlnode == NULL) {
+            *done_out = true;
+            return NULL;
+        }
+
+        struct vm_area *const vma = vma_of(avlnode);
+        const struct range range = vma->node.range;
+
+        if (addr < range.front) {
+            avlnode = avlnode->left;
+        } else if (addr - range.front >= range.size) {
+            avlnode = avlnode->right;
+        } else {
+            *done_out = true;
+            return vma;
+        }
+    }
+
+    *done_out = false;
+    return NULL;
+}
+
+static struct vm_area *
+locked_find_vma_and_lock(struct pagemap *const pagemap,
+                         const uint64_t addr,
+                         int *const flag_out)
+{
+    const int flag = spin_acquire_with_irq(&pagemap->addrspace_lock);
+    struct addrspace_node *const node =
+        addrspace_find_node(&pagemap->addrspace, addr);
+
+    if (node == NULL) {
+        spin_release_with_irq(&pagemap->addrspace_lock, flag);
+        return NULL;
+    }
+
+    struct vm_area *const vma = container_of(node, struct vm_area, node);
+
+    *flag_out = spin_acquire_with_irq(&vma->lock);
+    spin_release_with_irq(&pagemap->addrspace_lock, flag);
+
+    return vma;
+}
+
+struct vm_area *
+pagemap_find_vma_and_lock(struct pagemap *const pagemap,
+                          const uint64_t addr,
+                          int *const flag_out)
+{
+    for (uint8_t i = 0; i != LOCKLESS_LOOKUP_MAX_TRY_COUNT; i++) {
+        const uint32_t seq = seqcount_read_begin(&pagemap->addrspace_seq);
+
+        bool done = false;
+        struct vm_area *const vma = lockless_find_vma(pagemap, addr, &done);
+
+        if (seqcount_read_retry(&pagemap->addrspace_seq, seq) || !done) {
+            continue;
+        }
+
+        if (vma == NULL) {
+            return NULL;
+        }
+
+        // The vm_area may have been removed before we took its lock, but
+        // removal changes the seqcount, and then waits for the lock before
+        // freeing the vm_area.
+
+        const int flag = spin_acquire_with_irq(&vma->lock);
+        if (!seqcount_read_retry(&pagemap->addrspace_seq, seq)) {
+            *flag_out = flag;
+            return vma;
+        }
+
+        spin_release_with_irq(&vma->lock, flag);
+    }
+
+    // The addrspace is changing too often for the lockless walk to finish.
+    return locked_find_vma_and_lock(pagemap, addr, flag_out);
+}
+
+void
+pagemap_remove_vma(struct pagemap *const pagemap, struct vm_area *const vma) {
+    int flag = spin_acquire_with_irq(&pagemap->addrspace_lock);
+
+    seqcount_write_begin(&pagemap->addrspace_seq);
+    addrspace_remove_node(&vma->node);
+    seqcount_write_end(&pagemap->addrspace_seq);
+
+    spin_release_with_irq(&pagemap->addrspace_lock, flag);
+
+    // Lockless lookups that found the vm_area before its removal may still be
+    // holding its lock.
+
+    const struct pgunmap_options options = {
+        .free_pages = (vma->flags & __VMA_ANONYMOUS) != 0,
+        .dont_split_large_pages = true
+    };
+
+    flag = spin_acquire_with_irq(&vma->lock);
+    arch_unmap_mapping(pagemap,
+                       vma->node.range,
+                       /*map_options=*/NULL,
+                       &options);
+
+    spin_release_with_irq(&vma->lock, flag);
+    vma_free(vma);
+}
+
 void switch_to_pagemap(struct pagemap *const pagemap) {
 #if defined(__aarch64__)
     assert(pagemap->lower_root != NULL);
@@ -140,10 +338,26 @@ void switch_to_pagemap(struct pagemap *const pagemap) {
 
     this_cpu_mut()->pagemap = pagemap;
 
+    // Read the pagemap's tlb generation while holding cpu_lock, so that a
+    // shootdown either sees this cpu on the pagemap's cpu_list, or has already
+    // moved the generation on.
+
+    bool flush = true;
+    const uint64_t asid = asid_for_pagemap(pagemap, &flush);
+
 #if defined(__x86_64__)
-    write_cr3(virt_to_phys(pagemap->root));
+    uint64_t cr3 = virt_to_phys(pagemap->root);
+    if (get_cpu_capabilities()->supports_pcid) {
+        cr3 |= asid;
+        if (!flush) {
+            cr3 |= __CR3_NOFLUSH;
+        }
+    }
+
+    write_cr3(cr3);
 #elif defined(__aarch64__)
-    write_ttbr0_el1(virt_to_phys(pagemap->lower_root));
+    write_ttbr0_el1(
+        virt_to_phys(pagemap->lower_root) | asid << TTBR_ASID_SHIFT);
     write_ttbr1_el1(virt_to_phys(pagemap->higher_root));
 
     #if defined(AARCH64_USE_16K_PAGES)
@@ -152,12 +366,247 @@ void switch_to_pagemap(struct pagemap *const pagemap) {
     #endif /* defined(AARCH64_USE_16K_PAGES) */
 
     asm volatile ("dsb sy; isb" ::: "memory");
+    if (flush) {
+        if (asid != 0) {
+            asm volatile ("tlbi aside1, %0; dsb nsh; isb"
+                          :: "r"(asid << TTBR_ASID_SHIFT)
+                          : "memory");
+        } else {
+            asm volatile ("tlbi vmalle1; dsb nsh; isb" ::: "memory");
+        }
+    }
 #else
     const uint64_t satp =
-        (PAGING_MODE + 8) << 60 | (virt_to_phys(pagemap->root) >> PML1_SHIFT);
+        (PAGING_MODE + 8) << 60 |
+        asid << SATP_ASID_SHIFT |
+        (virt_to_phys(pagemap->root) >> PML1_SHIFT);
 
-    asm volatile ("csrw satp, %0; sfence.vma" :: "r"(satp) : "memory");
+    if (flush) {
+        asm volatile ("csrw satp, %0; sfence.vma zero, %1"
+                      :: "r"(satp), "r"(asid)
+                      : "memory");
+    } else {
+        asm volatile ("csrw satp, %0" :: "r"(satp) : "memory");
+    }
 #endif /* defined(__x86_64__) */
 
     spin_release_with_irq(&pagemap->cpu_lock, flag);
-}
\ No newline at end of file
+}
+// Every mapping outside the kernel is in the lower-half, which on aarch64 has
+// its own root.
+
+__optimize(3)
+static inline pte_t *lower_root(const struct pagemap *const pagemap) {
+#if defined(__aarch64__)
+    return pagemap->lower_root;
+#else
+    return pagemap->root;
+#endif /* defined(__aarch64__) */
+}
+
+// Returns the pte the clone should use for the leaf at src_pte. Pages of
+// anonymous vm_areas are shared by taking a reference and making the pte
+// read-only in both pagemaps, so the first write to the page copies it.
+
+static pte_t
+share_leaf(pte_t *const src_pte, const pgt_level_t level, const bool is_cow) {
+    pte_t entry = pte_read(src_pte);
+    if (!is_cow) {
+        return entry;
+    }
+
+    if (pte_is_writable(entry)) {
+        entry = pte_make_readonly(entry);
+        pte_write(src_pte, entry);
+    }
+
+    struct page *const page = pte_to_page(entry);
+    if (level == 1) {
+        // The page is no longer mapped exactly once.
+        page_clear_flag(page, __PAGE_IS_MOVABLE);
+        ref_up(&page->used.refcount);
+
+        return entry;
+    }
+
+    if (page_get_state(page) == PAGE_STATE_LARGE_HEAD) {
+        ref_up(&page->largehead.refcount);
+        return entry;
+    }
+
+    const struct page *const end =
+        page + (1ull << largepage_level_info_list[level - 1].order);
+
+    for (struct page *iter = page; iter != end; iter++) {
+        ref_up(&iter->used.refcount);
+    }
+
+    return entry;
+}
+
+// Copy the tables of src_table that map `range` into dst_table. Only the tables
+// are copied, the leaf ptes point to the same pages.
+
+static bool
+clone_table(pte_t *const src_table,
+            pte_t *const dst_table,
+            const pgt_level_t level,
+            const struct range range,
+            const bool is_cow)
+{
+    struct page *const dst_page = virt_to_page(dst_table);
+
+    const uint64_t entry_size = 1ull << PAGE_SHIFTS[level - 1];
+    const uint64_t end = range_get_end_assert(range);
+
+    for (uint64_t virt = range.front; virt < end;) {
+        uint64_t next = align_down(virt, entry_size) + entry_size;
+        if (next == 0 || next > end) {
+            next = end;
+        }
+
+        const pgt_index_t index = virt_to_pt_index(virt, level);
+        const pte_t entry = pte_read(&src_table[index]);
+
+        if (!pte_is_present(entry)) {
+            virt = next;
+            continue;
+        }
+
+        pte_t *const dst_pte = &dst_table[index];
+        if (level == 1 ||
+            (pte_level_can_have_large(level) && pte_is_large(entry)))
+        {
+            pte_write(dst_pte, share_leaf(&src_table[index], level, is_cow));
+            ref_up(&dst_page->table.refcount);
+
+            virt = next;
+            continue;
+        }
+
+        pte_t dst_entry = pte_read(dst_pte);
+        if (!pte_is_present(dst_entry)) {
+            struct page *const table = alloc_table();
+            if (__builtin_expect(table == NULL, 0)) {
+                return false;
+            }
+
+            dst_entry =
+                phys_create_pte(page_to_phys(table)) |
+                (entry & ~(pte_t)PTE_PHYS_MASK);
+
+            pte_write(dst_pte, dst_entry);
+            ref_up(&dst_page->table.refcount);
+        }
+
+        if (!clone_table(pte_to_virt(entry),
+                         pte_to_virt(dst_entry),
+                         level - 1,
+                         range_create_end(virt, next),
+                         is_cow))
+        {
+            return false;
+        }
+
+        virt = next;
+    }
+
+    return true;
+}
+
+// Caller is required to hold the addrspace-lock of vma's pagemap.
+
+static bool
+clone_vma(struct pagemap *const pagemap, struct vm_area *const vma) {
+    struct vm_area *const clone =
+        vma_alloc(pagemap, vma->node.range, vma->prot, vma->cachekind);
+
+    if (__builtin_expect(clone == NULL, 0)) {
+        return false;
+    }
+
+    clone->flags = vma->flags;
+    assert(addrspace_add_node(&pagemap->addrspace, &clone->node));
+
+    struct pagemap *const src = vma_pagemap(vma);
+    const bool is_cow = (vma->flags & __VMA_ANONYMOUS) != 0;
+    const int flag = spin_acquire_with_irq(&vma->lock);
+    const bool result =
+        clone_table(lower_root(src),
+                    lower_root(pagemap),
+                    pgt_get_top_level(),
+                    vma->node.range,
+                    is_cow);
+
+    // Even a failed clone may have made some of src's ptes read-only.
+    if (is_cow) {
+        struct pageop pageop;
+        pageop_init(&pageop, src, vma->node.range);
+        pageop_finish(&pageop);
+    }
+
+    spin_release_with_irq(&vma->lock, flag);
+    return result;
+}
+
+static void destroy_clone(struct pagemap *const pagemap) {
+    struct vm_area *vma = NULL;
+    struct vm_area *tmp = NULL;
+
+    list_foreach_mut(vma, tmp, &pagemap->addrspace.list, node.list) {
+        pagemap_remove_vma(pagemap, vma);
+    }
+
+    free_page(virt_to_page(lower_root(pagemap)));
+    kfree(pagemap);
+}
+
+struct pagemap *pagemap_clone(struct pagemap *const src) {
+    assert(src != &kernel_pagemap);
+
+    struct pagemap *const pagemap = kmalloc(sizeof(*pagemap));
+    if (__builtin_expect(pagemap == NULL, 0)) {
+        return NULL;
+    }
+
+    struct page *const root = alloc_table();
+    if (__builtin_expect(root == NULL, 0)) {
+        kfree(pagemap);
+        return NULL;
+    }
+
+    // Hold a reference to the root so unmapping the last lower-half mapping
+    // doesn't free it.
+
+    ref_up(&root->table.refcount);
+    pte_t *const root_table = page_to_virt(root);
+
+#if defined(__aarch64__)
+    pagemap_init(pagemap, root_table, kernel_pagemap.higher_root);
+#else
+    // The kernel's half of the root is shared by every pagemap, so only its
+    // entries need to be copied.
+
+    const uint64_t half = PGT_PTE_COUNT(pgt_get_top_level()) / 2;
+    memcpy(root_table + half,
+           kernel_pagemap.root + half,
+           half * sizeof(pte_t));
+
+    pagemap_init(pagemap, root_table);
+#endif /* defined(__aarch64__) */
+
+    const int flag = spin_acquire_with_irq(&src->addrspace_lock);
+    struct vm_area *vma = NULL;
+
+    list_foreach(vma, &src->addrspace.list, node.list) {
+        if (__builtin_expect(!clone_vma(pagemap, vma), 0)) {
+            spin_release_with_irq(&src->addrspace_lock, flag);
+            destroy_clone(pagemap);
+
+            return NULL;
+        }
+    }
+
+    spin_release_with_irq(&src->addrspace_lock, flag);
+    return pagemap;
+}
@@ -5,6 +5,10 @@
 
 #pragma once
 
+#include <stdatomic.h>
+
+#include "cpu/seqcount.h"
+
 #include "lib/adt/addrspace.h"
 #include "lib/refcount.h"
 
@@ -22,8 +26,21 @@ struct pagemap {
     struct spinlock cpu_lock;
     struct refcount refcount;
 
+    // Unique for the lifetime of the kernel, unlike the pagemap's address,
+    // so a cpu can tell which pagemap its asids belong to.
+
+    uint64_t id;
+
+    // Incremented every time the pagemap's entries are shot down.
+    _Atomic uint64_t tlb_generation;
+
+    // The addrspace-lock serializes changes to the addrspace, which are also
+    // written under the seqcount, so lookups can walk the addrspace without
+    // the lock, see pagemap_find_vma_and_lock().
+
     struct address_space addrspace;
     struct spinlock addrspace_lock;
+    struct seqcount addrspace_seq;
 };
 
 #if defined(__aarch64__)
@@ -32,6 +49,19 @@ struct pagemap {
     struct pagemap pagemap_create(pte_t *root);
 #endif
 
+// Initialize a pagemap in place. pagemap_create() returns by value, which
+// leaves the pagemap's list-heads pointing at its temporary.
+
+#if defined(__aarch64__)
+    void
+    pagemap_init(struct pagemap *pagemap,
+                 pte_t *lower_root,
+                 pte_t *higher_root);
+#else
+    void pagemap_init(struct pagemap *pagemap, pte_t *root);
+#endif /* defined(__aarch64__) */
+
+#define PAGEMAP_KERNEL_ID 1
 extern struct pagemap kernel_pagemap;
 
 bool
@@ -46,4 +76,23 @@ pagemap_add_vma(struct pagemap *pagemap,
                 struct vm_area *vma,
                 uint64_t phys_addr);
 
+// Find the vm_area containing `addr` and take its lock, without taking the
+// pagemap's addrspace-lock, so faults on different vm_areas don't serialize. On
+// success, returns with vma->lock held and its flag in flag_out.
+
+struct vm_area *
+pagemap_find_vma_and_lock(struct pagemap *pagemap,
+                          uint64_t addr,
+                          int *flag_out);
+
+// Remove the vm_area from the pagemap, unmap its range and free it. Pages are
+// only freed for anonymous vm_areas.
+
+void pagemap_remove_vma(struct pagemap *pagemap, struct vm_area *vma);
 void switch_to_pagemap(struct pagemap *pagemap);
+
+// Create a copy of pagemap's lower-half that shares its pages. Pages of
+// anonymous vm_areas are copied on the first write by either pagemap, see
+// mm/fault.h. Only the page-tables are copied up front.
+
+struct pagemap *pagemap_clone(struct pagemap *pagemap);
@@ -12,8 +12,6 @@
 #include "pagemap.h"
 #include "page_alloc.h"
 
-#include "walker.h"
-
 __optimize(3) void
 pageop_init(struct pageop *const pageop,
             struct pagemap *const pagemap,
@@ -21,10 +19,50 @@ pageop_init(struct pageop *const pageop,
 {
     pageop->pagemap = pagemap;
     pageop->flush_range = range;
+    pageop->pending_range_count = 0;
 
     list_init(&pageop->delayed_free);
 }
 
+// Drop the references held by every present pte in `table`, then queue the
+// table itself to be freed. The whole table is going away, so its refcount
+// doesn't need to be updated entry by entry.
+
+static void
+flush_table(struct pageop *const pageop,
+            pte_t *const table,
+            const pgt_level_t level,
+            const bool should_free_pages)
+{
+    const pte_t *const end = table + PGT_PTE_COUNT(level);
+    for (const pte_t *pte = table; pte != end; pte++) {
+        const pte_t entry = pte_read(pte);
+        if (!pte_is_present(entry)) {
+            continue;
+        }
+
+        struct page *const page = pte_to_page(entry);
+        if (level == 1) {
+            if (ref_down(&page->used.refcount) && should_free_pages) {
+                list_add(&pageop->delayed_free, &page->used.delayed_free_list);
+            }
+        } else if (pte_level_can_have_large(level) && pte_is_large(entry)) {
+            if (ref_down(&page->largehead.refcount) && should_free_pages) {
+                list_add(&pageop->delayed_free,
+                         &page->largehead.delayed_free_list);
+            }
+        } else {
+            flush_table(pageop,
+                        pte_to_virt(entry),
+                        level - 1,
+                        should_free_pages);
+        }
+    }
+
+    struct page *const table_page = virt_to_page(table);
+    list_add(&pageop->delayed_free, &table_page->table.delayed_free_list);
+}
+
 void
 pageop_flush_pte_in_current_range(struct pageop *const pageop,
                                   const pte_t pte,
@@ -39,45 +77,23 @@ pageop_flush_pte_in_current_range(struct pageop *const pageop,
         return;
     }
 
-    struct pt_walker walker;
-    ptwalker_create_from_toplevel(&walker,
-                                  pte_phys,
-                                  level,
-                                  /*root_index=*/0,
-                                  /*alloc_pgtable=*/NULL,
-                                  /*free_pgtable=*/NULL);
-
-    while (true) {
-        pte_t *const walker_pte =
-            walker.tables[walker.level - 1] + walker.indices[walker.level - 1];
-
-        const pte_t entry = pte_read(walker_pte);
-        struct page *const page = pte_to_page(entry);
-
-        if (pte_is_large(entry)) {
-            if (ref_down(&page->largehead.refcount) && should_free_pages) {
-                list_add(&pageop->delayed_free,
-                         &page->largehead.delayed_free_list);
-            }
-        } else {
-            if (ref_down(&page->used.refcount) && should_free_pages) {
-                list_add(&pageop->delayed_free, &page->used.delayed_free_list);
-            }
-        }
-
-        ptwalker_deref_from_level(&walker, walker.level, pageop);
-
-        const enum pt_walker_result result = ptwalker_next(&walker);
-        if (__builtin_expect(result == E_PT_WALKER_OK, 1)) {
-            continue;
-        }
-
-        if (result == E_PT_WALKER_REACHED_END) {
-            break;
-        }
+    flush_table(pageop, pte_to_virt(pte), level - 1, should_free_pages);
+}
 
-        panic("mm: got result=%d while flushing pte\n", result);
+// Start a new flush_range, keeping the current one pending, unless the pending
+// list is full, in which case every range is flushed first.
+
+static void
+push_flush_range(struct pageop *const pageop, const struct range range) {
+    if (pageop->pending_range_count == PAGEOP_PENDING_RANGE_MAX) {
+        pageop_finish(pageop);
+    } else if (!range_empty(pageop->flush_range)) {
+        pageop->pending_range_list[pageop->pending_range_count] =
+            pageop->flush_range;
+        pageop->pending_range_count++;
     }
+
+    pageop->flush_range = range;
 }
 
 void
@@ -99,8 +115,7 @@ pageop_setup_for_address(struct pageop *const pageop, const uint64_t virt) {
         }
     }
 
-    pageop_finish(pageop);
-    pageop->flush_range = RANGE_INIT(virt, PAGE_SIZE);
+    push_flush_range(pageop, RANGE_INIT(virt, PAGE_SIZE));
 }
 
 void
@@ -125,31 +140,37 @@ pageop_setup_for_range(struct pageop *const pageop, const struct range virt) {
         }
     }
 
-    pageop_finish(pageop);
-    pageop->flush_range = virt;
-}
-
-__optimize(3) static void free_all_pages(struct pageop *const pageop) {
-    struct page *iter = NULL;
-    list_foreach(iter, &pageop->delayed_free, table.delayed_free_list) {
-        free_page(iter);
-    }
+    push_flush_range(pageop, virt);
 }
 
 __optimize(3) void pageop_finish(struct pageop *const pageop) {
-    if (range_empty(pageop->flush_range)) {
-        free_all_pages(pageop);
+    if (range_empty(pageop->flush_range) && pageop->pending_range_count == 0) {
+        free_page_list(&pageop->delayed_free);
         return;
     }
 
+    // Cpus that ran the pagemap before, and may still hold its entries under
+    // an asid, flush them when they next switch to the pagemap.
+
+    if (pageop->pagemap != &kernel_pagemap) {
+        atomic_fetch_add(&pageop->pagemap->tlb_generation, 1);
+    }
+
+#if defined(__x86_64__)
+    // Flushes every cpu using the pagemap, and frees the delayed pages only
+    // once they've all acknowledged.
+
+    tlb_flush_pageop(pageop);
+#else
     if (this_cpu()->pagemap == pageop->pagemap) {
-    #if defined(__x86_64__)
-        tlb_flush_pageop(pageop);
-    #elif defined(__riscv64)
+    #if defined(__riscv64)
         asm volatile ("fence.i" ::: "memory");
-    #endif /* defined(__x86_64__) */
+    #endif /* defined(__riscv64) */
     }
 
-    free_all_pages(pageop);
+    free_page_list(&pageop->delayed_free);
+#endif /* defined(__x86_64__) */
+
     pageop->flush_range = RANGE_EMPTY();
+    pageop->pending_range_count = 0;
 }
\ No newline at end of file
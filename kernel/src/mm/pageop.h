@@ -10,16 +10,26 @@
 
 #include "mm_types.h"
 
+// Amount of ranges a pageop collects before flushing them. Ranges that aren't
+// adjacent to flush_range are saved here so they can all be flushed together.
+
+#define PAGEOP_PENDING_RANGE_MAX 8
+
 struct pagemap;
 struct pageop {
     struct pagemap *pagemap;
     struct range flush_range;
+
+    struct range pending_range_list[PAGEOP_PENDING_RANGE_MAX];
+    uint8_t pending_range_count;
+
     struct list delayed_free;
 };
 
 #define PAGEOP_INIT(name) \
     ((struct pageop){ \
         .flush_range = RANGE_EMPTY(), \
+        .pending_range_count = 0, \
         .delayed_free = LIST_INIT(name.delayed_free) \
     })
 
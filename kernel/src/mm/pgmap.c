@@ -176,6 +176,10 @@ override_pte(struct pt_walker *const walker,
                 &walker->tables[level - 1][walker->indices[level - 1]];
 
             pte_write(pte, new_pte_value);
+            if (!options->is_in_early) {
+                ptwalker_ref_run(walker, level, /*count=*/1);
+            }
+
             return OVERRIDE_OK;
         }
 
@@ -188,6 +192,10 @@ override_pte(struct pt_walker *const walker,
         entry = pte_read(pte);
         if (!pte_is_present(entry)) {
             pte_write(pte, new_pte_value);
+            if (!options->is_in_early) {
+                ptwalker_ref_run(walker, level, /*count=*/1);
+            }
+
             return OVERRIDE_OK;
         }
     }
@@ -354,63 +362,55 @@ map_normal(struct pt_walker *const walker,
         }
 
         do {
-            pte_t *const table = walker->tables[0];
-            pte_t *pte = &table[walker->indices[0]];
-            const pte_t *const end = &table[PGT_PTE_COUNT(1)];
-
-            do {
-                const pte_t new_pte_value =
-                    phys_create_pte(phys_addr) | PTE_LEAF_FLAGS | pte_flags;
-
-                pte_write(pte, new_pte_value);
-
-                phys_addr += PAGE_SIZE;
-                pte++;
-
-                if (pte == end) {
-                    if (phys_addr == phys_end) {
-                        *offset_in = phys_addr - phys_begin;
-                        return MAP_DONE;
-                    }
-
-                    walker->indices[0] = PGT_PTE_COUNT(1) - 1;
-
-                    // Only fill in if we can't use largepages at the
-                    // parent-level
+            const uint64_t count =
+                ptwalker_run_count(walker,
+                                   /*level=*/1,
+                                   (phys_end - phys_addr) / PAGE_SIZE);
+
+            pte_fill_run(ptwalker_run_begin(walker, /*level=*/1),
+                         count,
+                         phys_addr,
+                         PAGE_SIZE,
+                         PTE_LEAF_FLAGS | pte_flags);
+
+            if (should_ref) {
+                ptwalker_ref_run(walker, /*level=*/1, count);
+            }
 
-                    const bool should_fill_in =
-                        (options->supports_largepage_at_level_mask &
-                            (1ull << 2)) == 0;
+            phys_addr += count * PAGE_SIZE;
+            if (phys_addr == phys_end) {
+                if (walker->indices[0] + count != PGT_PTE_COUNT(1)) {
+                    walker->indices[0] += count;
+                }
 
-                    iterate_options.alloc_parents = should_fill_in;
-                    iterate_options.alloc_level = should_fill_in;
+                *offset_in = phys_addr - phys_begin;
+                return MAP_DONE;
+            }
 
-                    ptwalker_result =
-                        ptwalker_next_with_options(walker,
-                                                   /*level=*/1,
-                                                   &iterate_options);
+            // Only fill in if we can't use largepages at the parent-level
+            const bool should_fill_in =
+                (options->supports_largepage_at_level_mask & (1ull << 2)) == 0;
 
-                    if (__builtin_expect(ptwalker_result != E_PT_WALKER_OK, 0))
-                    {
-                        goto panic;
-                    }
+            iterate_options.alloc_parents = should_fill_in;
+            iterate_options.alloc_level = should_fill_in;
 
-                    // Exit if the level above is at index 0, which may mean
-                    // that a large page can be placed at the higher level.
+            ptwalker_result =
+                ptwalker_next_run(walker,
+                                  /*level=*/1,
+                                  count,
+                                  &iterate_options);
 
-                    if (!should_fill_in) {
-                        *offset_in = phys_addr - phys_begin;
-                        return MAP_RESTART;
-                    }
+            if (__builtin_expect(ptwalker_result != E_PT_WALKER_OK, 0)) {
+                goto panic;
+            }
 
-                    break;
-                } else if (phys_addr == phys_end) {
-                    walker->indices[0] = pte - table;
-                    *offset_in = phys_addr - phys_begin;
+            // Exit if the level above is at index 0, which may mean that a
+            // large page can be placed at the higher level.
 
-                    return MAP_DONE;
-                }
-            } while (true);
+            if (!should_fill_in) {
+                *offset_in = phys_addr - phys_begin;
+                return MAP_RESTART;
+            }
         } while (true);
     }
 }
@@ -543,67 +543,100 @@ alloc_and_map_normal(struct pt_walker *const walker,
         }
 
         void *const alloc_page_cb_info = alloc_options->alloc_page_cb_info;
+        const pgmap_alloc_pages_bulk_t alloc_bulk =
+            alloc_options->alloc_pages_bulk;
+
+        const bool should_ref = !options->is_in_early;
+        const uint64_t leaf_flags = PTE_LEAF_FLAGS | pte_flags;
+
         do {
-            pte_t *const table = walker->tables[0];
-            pte_t *pte = &table[walker->indices[0]];
-            const pte_t *const end = &table[PGT_PTE_COUNT(1)];
+            pte_t *const run = ptwalker_run_begin(walker, /*level=*/1);
+            const uint64_t count =
+                ptwalker_run_count(walker,
+                                   /*level=*/1,
+                                   (size - offset) / PAGE_SIZE);
+
+            // Fill the run a bulk allocation at a time, and account for
+            // whatever was filled even if an allocation fails partway.
+
+            uint64_t filled = 0;
+            bool alloc_failed = false;
+
+            while (filled != count) {
+                if (alloc_bulk != NULL) {
+                    uint64_t phys_list[PGMAP_ALLOC_BULK_COUNT];
+                    const uint64_t alloc_count =
+                        alloc_bulk(phys_list,
+                                   min(count - filled,
+                                       (uint64_t)countof(phys_list)),
+                                   alloc_page_cb_info);
+
+                    if (__builtin_expect(alloc_count == 0, 0)) {
+                        alloc_failed = true;
+                        break;
+                    }
+
+                    pte_fill_run_from_list(run + filled,
+                                           phys_list,
+                                           alloc_count,
+                                           leaf_flags);
+
+                    filled += alloc_count;
+                    continue;
+                }
 
-            do {
                 const uint64_t page = alloc_a_page(alloc_page_cb_info);
                 if (__builtin_expect(page == INVALID_PHYS, 0)) {
-                    return ALLOC_AND_MAP_ALLOC_PAGE_FAIL;
+                    alloc_failed = true;
+                    break;
                 }
 
-                const pte_t new_pte_value =
-                    phys_create_pte(page) | PTE_LEAF_FLAGS | pte_flags;
-
-                pte_write(pte, new_pte_value);
+                pte_write(run + filled, phys_create_pte(page) | leaf_flags);
+                filled++;
+            }
 
-                pte++;
-                offset += PAGE_SIZE;
+            if (should_ref) {
+                ptwalker_ref_run(walker, /*level=*/1, filled);
+            }
 
-                if (pte == end) {
-                    if (offset == size) {
-                        *offset_in = offset;
-                        return ALLOC_AND_MAP_DONE;
-                    }
+            offset += filled * PAGE_SIZE;
+            if (__builtin_expect(alloc_failed, 0)) {
+                return ALLOC_AND_MAP_ALLOC_PAGE_FAIL;
+            }
 
-                    // Only fill in if we can't use largepages at the
-                    // parent-level
-                    const bool should_fill_in =
-                        (options->supports_largepage_at_level_mask &
-                            (1ull << 2)) == 0;
+            if (offset == size) {
+                if (walker->indices[0] + count != PGT_PTE_COUNT(1)) {
+                    walker->indices[0] += count;
+                }
 
-                    iterate_options.alloc_level = should_fill_in;
-                    iterate_options.alloc_parents = should_fill_in;
+                *offset_in = offset;
+                return ALLOC_AND_MAP_DONE;
+            }
 
-                    walker->indices[0] = PGT_PTE_COUNT(1) - 1;
-                    ptwalker_result =
-                        ptwalker_next_with_options(walker,
-                                                   walker->level,
-                                                   &iterate_options);
+            // Only fill in if we can't use largepages at the parent-level
+            const bool should_fill_in =
+                (options->supports_largepage_at_level_mask & (1ull << 2)) == 0;
 
-                    if (__builtin_expect(ptwalker_result != E_PT_WALKER_OK, 0))
-                    {
-                        return ALLOC_AND_MAP_ALLOC_PGTABLE_FAIL;
-                    }
+            iterate_options.alloc_level = should_fill_in;
+            iterate_options.alloc_parents = should_fill_in;
 
-                    // Exit if the level above is at index 0, which may mean
-                    // that a large page can be placed at the higher level.
+            ptwalker_result =
+                ptwalker_next_run(walker,
+                                  /*level=*/1,
+                                  count,
+                                  &iterate_options);
 
-                    if (!should_fill_in) {
-                        *offset_in = offset;
-                        return ALLOC_AND_MAP_RESTART;
-                    }
+            if (__builtin_expect(ptwalker_result != E_PT_WALKER_OK, 0)) {
+                return ALLOC_AND_MAP_ALLOC_PGTABLE_FAIL;
+            }
 
-                    break;
-                } else if (offset == size) {
-                    walker->indices[0] = pte - table;
-                    *offset_in = offset;
+            // Exit if the level above is at index 0, which may mean that a
+            // large page can be placed at the higher level.
 
-                    return ALLOC_AND_MAP_DONE;
-                }
-            } while (true);
+            if (!should_fill_in) {
+                *offset_in = offset;
+                return ALLOC_AND_MAP_RESTART;
+            }
         } while (true);
     }
 }
@@ -1614,6 +1647,58 @@ pgmap_alloc_at(struct pagemap *const pagemap,
     return result;
 }
 
+// Clear up to max_count ptes of the level-1 run at the walker, returning how
+// many were cleared. Ptes that aren't present are skipped, so the table's
+// refcount, which counts present ptes, is only dropped for the rest.
+
+__optimize(3) static uint64_t
+unmap_run(struct pt_walker *const walker,
+          struct pageop *const pageop,
+          const uint64_t max_count,
+          const bool should_free_pages)
+{
+    pte_t *const run = ptwalker_run_begin(walker, /*level=*/1);
+    const uint64_t count = ptwalker_run_count(walker, /*level=*/1, max_count);
+
+    uint64_t present_count = 0;
+    for (uint64_t i = 0; i != count; i++) {
+        const pte_t entry = pte_read(run + i);
+        if (!pte_is_present(entry)) {
+            continue;
+        }
+
+        if (should_free_pages) {
+            deref_page(pte_to_page(entry), pageop);
+        }
+
+        present_count++;
+    }
+
+    pte_clear_run(run, count);
+    ptwalker_deref_run(walker, /*level=*/1, present_count, pageop);
+
+    return count;
+}
+
+// Returns the highest level a pte of which can be cleared at `virt` without
+// going past `size` bytes, or unmapping anything before `virt`.
+
+__optimize(3) static pgt_level_t
+unmap_level(const struct pt_walker *const walker,
+            const uint64_t virt,
+            const uint64_t size)
+{
+    pgt_level_t level = 1;
+    for (; level != walker->top_level; level++) {
+        const uint64_t next_size = PAGE_SIZE_AT_LEVEL(level + 1);
+        if (size < next_size || !has_align(virt, next_size)) {
+            break;
+        }
+    }
+
+    return level;
+}
+
 bool
 pgunmap_at(struct pagemap *const pagemap,
            const struct range virt_range,
@@ -1632,20 +1717,63 @@ pgunmap_at(struct pagemap *const pagemap,
     ptwalker_default_for_pagemap(&walker, pagemap, virt_range.front);
     pageop_init(&pageop, pagemap, virt_range);
 
+    // Unmapping must never allocate tables for the holes in the range.
+    const struct pt_walker_iterate_options iterate_options = {
+        .alloc_pgtable_cb_info = NULL,
+        .free_pgtable_cb_info = &pageop,
+
+        .alloc_parents = false,
+        .alloc_level = false,
+        .should_ref = false,
+    };
+
     const bool should_free_pages = unmap_options->free_pages;
     const bool dont_split_large_pages = unmap_options->dont_split_large_pages;
 
-    // Try flushing entire tables if we can.
-    pgt_level_t level = walker.level;
-    for (pgt_level_t iter = level + 1; iter <= walker.top_level; iter++) {
-        if (virt_range.size < PAGE_SIZE_AT_LEVEL(iter)) {
-            level = iter - 1;
-            break;
-        }
-    }
-
     uint64_t offset = 0;
     do {
+        // Try flushing entire tables if we can.
+        const pgt_level_t level =
+            unmap_level(&walker,
+                        virt_range.front + offset,
+                        virt_range.size - offset);
+
+        // The walker stops at the lowest level that has a table, so a pte at
+        // that level that isn't present means the tables below it are
+        // missing, and there's nothing to unmap until the end of the range the
+        // pte covers.
+
+        if (walker.level >= level && walker.level > 1) {
+            const pte_t entry =
+                pte_read(ptwalker_run_begin(&walker, walker.level));
+
+            if (!pte_is_present(entry)) {
+                const uint64_t hole_mask = PAGE_SIZE_AT_LEVEL(walker.level) - 1;
+                const uint64_t hole_size =
+                    hole_mask + 1 - ((virt_range.front + offset) & hole_mask);
+
+                offset += min(hole_size, virt_range.size - offset);
+                if (offset == virt_range.size) {
+                    break;
+                }
+
+                const enum pt_walker_result walker_result =
+                    ptwalker_next_with_options(&walker,
+                                               walker.level,
+                                               &iterate_options);
+
+                if (__builtin_expect(walker_result != E_PT_WALKER_OK, 0)) {
+                    pageop_finish(&pageop);
+                    return false;
+                }
+
+                continue;
+            }
+        }
+
+        uint64_t unmapped_size = PAGE_SIZE_AT_LEVEL(level);
+        uint64_t run_count = 1;
+
         // Sanity check for the rare case where we have a bug in pgmap; a table
         // doesn't have a pte at the appropriate index, which we're supposed to
         // unmap.
@@ -1666,8 +1794,11 @@ pgunmap_at(struct pagemap *const pagemap,
                 return false;
             }
 
-            pte_t *const pte =
-                &walker.tables[level - 1][walker.indices[level - 1]];
+            // The tables below the large page don't exist, so the pte is the
+            // one at the walker's level.
+
+            const pgt_level_t large_level = walker.level;
+            pte_t *const pte = ptwalker_run_begin(&walker, large_level);
 
             // Sanity check for the rare case where we're not actually dealing
             // with a large page (instead, a bug in pgmap because we have a
@@ -1680,12 +1811,12 @@ pgunmap_at(struct pagemap *const pagemap,
             }
 
             pte_write(pte, /*value=*/0);
-            ptwalker_deref_from_level(&walker, walker.level, &pageop);
+            ptwalker_deref_from_level(&walker, large_level, &pageop);
 
             const uint64_t pte_phys = pte_to_phys(entry);
             if (pte_is_dirty(entry)) {
                 set_pages_dirty(phys_to_page(pte_phys),
-                                PAGE_SIZE_AT_LEVEL(walker.level) / PAGE_SIZE);
+                                PAGE_SIZE_AT_LEVEL(large_level) / PAGE_SIZE);
             }
 
             const uint64_t map_size = virt_range.size - offset;
@@ -1701,6 +1832,14 @@ pgunmap_at(struct pagemap *const pagemap,
                 pageop_finish(&pageop);
                 return false;
             }
+        } else if (level == 1) {
+            run_count =
+                unmap_run(&walker,
+                          &pageop,
+                          PAGE_COUNT(virt_range.size - offset),
+                          should_free_pages);
+
+            unmapped_size = run_count * PAGE_SIZE;
         } else {
             pte_t *const pte =
                 &walker.tables[level - 1][walker.indices[level - 1]];
@@ -1717,27 +1856,28 @@ pgunmap_at(struct pagemap *const pagemap,
                 pte_write(pte, /*value=*/0);
             }
 
-            ptwalker_deref_from_level(&walker, walker.level, &pageop);
-        }
+            // The pte may point to a table flushed above, so only the table
+            // holding the pte loses a reference.
 
-        const uint64_t page_size = PAGE_SIZE_AT_LEVEL(level);
-        offset += page_size;
+            ptwalker_deref_from_level(&walker, level, &pageop);
+        }
 
+        offset += unmapped_size;
         if (offset == virt_range.size) {
             break;
         }
 
         walker.level = level;
-        const enum pt_walker_result walker_result = ptwalker_next(&walker);
+        const enum pt_walker_result walker_result =
+            ptwalker_next_run(&walker,
+                              level,
+                              run_count,
+                              &iterate_options);
 
         if (__builtin_expect(walker_result != E_PT_WALKER_OK, 0)) {
             pageop_finish(&pageop);
             return false;
         }
-
-        while (virt_range.size - offset < PAGE_SIZE_AT_LEVEL(level)) {
-            level--;
-        }
     } while (true);
 
     pageop_finish(&pageop);
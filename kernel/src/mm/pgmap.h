@@ -28,10 +28,22 @@ pgmap_at(struct pagemap *pagemap,
 typedef uint64_t (*pgmap_alloc_page_t)(void *cb_info);
 typedef uint64_t (*pgmap_alloc_large_page_t)(pgt_level_t level, void *cb_info);
 
+// Fill phys_list with up to count pages, and return the number of pages
+// allocated, or 0 on failure. count is never above PGMAP_ALLOC_BULK_COUNT.
+
+#define PGMAP_ALLOC_BULK_COUNT 64
+
+typedef uint64_t
+(*pgmap_alloc_pages_bulk_t)(uint64_t *phys_list, uint64_t count, void *cb_info);
+
 struct pgmap_alloc_options {
     pgmap_alloc_page_t alloc_page;
     pgmap_alloc_large_page_t alloc_large_page;
 
+    // Optional. When provided, pages are allocated a page-table at a time
+    // instead of one page at a time. Receives alloc_page_cb_info.
+    pgmap_alloc_pages_bulk_t alloc_pages_bulk;
+
     void *alloc_page_cb_info;
     void *alloc_large_page_cb_info;
 };
@@ -67,6 +79,16 @@ arch_make_mapping(struct pagemap *pagemap,
                   enum vma_cachekind cachekind,
                   bool is_overwrite);
 
+// Map virt_range to newly allocated order-0 pages, which are freed when the
+// range is unmapped with free_pages set.
+
+enum pgmap_alloc_result
+arch_alloc_mapping(struct pagemap *pagemap,
+                   struct range virt_range,
+                   prot_t prot,
+                   enum vma_cachekind cachekind,
+                   const struct pgmap_alloc_options *alloc_options);
+
 bool
 arch_unmap_mapping(struct pagemap *pagemap,
                    struct range virt_range,
@@ -0,0 +1,313 @@
+/*
+ * kernel/src/mm/promote.c
+ * © suhas pai
+ */
+
+#include <stdatomic.h>
+
+#include "cpu/info.h"
+#include "dev/printk.h"
+
+#include "lib/align.h"
+#include "lib/string.h"
+
+#include "page_alloc.h"
+#include "pagemap.h"
+#include "pageop.h"
+#include "promote.h"
+#include "walker.h"
+
+// Only leaf tables are promoted, into a large page of the level above them.
+#define PROMOTE_LEVEL 2
+#define PROMOTE_SIZE (1ull << PAGE_SHIFTS[PROMOTE_LEVEL - 1])
+
+// A block is only promoted once 7/8ths of its ptes are present, so promotion
+// doesn't zero-fill much memory the vm_area never touched.
+
+#define PROMOTE_MIN_PRESENT_COUNT (PGT_PTE_COUNT(1) - PGT_PTE_COUNT(1) / 8)
+
+// Amount of blocks looked at in a single idle call.
+#define PROMOTE_IDLE_SCAN_COUNT 8
+
+static _Atomic bool g_idle_promoting = false;
+
+static uint64_t g_idle_pagemap_id = 0;
+static uint64_t g_idle_addr = 0;
+
+static _Atomic uint64_t g_promote_count = 0;
+static _Atomic uint64_t g_zero_filled_count = 0;
+static _Atomic uint64_t g_tlb_reach_gained = 0;
+
+__optimize(3) static bool vma_can_promote(const struct vm_area *const vma) {
+    return (vma->flags & __VMA_ANONYMOUS) != 0 && (vma->prot & PROT_WRITE) != 0;
+}
+
+// Returns the leaf table mapping the block at `front` if enough of its ptes are
+// present, and every present pte maps a page that can be copied and freed. The
+// pte pointing to the table is written to `parent_pte_out`. Caller is required
+// to hold vma->lock.
+
+static pte_t *
+find_promotable_table(struct pagemap *const pagemap,
+                      const uint64_t front,
+                      pte_t **const parent_pte_out)
+{
+    struct pt_walker walker;
+    ptwalker_default_for_pagemap(&walker, pagemap, front);
+
+    // Either nothing in the block is mapped, or a large page already maps it.
+    if (walker.level != 1) {
+        return NULL;
+    }
+
+    pte_t *const table = walker.tables[0];
+    uint64_t present_count = 0;
+
+    for (uint64_t i = 0; i != PGT_PTE_COUNT(1); i++) {
+        const pte_t entry = pte_read(table + i);
+        if (!pte_is_present(entry)) {
+            continue;
+        }
+
+        // Read-only ptes of a writable vm_area are shared with a clone.
+        if (!pte_is_writable(entry)) {
+            return NULL;
+        }
+
+        struct page *const page = pte_to_page(entry);
+        if (page_get_state(page) != PAGE_STATE_USED ||
+            ref_get(&page->used.refcount) != 1)
+        {
+            return NULL;
+        }
+
+        present_count++;
+    }
+
+    if (present_count < PROMOTE_MIN_PRESENT_COUNT) {
+        return NULL;
+    }
+
+    *parent_pte_out = walker.tables[1] + walker.indices[1];
+    return table;
+}
+
+// Find the first block at or after `*addr` that's inside a vm_area that can be
+// promoted. Caller is required to hold pagemap's addrspace-lock.
+
+static struct vm_area *
+find_next_block(struct pagemap *const pagemap, uint64_t *const addr) {
+    struct vm_area *vma = NULL;
+    list_foreach(vma, &pagemap->addrspace.list, node.list) {
+        const uint64_t end = range_get_end_assert(vma->node.range);
+        if (end <= *addr || !vma_can_promote(vma)) {
+            continue;
+        }
+
+        uint64_t front = 0;
+        if (!align_up(max(*addr, vma->node.range.front), PROMOTE_SIZE, &front))
+        {
+            return NULL;
+        }
+
+        if (front < end && end - front >= PROMOTE_SIZE) {
+            *addr = front;
+            return vma;
+        }
+    }
+
+    return NULL;
+}
+
+// Look at up to PROMOTE_IDLE_SCAN_COUNT blocks starting at g_idle_addr, and
+// stop at the first one that can be promoted.
+
+static bool find_candidate(struct pagemap *const pagemap) {
+    const int flag = spin_acquire_with_irq(&pagemap->addrspace_lock);
+    bool found = false;
+
+    for (uint32_t i = 0; i != PROMOTE_IDLE_SCAN_COUNT; i++) {
+        struct vm_area *const vma = find_next_block(pagemap, &g_idle_addr);
+        if (vma == NULL) {
+            g_idle_addr = 0;
+            break;
+        }
+
+        pte_t *parent_pte = NULL;
+        const int vma_flag = spin_acquire_with_irq(&vma->lock);
+
+        found =
+            find_promotable_table(pagemap, g_idle_addr, &parent_pte) != NULL;
+
+        spin_release_with_irq(&vma->lock, vma_flag);
+
+        if (found) {
+            break;
+        }
+
+        g_idle_addr += PROMOTE_SIZE;
+    }
+
+    spin_release_with_irq(&pagemap->addrspace_lock, flag);
+    return found;
+}
+
+// Copy the block's pages into `large`, zeroing the rest, and map `large` in
+// place of the block's leaf table. Caller is required to hold vma->lock.
+
+static void
+promote_block(struct pagemap *const pagemap,
+              const uint64_t front,
+              pte_t *const parent_pte,
+              const pte_t *const table,
+              struct page *const large)
+{
+    // Every present pte of a vm_area has the same flags, other than the
+    // accessed and dirty bits.
+
+    pte_t leaf_entry = 0;
+    for (uint64_t i = 0; i != PGT_PTE_COUNT(1); i++) {
+        leaf_entry = pte_read(table + i);
+        if (pte_is_present(leaf_entry)) {
+            break;
+        }
+    }
+
+    // Unmap the whole block before copying, so a write from another cpu can't
+    // land in a page that was already copied. Faults on the block wait on
+    // vma->lock until the large page is mapped.
+
+    const pte_t table_entry = pte_read(parent_pte);
+    struct pageop pageop;
+
+    pageop_init(&pageop, pagemap, RANGE_INIT(front, PROMOTE_SIZE));
+    pte_write(parent_pte, 0);
+    pageop_finish(&pageop);
+
+    uint8_t *const dst = page_to_virt(large);
+    uint64_t zero_filled_count = 0;
+
+    for (uint64_t i = 0; i != PGT_PTE_COUNT(1); i++) {
+        const pte_t entry = pte_read(table + i);
+        void *const page_dst = dst + (i << PAGE_SHIFT);
+
+        if (pte_is_present(entry)) {
+            memcpy(page_dst, pte_to_virt(entry), PAGE_SIZE);
+        } else {
+            bzero(page_dst, PAGE_SIZE);
+            zero_filled_count++;
+        }
+    }
+
+    pte_write(parent_pte,
+              phys_create_pte(page_to_phys(large)) |
+              pte_leaf_to_large_flags(leaf_entry, PROMOTE_LEVEL));
+
+    // The block was unmapped above, so this only frees the leaf table and the
+    // pages it mapped.
+
+    pageop_init(&pageop, pagemap, RANGE_INIT(front, PROMOTE_SIZE));
+    pageop_flush_pte_in_current_range(&pageop,
+                                      table_entry,
+                                      PROMOTE_LEVEL,
+                                      /*should_free_pages=*/true);
+    pageop_finish(&pageop);
+
+    atomic_fetch_add(&g_promote_count, 1);
+    atomic_fetch_add(&g_zero_filled_count, zero_filled_count);
+    atomic_fetch_add(&g_tlb_reach_gained, PROMOTE_SIZE - PAGE_SIZE);
+}
+
+// The block at `front` may have changed since find_candidate() looked at it, so
+// everything is checked again under the locks.
+
+static bool
+try_promote(struct pagemap *const pagemap,
+            const uint64_t front,
+            struct page *const large)
+{
+    const int flag = spin_acquire_with_irq(&pagemap->addrspace_lock);
+    struct addrspace_node *const node =
+        addrspace_find_node(&pagemap->addrspace, front);
+
+    bool result = false;
+    struct vm_area *const vma =
+        node != NULL ? container_of(node, struct vm_area, node) : NULL;
+
+    if (vma != NULL &&
+        vma_can_promote(vma) &&
+        range_get_end_assert(vma->node.range) - front >= PROMOTE_SIZE)
+    {
+        const int vma_flag = spin_acquire_with_irq(&vma->lock);
+        pte_t *parent_pte = NULL;
+        pte_t *const table = find_promotable_table(pagemap, front, &parent_pte);
+
+        if (table != NULL) {
+            promote_block(pagemap, front, parent_pte, table, large);
+            result = true;
+        }
+
+        spin_release_with_irq(&vma->lock, vma_flag);
+    }
+
+    spin_release_with_irq(&pagemap->addrspace_lock, flag);
+    return result;
+}
+
+void promote_idle() {
+    if (!largepage_level_info_list[PROMOTE_LEVEL - 1].is_supported) {
+        return;
+    }
+
+    // Only one cpu promotes in the background at a time.
+    if (atomic_exchange(&g_idle_promoting, true)) {
+        return;
+    }
+
+    struct pagemap *pagemap = this_cpu()->pagemap;
+    if (pagemap == NULL) {
+        pagemap = &kernel_pagemap;
+    }
+
+    // Start over from the bottom when the cpu switched pagemaps.
+    if (pagemap->id != g_idle_pagemap_id) {
+        g_idle_pagemap_id = pagemap->id;
+        g_idle_addr = 0;
+    }
+
+    if (find_candidate(pagemap)) {
+        // Allocate without holding any lock, as allocating can compact, which
+        // takes the lock of every vm_area it migrates pages out of.
+
+        struct page *const large =
+            alloc_large_page(PROMOTE_LEVEL, /*flags=*/0);
+
+        if (large != NULL) {
+            if (!try_promote(pagemap, g_idle_addr, large)) {
+                free_large_page(large);
+            }
+
+            g_idle_addr += PROMOTE_SIZE;
+        }
+    }
+
+    atomic_store(&g_idle_promoting, false);
+}
+
+struct promote_stats promote_get_stats() {
+    return (struct promote_stats){
+        .promote_count = atomic_load(&g_promote_count),
+        .zero_filled_count = atomic_load(&g_zero_filled_count),
+        .tlb_reach_gained = atomic_load(&g_tlb_reach_gained)
+    };
+}
+
+void promote_print_stats() {
+    const struct promote_stats stats = promote_get_stats();
+    printk(LOGLEVEL_INFO,
+           "mm: promoted %" PRIu64 " block(s) to large pages, zero-filled "
+           "%" PRIu64 " page(s), tlb reach gained: %" PRIu64 " KiB\n",
+           stats.promote_count,
+           stats.zero_filled_count,
+           stats.tlb_reach_gained / 1024);
+}
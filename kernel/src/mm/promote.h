@@ -0,0 +1,28 @@
+/*
+ * kernel/src/mm/promote.h
+ * © suhas pai
+ */
+
+#pragma once
+#include <stdint.h>
+
+// Promotion replaces a leaf page-table of an anonymous vm_area with a single
+// large page, once enough of the table's pages have been faulted in. The pages
+// are copied into the large page, and the rest of the large page is zeroed, so
+// one tlb entry covers what used to take an entry per page.
+
+struct promote_stats {
+    uint64_t promote_count;
+    uint64_t zero_filled_count;
+
+    // Bytes of address-space that no longer need a tlb entry per page.
+    uint64_t tlb_reach_gained;
+};
+
+// Scan a few large-page sized blocks of the current pagemap, and promote at
+// most one of them. Meant to be called when the cpu goes idle.
+
+void promote_idle();
+
+struct promote_stats promote_get_stats();
+void promote_print_stats();
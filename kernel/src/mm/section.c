@@ -17,9 +17,9 @@ page_section_init(struct page_section *const section,
     section->lock = SPINLOCK_INIT();
     section->pfn = pfn;
     section->range = range;
-    section->min_order = MAX_ORDER;
-    section->max_order = 0;
+    section->order_mask = 0;
     section->total_free = 0;
+    section->compacting = false;
 
     for (uint8_t i = 0; i != MAX_ORDER; i++) {
         list_init(&section->freelist_list[i].page_list);
@@ -29,15 +29,19 @@ struct page_section {
     struct spinlock lock;
     struct page_freelist freelist_list[MAX_ORDER];
 
-    // max_order in section is one plus the highest order that has at least one
-    // page in its freelist.
-
-    uint8_t min_order;
-    uint8_t max_order;
+    // Bit N is set if freelist_list[N] is non-empty, so the first order at or
+    // above a given order with a free block is a single find-first-set.
 
+    uint32_t order_mask;
     uint64_t total_free;
+
+    // Set while compaction is migrating pages out of a block in the section.
+    bool compacting;
 };
 
+_Static_assert(MAX_ORDER <= sizeof_bits_field(struct page_section, order_mask),
+               "page_section's order_mask can't hold every order");
+
 void
 page_section_init(struct page_section *section,
                   struct page_zone *zone,
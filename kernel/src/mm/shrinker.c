@@ -0,0 +1,36 @@
+/*
+ * kernel/src/mm/shrinker.c
+ * © suhas pai
+ */
+
+#include "cpu/spinlock.h"
+#include "shrinker.h"
+
+static struct list g_shrinker_list = LIST_INIT(g_shrinker_list);
+static struct spinlock g_shrinker_lock = SPINLOCK_INIT();
+
+void shrinker_register(struct shrinker *const shrinker) {
+    const int flag = spin_acquire_with_irq(&g_shrinker_lock);
+
+    list_init(&shrinker->list);
+    list_radd(&g_shrinker_list, &shrinker->list);
+
+    spin_release_with_irq(&g_shrinker_lock, flag);
+}
+
+uint64_t shrinkers_run(const uint64_t page_count) {
+    const int flag = spin_acquire_with_irq(&g_shrinker_lock);
+
+    uint64_t released = 0;
+    struct shrinker *iter = NULL;
+
+    list_foreach(iter, &g_shrinker_list, list) {
+        released += iter->shrink(iter, page_count - released);
+        if (released >= page_count) {
+            break;
+        }
+    }
+
+    spin_release_with_irq(&g_shrinker_lock, flag);
+    return released;
+}
@@ -0,0 +1,24 @@
+/*
+ * kernel/src/mm/shrinker.h
+ * © suhas pai
+ */
+
+#pragma once
+#include "lib/list.h"
+
+// Shrinkers let caches built on top of the page allocator give back pages they
+// hold onto when memory is running low.
+
+struct shrinker {
+    struct list list;
+
+    // Release up to `page_count` pages, returning the amount released.
+    uint64_t (*shrink)(struct shrinker *shrinker, uint64_t page_count);
+};
+
+void shrinker_register(struct shrinker *shrinker);
+
+// Run every shrinker until `page_count` pages are released. Returns the amount
+// of pages released.
+
+uint64_t shrinkers_run(uint64_t page_count);
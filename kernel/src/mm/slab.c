@@ -3,6 +3,10 @@
  * © suhas pai
  */
 
+#include <stdatomic.h>
+#include "asm/irqs.h"
+
+#include "cpu/info.h"
 #include "cpu/panic.h"
 #include "cpu/spinlock.h"
 
@@ -11,6 +15,8 @@
 #include "lib/string.h"
 
 #include "mm/page_alloc.h"
+
+#include "shrinker.h"
 #include "slab.h"
 
 struct free_slab_object {
@@ -18,55 +24,228 @@ struct free_slab_object {
 };
 
 #define MIN_OBJ_PER_SLAB 4
+#define SLAB_REFILL_COUNT 4ull
+
+#define SLAB_MIN_ALIGN 8
+
+// Larger slab orders tried when the smallest order leaves more than
+// 1/SLAB_MAX_WASTE_FRACTION of the slab unused.
+
+#define SLAB_ORDER_SEARCH_COUNT 3
+#define SLAB_MAX_WASTE_FRACTION 8
+
+// A magazine takes up exactly 256 bytes.
+#define SLAB_MAGAZINE_SIZE 29
+
+// Amount of magazines a depot may hold before a full magazine is returned to
+// the slabs, or an empty magazine is freed.
+
+#define SLAB_DEPOT_FULL_MAX 8
+#define SLAB_DEPOT_EMPTY_MAX 4
+
+// Amount of empty slabs an allocator keeps by default, so that alternating
+// allocs and frees of a single object don't go to the page allocator each
+// time.
+
+#define SLAB_DEFAULT_MAX_EMPTY_SLAB_COUNT 2
+
+struct slab_magazine {
+    struct list depot_list;
+    uint32_t count;
+
+    void *objects[SLAB_MAGAZINE_SIZE];
+};
+
+static struct slab_allocator g_magazine_allocator;
+static _Atomic uint8_t g_cpu_cache_count = 0;
+
+static struct list g_allocator_list = LIST_INIT(g_allocator_list);
+static struct spinlock g_allocator_list_lock = SPINLOCK_INIT();
+
+static uint64_t shrink_slabs(struct shrinker *shrinker, uint64_t page_count);
+static struct shrinker g_slab_shrinker = {
+    .list = LIST_INIT(g_slab_shrinker.list),
+    .shrink = shrink_slabs
+};
+
+void slab_init() {
+    assert(slab_allocator_init(&g_magazine_allocator,
+                               sizeof(struct slab_magazine),
+                               /*alloc_flags=*/0,
+                               __SLAB_ALLOC_NO_MAGAZINE));
+
+    shrinker_register(&g_slab_shrinker);
+}
+
+__optimize(3) static uint8_t get_cpu_cache_index(const uint16_t flags) {
+    if (flags & (__SLAB_ALLOC_NO_LOCK | __SLAB_ALLOC_NO_MAGAZINE)) {
+        return CPU_SLAB_CACHE_MAX;
+    }
+
+    uint8_t index = atomic_load(&g_cpu_cache_count);
+    do {
+        if (index == CPU_SLAB_CACHE_MAX) {
+            return CPU_SLAB_CACHE_MAX;
+        }
+    } while (!atomic_compare_exchange_weak(&g_cpu_cache_count,
+                                           &index,
+                                           index + 1));
+
+    return index;
+}
+
+// Pick the smallest slab order that holds MIN_OBJ_PER_SLAB objects, unless a
+// slightly larger order wastes much less of the slab.
+
+__optimize(3) static uint8_t
+slab_order_for_size(const uint32_t object_size, const uint64_t min_size) {
+    uint8_t order = 0;
+    for (; (PAGE_SIZE << order) < min_size; order++) {}
+
+    for (uint8_t i = 0; i != SLAB_ORDER_SEARCH_COUNT; i++) {
+        const uint64_t slab_size = PAGE_SIZE << (order + i);
+        if (slab_size % object_size <= slab_size / SLAB_MAX_WASTE_FRACTION) {
+            return order + i;
+        }
+    }
+
+    return order;
+}
 
 bool
-slab_allocator_init(struct slab_allocator *const slab_alloc,
-                    const uint32_t object_size_arg,
-                    const uint32_t alloc_flags,
-                    const uint16_t flags)
+slab_allocator_init_with_ctor(struct slab_allocator *const slab_alloc,
+                              const uint32_t object_size_arg,
+                              const uint32_t align_arg,
+                              void (*const ctor)(void *object),
+                              const uint32_t alloc_flags,
+                              const uint16_t flags)
 {
+    const uint32_t align = max(align_arg, (uint32_t)SLAB_MIN_ALIGN);
+    if (__builtin_expect(object_size_arg == 0, 0) ||
+        __builtin_expect((align & (align - 1)) != 0, 0))
+    {
+        return false;
+    }
+
+    // Objects with a constructor store their free-list link after the object,
+    // while other objects store it at the front of the object.
+
     uint64_t object_size = object_size_arg;
+    uint64_t free_link_offset = 0;
+
+    if (ctor != NULL) {
+        if (!align_up(object_size,
+                      /*boundary=*/_Alignof(struct free_slab_object),
+                      &free_link_offset))
+        {
+            return false;
+        }
 
-    // To store free_page_objects, every object must be at least 16 bytes.
-    // We also make this the required minimum alignment.
+        object_size = free_link_offset + sizeof(struct free_slab_object);
+    } else {
+        object_size = max(object_size, sizeof(struct free_slab_object));
+    }
 
-    if (!align_up(object_size, /*boundary=*/16, &object_size) ||
+    if (!align_up(object_size, align, &object_size) ||
         object_size > UINT32_MAX)
     {
         return false;
     }
 
-    uint32_t min_size_for_slab = object_size;
+    uint64_t min_size_for_slab = 0;
     if (!check_mul(object_size, MIN_OBJ_PER_SLAB, &min_size_for_slab)) {
         return false;
     }
 
     list_init(&slab_alloc->free_slab_head_list);
+    list_init(&slab_alloc->empty_slab_list);
+    list_init(&slab_alloc->allocator_list);
+    list_init(&slab_alloc->full_magazine_list);
+    list_init(&slab_alloc->empty_magazine_list);
 
     slab_alloc->lock = SPINLOCK_INIT();
+    slab_alloc->depot_lock = SPINLOCK_INIT();
     slab_alloc->object_size = object_size;
     slab_alloc->free_obj_count = 0;
     slab_alloc->alloc_flags = alloc_flags;
     slab_alloc->flags = flags;
 
-    uint8_t order = 0;
-    for (; (PAGE_SIZE << order) < min_size_for_slab; order++) {}
+    slab_alloc->empty_slab_count = 0;
+    slab_alloc->max_empty_slab_count = SLAB_DEFAULT_MAX_EMPTY_SLAB_COUNT;
+    slab_alloc->slab_count = 0;
+
+    slab_alloc->full_magazine_count = 0;
+    slab_alloc->empty_magazine_count = 0;
+    slab_alloc->cpu_cache_index = get_cpu_cache_index(flags);
+
+    const uint8_t order =
+        slab_order_for_size((uint32_t)object_size, min_size_for_slab);
+    const uint64_t slab_size = PAGE_SIZE << order;
 
     slab_alloc->slab_order = order;
-    slab_alloc->object_count_per_slab = (PAGE_SIZE << order) / object_size;
+    slab_alloc->object_count_per_slab = slab_size / object_size;
+
+    slab_alloc->ctor = ctor;
+    slab_alloc->free_link_offset = (uint32_t)free_link_offset;
+
+    const uint64_t unused_size = slab_size % object_size;
+
+    slab_alloc->color_align = (uint16_t)min(align, (uint32_t)UINT16_MAX);
+    slab_alloc->color_count =
+        (uint16_t)min(unused_size / slab_alloc->color_align + 1,
+                      (uint64_t)UINT16_MAX / slab_alloc->color_align);
+    slab_alloc->next_color = 0;
+
+    // Allocators without a lock can't have their slabs released from another
+    // context.
+
+    if ((flags & __SLAB_ALLOC_NO_LOCK) == 0) {
+        const int flag = spin_acquire_with_irq(&g_allocator_list_lock);
+
+        list_radd(&g_allocator_list, &slab_alloc->allocator_list);
+        spin_release_with_irq(&g_allocator_list_lock, flag);
+    }
 
     return true;
 }
 
-static struct page *alloc_slab_page(struct slab_allocator *const alloc) {
-    struct page *const head =
-        alloc_pages(PAGE_STATE_SLAB_HEAD, __ALLOC_ZERO, alloc->slab_order);
+bool
+slab_allocator_init(struct slab_allocator *const slab_alloc,
+                    const uint32_t object_size,
+                    const uint32_t alloc_flags,
+                    const uint16_t flags)
+{
+    // To store free_page_objects, every object must be at least 16 bytes.
+    // We also make this the required minimum alignment.
 
-    if (__builtin_expect(head == NULL, 0)) {
-        return NULL;
+    uint64_t aligned_size = 0;
+    if (!align_up(object_size, /*boundary=*/16, &aligned_size) ||
+        aligned_size > UINT32_MAX)
+    {
+        return false;
     }
 
-    const struct page *const end = head + ((1 << alloc->slab_order) - 1);
+    return slab_allocator_init_with_ctor(slab_alloc,
+                                         (uint32_t)aligned_size,
+                                         /*align=*/16,
+                                         /*ctor=*/NULL,
+                                         alloc_flags,
+                                         flags);
+}
+
+__optimize(3) static inline void *
+slab_objects_begin(struct page *const head) {
+    return page_to_virt(head) + head->extra.slab_head.color_offset;
+}
+
+__optimize(3) static inline struct free_slab_object *
+free_link_of(const struct slab_allocator *const alloc, void *const object) {
+    return (struct free_slab_object *)(object + alloc->free_link_offset);
+}
+
+static void
+setup_slab_page(struct slab_allocator *const alloc, struct page *const head) {
+    const struct page *const end = head + (1ull << alloc->slab_order);
     for (struct page *page = head + 1; page < end; page++) {
         page->slab.allocator = alloc;
     }
@@ -80,31 +259,51 @@ static struct page *alloc_slab_page(struct slab_allocator *const alloc) {
     alloc->slab_count++;
     alloc->free_obj_count += alloc->object_count_per_slab;
 
-    void *const head_virt = page_to_virt(head);
+    head->extra.slab_head.color_offset =
+        (uint16_t)(alloc->next_color * alloc->color_align);
+
+    alloc->next_color++;
+    if (alloc->next_color == alloc->color_count) {
+        alloc->next_color = 0;
+    }
+
+    void *const head_virt = slab_objects_begin(head);
     uint64_t object_byte_index = 0;
 
     for (uint32_t i = 0;
-         i != alloc->object_count_per_slab - 1;
+         i != alloc->object_count_per_slab;
          i++, object_byte_index += alloc->object_size)
     {
-        struct free_slab_object *const free_obj =
-            (struct free_slab_object *)(head_virt + object_byte_index);
+        void *const object = head_virt + object_byte_index;
+        const bool is_last = i == alloc->object_count_per_slab - 1;
 
-        free_obj->next = i + 1;
+        free_link_of(alloc, object)->next = is_last ? UINT32_MAX : i + 1;
+        if (alloc->ctor != NULL) {
+            alloc->ctor(object);
+        }
     }
+}
 
-    struct free_slab_object *const last_object = head_virt + object_byte_index;
-    last_object->next = UINT32_MAX;
+// Allocate a batch of slabs, so a run of allocations doesn't go to the page
+// allocator once per slab. Larger slabs are allocated in smaller batches.
 
-    return head;
+static uint64_t
+alloc_slab_pages(const struct slab_allocator *const alloc,
+                 struct page **const head_list)
+{
+    return alloc_pages_bulk(PAGE_STATE_SLAB_HEAD,
+                            __ALLOC_ZERO,
+                            alloc->slab_order,
+                            head_list,
+                            max(SLAB_REFILL_COUNT >> alloc->slab_order, 1ull));
 }
 
 static inline uint64_t
 get_free_index(struct page *const head,
                struct slab_allocator *const alloc,
-               struct free_slab_object *const free_object)
+               void *const object)
 {
-    return distance(page_to_virt(head), free_object) / alloc->object_size;
+    return distance(slab_objects_begin(head), object) / alloc->object_size;
 }
 
 static inline void *
@@ -116,10 +315,10 @@ get_free_ptr(struct page *const page, struct slab_allocator *const alloc) {
     const uint64_t byte_index =
         check_mul_assert(page->slab.head.first_free_index, alloc->object_size);
 
-    return page_to_virt(page) + byte_index;
+    return slab_objects_begin(page) + byte_index;
 }
 
-void *slab_alloc(struct slab_allocator *const alloc) {
+static void *alloc_from_slabs(struct slab_allocator *const alloc) {
     int flag = 0;
 
     const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
@@ -127,23 +326,58 @@ void *slab_alloc(struct slab_allocator *const alloc) {
         flag = spin_acquire_with_irq(&alloc->lock);
     }
 
-    struct page *head = NULL;
     if (list_empty(&alloc->free_slab_head_list)) {
-        head = alloc_slab_page(alloc);
-        if (head == NULL) {
+        if (!list_empty(&alloc->empty_slab_list)) {
+            // Empty slabs still have their freelist setup, and their objects
+            // were zeroed when freed.
+
+            struct page *const empty =
+                list_head(&alloc->empty_slab_list,
+                          struct page,
+                          slab.head.slab_list);
+
+            list_remove(&empty->slab.head.slab_list);
+            list_add(&alloc->free_slab_head_list, &empty->slab.head.slab_list);
+
+            alloc->empty_slab_count--;
+        } else {
+            // The page allocator may reclaim, which runs the slab shrinker,
+            // and the shrinker frees into slab allocators, including this one,
+            // so don't hold the lock while allocating.
+
             if (needs_lock) {
                 spin_release_with_irq(&alloc->lock, flag);
             }
 
-            return NULL;
+            struct page *head_list[SLAB_REFILL_COUNT];
+            const uint64_t count = alloc_slab_pages(alloc, head_list);
+
+            if (needs_lock) {
+                flag = spin_acquire_with_irq(&alloc->lock);
+            }
+
+            for (uint64_t i = 0; i != count; i++) {
+                setup_slab_page(alloc, head_list[i]);
+            }
+
+            // Even if allocating failed, another cpu may have refilled the
+            // allocator in the meantime.
+
+            if (__builtin_expect(list_empty(&alloc->free_slab_head_list), 0)) {
+                if (needs_lock) {
+                    spin_release_with_irq(&alloc->lock, flag);
+                }
+
+                return NULL;
+            }
         }
-    } else {
-        head =
-            list_head(&alloc->free_slab_head_list,
-                      struct page,
-                      slab.head.slab_list);
     }
 
+    struct page *const head =
+        list_head(&alloc->free_slab_head_list,
+                  struct page,
+                  slab.head.slab_list);
+
     alloc->free_obj_count--;
     head->slab.head.free_obj_count--;
 
@@ -151,15 +385,16 @@ void *slab_alloc(struct slab_allocator *const alloc) {
         list_delete(&head->slab.head.slab_list);
     }
 
-    struct free_slab_object *const result = get_free_ptr(head, alloc);
-    head->slab.head.first_free_index = result ? result->next : UINT32_MAX;
+    void *const result = get_free_ptr(head, alloc);
+    struct free_slab_object *const link = free_link_of(alloc, result);
 
+    head->slab.head.first_free_index = link->next;
     if (needs_lock) {
         spin_release_with_irq(&alloc->lock, flag);
     }
 
     // Zero-out free-block
-    result->next = 0;
+    link->next = 0;
     return result;
 }
 
@@ -174,12 +409,11 @@ __optimize(3) static inline struct page *slab_head_of(const void *const mem) {
     return page->slab.tail.head;
 }
 
-void slab_free(void *const mem) {
-    struct page *const head = slab_head_of(mem);
-    struct slab_allocator *const alloc = head->slab.allocator;
-
-    bzero(mem, alloc->object_size);
-
+static void
+free_to_slabs(struct slab_allocator *const alloc,
+              struct page *const head,
+              void *const mem)
+{
     int flag = 0;
     const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
 
@@ -192,17 +426,26 @@ void slab_free(void *const mem) {
 
     if (head->slab.head.free_obj_count != 1) {
         if (head->slab.head.free_obj_count == alloc->object_count_per_slab) {
-            alloc->free_obj_count -= alloc->object_count_per_slab;
-            alloc->slab_count -= 1;
+            if (alloc->empty_slab_count == alloc->max_empty_slab_count &&
+                (alloc->flags & __SLAB_ALLOC_TYPESAFE) == 0)
+            {
+                alloc->free_obj_count -= alloc->object_count_per_slab;
+                alloc->slab_count -= 1;
 
-            list_delete(&head->slab.head.slab_list);
-            free_pages(head, alloc->slab_order);
+                list_delete(&head->slab.head.slab_list);
+                free_pages(head, alloc->slab_order);
 
-            if (needs_lock) {
-                spin_release_with_irq(&alloc->lock, flag);
+                if (needs_lock) {
+                    spin_release_with_irq(&alloc->lock, flag);
+                }
+
+                return;
             }
 
-            return;
+            list_remove(&head->slab.head.slab_list);
+            list_add(&alloc->empty_slab_list, &head->slab.head.slab_list);
+
+            alloc->empty_slab_count++;
         }
     } else {
         // This was previously a fully used slab, so we have to add this back
@@ -211,16 +454,330 @@ void slab_free(void *const mem) {
         list_add(&alloc->free_slab_head_list, &head->slab.head.slab_list);
     }
 
-    struct free_slab_object *const free_obj = (struct free_slab_object *)mem;
+    free_link_of(alloc, mem)->next = head->slab.head.first_free_index;
+    head->slab.head.first_free_index = get_free_index(head, alloc, mem);
+
+    if (needs_lock) {
+        spin_release_with_irq(&alloc->lock, flag);
+    }
+}
+
+// Return every object in a magazine to its slab.
+
+static void
+flush_magazine(struct slab_allocator *const alloc,
+               struct slab_magazine *const magazine)
+{
+    for (uint32_t i = 0; i != magazine->count; i++) {
+        void *const mem = magazine->objects[i];
+        free_to_slabs(alloc, slab_head_of(mem), mem);
+    }
+
+    magazine->count = 0;
+}
+
+// Put an empty magazine in the depot, or free it if the depot already has
+// enough. Caller is required to hold the depot's lock, which is released.
+
+static void
+put_empty_magazine_and_unlock(struct slab_allocator *const alloc,
+                              struct slab_magazine *const magazine)
+{
+    if (alloc->empty_magazine_count != SLAB_DEPOT_EMPTY_MAX) {
+        list_add(&alloc->empty_magazine_list, &magazine->depot_list);
+        alloc->empty_magazine_count++;
+
+        spin_release(&alloc->depot_lock);
+        return;
+    }
+
+    spin_release(&alloc->depot_lock);
+    slab_free(magazine);
+}
+
+// Replace the cpu's empty magazines with a full one from the depot. Caller is
+// required to have disabled irqs.
+
+static bool
+exchange_for_full_magazine(struct slab_allocator *const alloc,
+                           struct cpu_slab_magazines *const magazines)
+{
+    spin_acquire(&alloc->depot_lock);
+    if (list_empty(&alloc->full_magazine_list)) {
+        spin_release(&alloc->depot_lock);
+        return false;
+    }
+
+    struct slab_magazine *const full =
+        list_head(&alloc->full_magazine_list,
+                  struct slab_magazine,
+                  depot_list);
+
+    list_delete(&full->depot_list);
+    alloc->full_magazine_count--;
+
+    struct slab_magazine *const empty = magazines->previous;
+
+    magazines->previous = magazines->loaded;
+    magazines->loaded = full;
 
-    free_obj->next = head->slab.head.first_free_index;
-    head->slab.head.first_free_index = get_free_index(head, alloc, free_obj);
+    if (empty != NULL) {
+        put_empty_magazine_and_unlock(alloc, empty);
+    } else {
+        spin_release(&alloc->depot_lock);
+    }
+
+    return true;
+}
+
+// Replace the cpu's full magazines with an empty one, from the depot or newly
+// allocated. Caller is required to have disabled irqs.
+
+static bool
+exchange_for_empty_magazine(struct slab_allocator *const alloc,
+                            struct cpu_slab_magazines *const magazines)
+{
+    struct slab_magazine *empty = NULL;
+    spin_acquire(&alloc->depot_lock);
+
+    if (!list_empty(&alloc->empty_magazine_list)) {
+        empty =
+            list_head(&alloc->empty_magazine_list,
+                      struct slab_magazine,
+                      depot_list);
+
+        list_delete(&empty->depot_list);
+        alloc->empty_magazine_count--;
+    } else {
+        spin_release(&alloc->depot_lock);
+
+        empty = slab_alloc(&g_magazine_allocator);
+        if (__builtin_expect(empty == NULL, 0)) {
+            return false;
+        }
+
+        list_init(&empty->depot_list);
+        spin_acquire(&alloc->depot_lock);
+    }
+
+    struct slab_magazine *const full = magazines->previous;
+    struct slab_magazine *flush = NULL;
+
+    magazines->previous = magazines->loaded;
+    magazines->loaded = empty;
+
+    if (full != NULL) {
+        if (alloc->full_magazine_count == SLAB_DEPOT_FULL_MAX) {
+            flush = full;
+        } else {
+            list_add(&alloc->full_magazine_list, &full->depot_list);
+            alloc->full_magazine_count++;
+        }
+    }
+
+    spin_release(&alloc->depot_lock);
+    if (flush != NULL) {
+        flush_magazine(alloc, flush);
+
+        spin_acquire(&alloc->depot_lock);
+        put_empty_magazine_and_unlock(alloc, flush);
+    }
+
+    return true;
+}
+
+__optimize(3)
+static void *alloc_from_magazine(struct slab_allocator *const alloc) {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_slab_magazines *const magazines =
+        &this_cpu_mut()->slab_cache.list[alloc->cpu_cache_index];
+
+    struct slab_magazine *loaded = magazines->loaded;
+    if (loaded == NULL || loaded->count == 0) {
+        struct slab_magazine *const previous = magazines->previous;
+        if (previous != NULL && previous->count != 0) {
+            magazines->previous = loaded;
+            magazines->loaded = previous;
+        } else if (!exchange_for_full_magazine(alloc, magazines)) {
+            enable_all_irqs_if_flag(flag);
+            return NULL;
+        }
+
+        loaded = magazines->loaded;
+    }
+
+    loaded->count--;
+    void *const result = loaded->objects[loaded->count];
+
+    enable_all_irqs_if_flag(flag);
+    return result;
+}
+
+__optimize(3) static bool
+free_to_magazine(struct slab_allocator *const alloc, void *const mem) {
+    const bool flag = disable_all_irqs_if_not();
+    struct cpu_slab_magazines *const magazines =
+        &this_cpu_mut()->slab_cache.list[alloc->cpu_cache_index];
+
+    struct slab_magazine *loaded = magazines->loaded;
+    if (loaded == NULL || loaded->count == SLAB_MAGAZINE_SIZE) {
+        struct slab_magazine *const previous = magazines->previous;
+        if (previous != NULL && previous->count != SLAB_MAGAZINE_SIZE) {
+            magazines->previous = loaded;
+            magazines->loaded = previous;
+        } else if (!exchange_for_empty_magazine(alloc, magazines)) {
+            enable_all_irqs_if_flag(flag);
+            return false;
+        }
+
+        loaded = magazines->loaded;
+    }
+
+    loaded->objects[loaded->count] = mem;
+    loaded->count++;
+
+    enable_all_irqs_if_flag(flag);
+    return true;
+}
+
+void *slab_alloc(struct slab_allocator *const alloc) {
+    if (alloc->cpu_cache_index != CPU_SLAB_CACHE_MAX) {
+        void *const result = alloc_from_magazine(alloc);
+        if (result != NULL) {
+            return result;
+        }
+    }
+
+    return alloc_from_slabs(alloc);
+}
+
+void slab_free(void *const mem) {
+    struct page *const head = slab_head_of(mem);
+    struct slab_allocator *const alloc = head->slab.allocator;
+
+    if (alloc->ctor == NULL) {
+        bzero(mem, alloc->object_size);
+    }
+
+    if (alloc->cpu_cache_index != CPU_SLAB_CACHE_MAX &&
+        free_to_magazine(alloc, mem))
+    {
+        return;
+    }
+
+    free_to_slabs(alloc, head, mem);
+}
+
+// Release empty slabs until at most `keep_count` remain, returning the amount
+// of pages released. Caller is required to hold the allocator's lock.
+
+static uint64_t
+release_empty_slabs(struct slab_allocator *const alloc,
+                    const uint32_t keep_count)
+{
+    if (alloc->flags & __SLAB_ALLOC_TYPESAFE) {
+        return 0;
+    }
+
+    uint64_t page_count = 0;
+    while (alloc->empty_slab_count > keep_count) {
+        struct page *const head =
+            list_head(&alloc->empty_slab_list,
+                      struct page,
+                      slab.head.slab_list);
+
+        list_delete(&head->slab.head.slab_list);
+        free_pages(head, alloc->slab_order);
+
+        alloc->free_obj_count -= alloc->object_count_per_slab;
+        alloc->slab_count--;
+        alloc->empty_slab_count--;
+
+        page_count += 1ull << alloc->slab_order;
+    }
+
+    return page_count;
+}
+
+void
+slab_allocator_set_max_empty_slabs(struct slab_allocator *const alloc,
+                                   const uint32_t count)
+{
+    int flag = 0;
+    const bool needs_lock = (alloc->flags & __SLAB_ALLOC_NO_LOCK) == 0;
+
+    if (needs_lock) {
+        flag = spin_acquire_with_irq(&alloc->lock);
+    }
+
+    alloc->max_empty_slab_count = count;
+    release_empty_slabs(alloc, count);
 
     if (needs_lock) {
         spin_release_with_irq(&alloc->lock, flag);
     }
 }
 
+// Return the objects held in the depot's full magazines to their slabs, so the
+// slabs they empty out can be released too.
+
+static void flush_depot(struct slab_allocator *const alloc) {
+    spin_acquire(&alloc->depot_lock);
+    while (!list_empty(&alloc->full_magazine_list)) {
+        struct slab_magazine *const magazine =
+            list_head(&alloc->full_magazine_list,
+                      struct slab_magazine,
+                      depot_list);
+
+        list_delete(&magazine->depot_list);
+        alloc->full_magazine_count--;
+
+        spin_release(&alloc->depot_lock);
+        flush_magazine(alloc, magazine);
+
+        spin_acquire(&alloc->depot_lock);
+        put_empty_magazine_and_unlock(alloc, magazine);
+        spin_acquire(&alloc->depot_lock);
+    }
+
+    spin_release(&alloc->depot_lock);
+}
+
+static uint64_t
+shrink_slabs(struct shrinker *const shrinker, const uint64_t page_count) {
+    (void)shrinker;
+
+    uint64_t released = 0;
+    struct slab_allocator *iter = NULL;
+
+    const int flag = spin_acquire_with_irq(&g_allocator_list_lock);
+    list_foreach(iter, &g_allocator_list, allocator_list) {
+        // We may have been called by the page allocator while this allocator
+        // was refilling its slabs, so skip allocators that are busy.
+
+        if (!spin_try_acquire(&iter->lock)) {
+            continue;
+        }
+
+        if (iter->cpu_cache_index != CPU_SLAB_CACHE_MAX) {
+            spin_release(&iter->lock);
+            flush_depot(iter);
+
+            spin_acquire(&iter->lock);
+        }
+
+        released += release_empty_slabs(iter, /*keep_count=*/0);
+        spin_release(&iter->lock);
+
+        if (released >= page_count) {
+            break;
+        }
+    }
+
+    spin_release_with_irq(&g_allocator_list_lock, flag);
+    return released;
+}
+
 __optimize(3) uint32_t slab_object_size(void *const mem) {
     if (__builtin_expect(mem == NULL, 0)) {
         panic("slab_object_size(): Got mem=NULL");
@@ -8,12 +8,26 @@
 #include "cpu/spinlock.h"
 #include "lib/list.h"
 
+#include "cpu_slab_cache.h"
+
 // Structure to represent a slab allocator.
 struct slab_allocator {
     // List of struct page used as slabs.
     struct list free_slab_head_list;
     struct spinlock lock;
 
+    // Slabs whose objects are all free, kept instead of being returned to the
+    // page allocator, up to max_empty_slab_count of them. Protected by lock.
+
+    struct list empty_slab_list;
+    uint32_t empty_slab_count;
+    uint32_t max_empty_slab_count;
+
+    // Entry in the list of allocators the slab shrinker releases empty slabs
+    // from.
+
+    struct list allocator_list;
+
     // Statistics about this allocator. These are constant and can be read w/o
     // holding the lock.
     uint32_t object_size;
@@ -22,20 +36,85 @@ struct slab_allocator {
     uint8_t slab_order;
     uint16_t flags;
 
+    // Called on every object of a slab when the slab is created. Objects of an
+    // allocator with a constructor aren't zeroed when freed, and so are
+    // expected to be freed in their constructed state.
+
+    void (*ctor)(void *object);
+
+    // Offset of the free-list link within each object. Allocators with a
+    // constructor keep the link past the end of the object so a free object
+    // stays constructed.
+
+    uint32_t free_link_offset;
+
+    // Each new slab starts its objects at the next color, a multiple of
+    // color_align that fits in the space the slab's objects leave unused, so
+    // that the first objects of different slabs don't share cache sets.
+    // next_color is protected by lock.
+
+    uint16_t color_align;
+    uint16_t color_count;
+    uint16_t next_color;
+
     uint32_t free_obj_count;
     uint32_t slab_count;
+
+    // Index of this allocator's magazines in every cpu's slab cache, or
+    // CPU_SLAB_CACHE_MAX if this allocator doesn't use magazines.
+    uint8_t cpu_cache_index;
+
+    // Depot of magazines exchanged with the cpus' slab caches. Full magazines
+    // are returned to the slabs once there are too many of them.
+
+    struct spinlock depot_lock;
+    struct list full_magazine_list;
+    struct list empty_magazine_list;
+
+    uint32_t full_magazine_count;
+    uint32_t empty_magazine_count;
 };
 
 enum slab_allocator_flags {
-    __SLAB_ALLOC_NO_LOCK = 1ull << 0
+    __SLAB_ALLOC_NO_LOCK = 1ull << 0,
+    __SLAB_ALLOC_NO_MAGAZINE = 1ull << 1,
+
+    // Never return empty slabs to the page allocator, so memory that held an
+    // object keeps holding an object of the same type after it's freed. Lets
+    // lockless readers safely touch an object that was freed under them, such
+    // as to take its lock and then check that it's still live.
+
+    __SLAB_ALLOC_TYPESAFE = 1ull << 2,
 };
 
+// Must be called before any slab allocator is initialized.
+void slab_init();
+
 bool
 slab_allocator_init(struct slab_allocator *allocator,
                     uint32_t object_size,
                     uint32_t alloc_flags,
                     uint16_t flags);
 
+// Objects are aligned to `align`, which must be a power of two. Unlike
+// slab_allocator_init(), objects are only rounded up to the alignment, not to a
+// minimum of 16 bytes.
+
+bool
+slab_allocator_init_with_ctor(struct slab_allocator *allocator,
+                              uint32_t object_size,
+                              uint32_t align,
+                              void (*ctor)(void *object),
+                              uint32_t alloc_flags,
+                              uint16_t flags);
+
+// Set the amount of empty slabs the allocator keeps, releasing any above the
+// new limit.
+
+void
+slab_allocator_set_max_empty_slabs(struct slab_allocator *allocator,
+                                   uint32_t count);
+
 void slab_free(void *buffer);
 
 __malloclike __malloc_dealloc(slab_free, 1)
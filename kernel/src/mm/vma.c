@@ -4,10 +4,26 @@
  */
 
 #include "lib/align.h"
-#include "mm/kmalloc.h"
+#include "mm/kmem_cache.h"
 
 #include "pagemap.h"
 
+static struct kmem_cache g_vma_cache;
+
+static void vma_ctor(void *const object) {
+    struct vm_area *const vma = (struct vm_area *)object;
+    vma->lock = SPINLOCK_INIT();
+}
+
+void vma_cache_init() {
+    assert(kmem_cache_init(&g_vma_cache,
+                           "vm_area",
+                           sizeof(struct vm_area),
+                           _Alignof(struct vm_area),
+                           vma_ctor,
+                           __SLAB_ALLOC_TYPESAFE));
+}
+
 __optimize(3) struct vm_area *vma_prev(struct vm_area *const vma) {
     struct addrspace_node *const node = addrspace_node_prev(&vma->node);
     if (node == NULL) {
@@ -32,7 +48,7 @@ vma_alloc(struct pagemap *const pagemap,
           const prot_t prot,
           const enum vma_cachekind cachekind)
 {
-    struct vm_area *const vma = kmalloc(sizeof(struct vm_area));
+    struct vm_area *const vma = kmem_cache_alloc(&g_vma_cache);
     if (vma == NULL) {
         return NULL;
     }
@@ -41,6 +57,7 @@ vma_alloc(struct pagemap *const pagemap,
     vma->node.range = range;
     vma->cachekind = cachekind;
     vma->prot = prot;
+    vma->flags = 0;
 
     return vma;
 }
@@ -64,7 +81,36 @@ vma_create(struct pagemap *const pagemap,
     }
 
     if (!pagemap_find_space_and_add_vma(pagemap, vma, in_range, phys, align)) {
-        kfree(vma);
+        vma_free(vma);
+        return NULL;
+    }
+
+    return vma;
+}
+
+struct vm_area *
+vma_create_anonymous(struct pagemap *const pagemap,
+                     const struct range in_range,
+                     const uint64_t size,
+                     const uint64_t align,
+                     const prot_t prot)
+{
+    const struct range range = range_create_upto(size);
+    struct vm_area *const vma =
+        vma_alloc(pagemap, range, prot, VMA_CACHEKIND_DEFAULT);
+
+    if (vma == NULL) {
+        return NULL;
+    }
+
+    vma->flags |= __VMA_ANONYMOUS;
+    if (!pagemap_find_space_and_add_vma(pagemap,
+                                        vma,
+                                        in_range,
+                                        /*phys_addr=*/0,
+                                        align))
+    {
+        vma_free(vma);
         return NULL;
     }
 
@@ -84,13 +130,17 @@ vma_create_at(struct pagemap *const pagemap,
     }
 
     if (!pagemap_add_vma(pagemap, vma, phys_addr)) {
-        kfree(vma);
+        vma_free(vma);
         return NULL;
     }
 
     return vma;
 }
 
+void vma_free(struct vm_area *const vma) {
+    kmem_cache_free(&g_vma_cache, vma);
+}
+
 __optimize(3) struct pagemap *vma_pagemap(struct vm_area *const vma) {
     return container_of(vma->node.addrspace, struct pagemap, addrspace);
 }
\ No newline at end of file
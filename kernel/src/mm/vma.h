@@ -9,6 +9,13 @@
 #include "cpu/spinlock.h"
 #include "mm_types.h"
 
+enum vma_flags {
+    // The vm_area only reserves its range. Pages are allocated and mapped on
+    // first access by the page-fault handler, see mm/fault.h.
+
+    __VMA_ANONYMOUS = 1 << 0,
+};
+
 struct pagemap;
 struct vm_area {
     struct addrspace_node node;
@@ -16,12 +23,16 @@ struct vm_area {
     // This lock guards the physical page tables held by this vm_area.
     struct spinlock lock;
     prot_t prot;
+    uint8_t flags;
 
     enum vma_cachekind cachekind;
 };
 
 #define vma_of(obj) container_of((obj), struct vm_area, node.avlnode)
 
+// Must be called after kmalloc_init(), before any vm_area is allocated.
+void vma_cache_init();
+
 struct vm_area *vma_prev(struct vm_area *const vma);
 struct vm_area *vma_next(struct vm_area *const vma);
 
@@ -31,6 +42,9 @@ vma_alloc(struct pagemap *pagemap,
           prot_t prot,
           enum vma_cachekind cachekind);
 
+// Free a `vm_area` that isn't in any tree.
+void vma_free(struct vm_area *vma);
+
 // Whereas alloc will only allocate a `vm_area`, create will allocate and add to
 // the tree.
 
@@ -43,6 +57,16 @@ vma_create(struct pagemap *pagemap,
            prot_t prot,
            enum vma_cachekind cachekind);
 
+// Reserve `size` bytes of address-space for an anonymous vm_area without
+// mapping anything.
+
+struct vm_area *
+vma_create_anonymous(struct pagemap *pagemap,
+                     struct range in_range,
+                     uint64_t size,
+                     uint64_t align,
+                     prot_t prot);
+
 struct vm_area *
 vma_create_at(struct pagemap *pagemap,
               struct range range,
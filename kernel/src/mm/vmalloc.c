@@ -0,0 +1,321 @@
+/*
+ * kernel/src/mm/vmalloc.c
+ * © suhas pai
+ */
+
+#include "dev/printk.h"
+
+#include "lib/adt/addrspace.h"
+#include "lib/align.h"
+#include "lib/string.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page_alloc.h"
+#include "mm/pgmap.h"
+
+#include "vmalloc.h"
+
+struct vmalloc_area {
+    struct addrspace_node node;
+
+    // Size of the mapping, which is followed by an unmapped guard page that's
+    // part of the node's range.
+
+    uint64_t size;
+};
+
+static struct address_space g_vmalloc_space = ADDRSPACE_INIT(g_vmalloc_space);
+static struct spinlock g_vmalloc_lock = SPINLOCK_INIT();
+
+#define VMALLOC_GUARD_SIZE PAGE_SIZE
+
+__optimize(3) bool is_vmalloc_addr(const void *const buffer) {
+    const uint64_t addr = (uint64_t)buffer;
+    return addr >= VMALLOC_BASE && addr < VMALLOC_END;
+}
+
+// Caller is required to hold g_vmalloc_lock.
+
+__optimize(3) static struct vmalloc_area *find_area(const uint64_t addr) {
+    struct addrspace_node *const node =
+        addrspace_find_node(&g_vmalloc_space, addr);
+
+    if (node == NULL) {
+        return NULL;
+    }
+
+    return container_of(node, struct vmalloc_area, node);
+}
+
+static struct vmalloc_area *
+find_area_of_buffer(const void *const buffer, const char *const caller) {
+    const int flag = spin_acquire_with_irq(&g_vmalloc_lock);
+    struct vmalloc_area *const area = find_area((uint64_t)buffer);
+
+    spin_release_with_irq(&g_vmalloc_lock, flag);
+    if (__builtin_expect(
+            area == NULL || area->node.range.front != (uint64_t)buffer, 0))
+    {
+        printk(LOGLEVEL_WARN,
+               "mm: %s() got buffer %p that wasn't returned by vmalloc()\n",
+               caller,
+               buffer);
+        return NULL;
+    }
+
+    return area;
+}
+
+static void remove_area(struct vmalloc_area *const area) {
+    const int flag = spin_acquire_with_irq(&g_vmalloc_lock);
+
+    addrspace_remove_node(&area->node);
+    spin_release_with_irq(&g_vmalloc_lock, flag);
+
+    kfree(area);
+}
+
+// Counts the pages handed to pgmap, every one of which is mapped before pgmap
+// can fail, so a failed mapping can be undone.
+
+struct vmalloc_fill_info {
+    uint64_t page_count;
+};
+
+__optimize(3) static uint64_t alloc_page_cb(void *const cb_info) {
+    struct page *const page = alloc_page(PAGE_STATE_USED, __ALLOC_ZERO);
+    if (__builtin_expect(page == NULL, 0)) {
+        return INVALID_PHYS;
+    }
+
+    struct vmalloc_fill_info *const info = (struct vmalloc_fill_info *)cb_info;
+    info->page_count++;
+
+    return page_to_phys(page);
+}
+
+__optimize(3) static uint64_t
+alloc_pages_bulk_cb(uint64_t *const phys_list,
+                    const uint64_t count,
+                    void *const cb_info)
+{
+    struct page *page_list[PGMAP_ALLOC_BULK_COUNT];
+    const uint64_t alloc_count =
+        alloc_pages_bulk(PAGE_STATE_USED,
+                         __ALLOC_ZERO,
+                         /*order=*/0,
+                         page_list,
+                         count);
+
+    for (uint64_t i = 0; i != alloc_count; i++) {
+        phys_list[i] = page_to_phys(page_list[i]);
+    }
+
+    struct vmalloc_fill_info *const info = (struct vmalloc_fill_info *)cb_info;
+    info->page_count += alloc_count;
+
+    return alloc_count;
+}
+
+static void unmap_pages(const uint64_t virt, const uint64_t size) {
+    const struct pgunmap_options options = {
+        .free_pages = true,
+        .dont_split_large_pages = true
+    };
+
+    assert(
+        arch_unmap_mapping(&kernel_pagemap,
+                           RANGE_INIT(virt, size),
+                           /*map_options=*/NULL,
+                           &options));
+}
+
+// Map newly allocated pages at [virt, virt + size). On failure, the pages that
+// were already mapped are unmapped and freed.
+
+static bool map_pages(const uint64_t virt, const uint64_t size) {
+    struct vmalloc_fill_info info = { .page_count = 0 };
+    const struct pgmap_alloc_options alloc_options = {
+        .alloc_page = alloc_page_cb,
+        .alloc_large_page = NULL,
+        .alloc_pages_bulk = alloc_pages_bulk_cb,
+
+        .alloc_page_cb_info = &info,
+        .alloc_large_page_cb_info = NULL
+    };
+
+    const enum pgmap_alloc_result result =
+        arch_alloc_mapping(&kernel_pagemap,
+                           RANGE_INIT(virt, size),
+                           PROT_READ | PROT_WRITE,
+                           VMA_CACHEKIND_DEFAULT,
+                           &alloc_options);
+
+    if (__builtin_expect(result == E_PGMAP_ALLOC_OK, 1)) {
+        return true;
+    }
+
+    if (info.page_count != 0) {
+        unmap_pages(virt, info.page_count << PAGE_SHIFT);
+    }
+
+    return false;
+}
+
+__optimize(3) __malloclike __malloc_dealloc(vfree, 1) __alloc_size(1)
+void *vmalloc(const uint64_t size) {
+    if (__builtin_expect(size == 0, 0)) {
+        printk(LOGLEVEL_WARN, "mm: vmalloc() got size=0\n");
+        return NULL;
+    }
+
+    uint64_t map_size = 0;
+    uint64_t node_size = 0;
+
+    if (__builtin_expect(!align_up(size, PAGE_SIZE, &map_size), 0) ||
+        __builtin_expect(!check_add(map_size, VMALLOC_GUARD_SIZE, &node_size),
+                         0))
+    {
+        printk(LOGLEVEL_WARN,
+               "mm: vmalloc() can't allocate %" PRIu64 " bytes\n",
+               size);
+        return NULL;
+    }
+
+    struct vmalloc_area *const area = kmalloc(sizeof(*area));
+    if (__builtin_expect(area == NULL, 0)) {
+        printk(LOGLEVEL_WARN, "mm: vmalloc() failed to allocate area\n");
+        return NULL;
+    }
+
+    area->node = ADDRSPACE_NODE_INIT(area->node, &g_vmalloc_space);
+    area->node.range.size = node_size;
+    area->size = map_size;
+
+    const struct range in_range = range_create_end(VMALLOC_BASE, VMALLOC_END);
+    const int flag = spin_acquire_with_irq(&g_vmalloc_lock);
+    const uint64_t virt =
+        addrspace_find_space_and_add_node(&g_vmalloc_space,
+                                          in_range,
+                                          &area->node,
+                                          /*pagesize_order=*/0);
+
+    spin_release_with_irq(&g_vmalloc_lock, flag);
+    if (__builtin_expect(virt == ADDRSPACE_INVALID_ADDR, 0)) {
+        kfree(area);
+        printk(LOGLEVEL_WARN,
+               "mm: vmalloc() failed to find a virtual-address range for %"
+               PRIu64 " bytes\n",
+               size);
+
+        return NULL;
+    }
+
+    if (__builtin_expect(!map_pages(virt, map_size), 0)) {
+        remove_area(area);
+        printk(LOGLEVEL_WARN,
+               "mm: vmalloc() failed to map %" PRIu64 " bytes\n",
+               size);
+
+        return NULL;
+    }
+
+    return (void *)virt;
+}
+
+uint64_t vmalloc_size(const void *const buffer) {
+    const struct vmalloc_area *const area =
+        find_area_of_buffer(buffer, "vmalloc_size");
+
+    if (__builtin_expect(area == NULL, 0)) {
+        return 0;
+    }
+
+    return area->size;
+}
+
+// Try extending the area's mapping to map_size without moving it.
+
+static bool
+grow_area_in_place(struct vmalloc_area *const area, const uint64_t map_size) {
+    const uint64_t front = area->node.range.front;
+    const uint64_t old_size = area->size;
+
+    uint64_t node_size = 0;
+    if (!check_add(map_size, VMALLOC_GUARD_SIZE, &node_size) ||
+        node_size > VMALLOC_END - front)
+    {
+        return false;
+    }
+
+    int flag = spin_acquire_with_irq(&g_vmalloc_lock);
+    const bool resized = addrspace_resize_node(&area->node, node_size);
+
+    spin_release_with_irq(&g_vmalloc_lock, flag);
+    if (!resized) {
+        return false;
+    }
+
+    if (!map_pages(front + old_size, map_size - old_size)) {
+        flag = spin_acquire_with_irq(&g_vmalloc_lock);
+        assert(
+            addrspace_resize_node(&area->node,
+                                  old_size + VMALLOC_GUARD_SIZE));
+
+        spin_release_with_irq(&g_vmalloc_lock, flag);
+        return false;
+    }
+
+    area->size = map_size;
+    return true;
+}
+
+__optimize(3) void *vrealloc(void *const buffer, const uint64_t size) {
+    if (buffer == NULL) {
+        return vmalloc(size);
+    }
+
+    if (__builtin_expect(size == 0, 0)) {
+        vfree(buffer);
+        return NULL;
+    }
+
+    struct vmalloc_area *const area = find_area_of_buffer(buffer, "vrealloc");
+    if (__builtin_expect(area == NULL, 0)) {
+        return NULL;
+    }
+
+    uint64_t map_size = 0;
+    if (__builtin_expect(!align_up(size, PAGE_SIZE, &map_size), 0)) {
+        return NULL;
+    }
+
+    const uint64_t old_size = area->size;
+    if (map_size <= old_size || grow_area_in_place(area, map_size)) {
+        return buffer;
+    }
+
+    void *const result = vmalloc(size);
+    if (__builtin_expect(result == NULL, 0)) {
+        return NULL;
+    }
+
+    memcpy(result, buffer, old_size);
+    vfree(buffer);
+
+    return result;
+}
+
+void vfree(void *const buffer) {
+    if (buffer == NULL) {
+        return;
+    }
+
+    struct vmalloc_area *const area = find_area_of_buffer(buffer, "vfree");
+    if (__builtin_expect(area == NULL, 0)) {
+        return;
+    }
+
+    unmap_pages(area->node.range.front, area->size);
+    remove_area(area);
+}
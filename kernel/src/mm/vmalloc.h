@@ -0,0 +1,31 @@
+/*
+ * kernel/src/mm/vmalloc.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lib/macros.h"
+
+// vmalloc() maps order-0 pages contiguously into the vmalloc range, so large
+// allocations don't need physically contiguous memory. Memory returned is
+// page-aligned and zeroed.
+
+bool is_vmalloc_addr(const void *buffer);
+void vfree(void *buffer);
+
+__malloclike __malloc_dealloc(vfree, 1) __alloc_size(1)
+void *vmalloc(uint64_t size);
+
+// Returns the mapped size of the allocation, which is `size` rounded up to
+// PAGE_SIZE.
+
+uint64_t vmalloc_size(const void *buffer);
+
+// Grows the allocation in place when the virtual range after it is free,
+// otherwise moves it to a new allocation. Never shrinks the allocation.
+
+__alloc_size(2) void *vrealloc(void *buffer, uint64_t size);
@@ -670,4 +670,116 @@ bool ptwalker_points_to_largepage(const struct pt_walker *const walker) {
                  walker->indices[walker->level - 1]);
 
     return pte_is_large(pte);
-}
\ No newline at end of file
+}
+
+__optimize(3) pte_t *
+ptwalker_run_begin(const struct pt_walker *const walker,
+                   const pgt_level_t level)
+{
+    return &walker->tables[level - 1][walker->indices[level - 1]];
+}
+
+__optimize(3) uint64_t
+ptwalker_run_count(const struct pt_walker *const walker,
+                   const pgt_level_t level,
+                   const uint64_t max_count)
+{
+    const uint64_t left_in_table =
+        PGT_PTE_COUNT(level) - walker->indices[level - 1];
+
+    return min(left_in_table, max_count);
+}
+
+__optimize(3) enum pt_walker_result
+ptwalker_next_run(struct pt_walker *const walker,
+                  const pgt_level_t level,
+                  const uint64_t count,
+                  const struct pt_walker_iterate_options *const options)
+{
+    assert(count != 0);
+
+    // Move to the run's last pte, then step past it like a normal increment so
+    // crossing into the next table is handled for us.
+
+    walker->indices[level - 1] += (pgt_index_t)(count - 1);
+    return ptwalker_next_with_options(walker,
+                                      level,
+                                      options != NULL ?
+                                        options : &default_options);
+}
+
+__optimize(3) void
+ptwalker_ref_run(struct pt_walker *const walker,
+                 const pgt_level_t level,
+                 const uint64_t count)
+{
+    if (count == 0) {
+        return;
+    }
+
+    struct page *const pt = virt_to_page(walker->tables[level - 1]);
+    refcount_increment(&pt->table.refcount, (int32_t)count);
+}
+
+__optimize(3) void
+ptwalker_deref_run(struct pt_walker *const walker,
+                   const pgt_level_t level,
+                   const uint64_t count,
+                   void *const free_pgtable_cb_info)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Drop all but the last reference at once, and let the final deref free
+    // the table, and its parents, if it's now empty.
+
+    if (count > 1) {
+        struct page *const pt = virt_to_page(walker->tables[level - 1]);
+        refcount_decrement(&pt->table.refcount, (int32_t)(count - 1));
+    }
+
+    ptwalker_deref_from_level(walker, level, free_pgtable_cb_info);
+}
+
+// Every pte is stored through pte_write(), so the mmu never sees a pte that's
+// only been partly written.
+
+__optimize(3) void
+pte_fill_run(pte_t *pte,
+             const uint64_t count,
+             uint64_t phys,
+             const uint64_t stride,
+             const uint64_t flags)
+{
+    const pte_t *const end = pte + count;
+    const pte_t *const unrolled_end = pte + (count & ~3ull);
+
+    for (; pte != unrolled_end; pte += 4, phys += stride * 4) {
+        pte_write(&pte[0], phys_create_pte(phys) | flags);
+        pte_write(&pte[1], phys_create_pte(phys + stride) | flags);
+        pte_write(&pte[2], phys_create_pte(phys + stride * 2) | flags);
+        pte_write(&pte[3], phys_create_pte(phys + stride * 3) | flags);
+    }
+
+    for (; pte != end; pte++, phys += stride) {
+        pte_write(pte, phys_create_pte(phys) | flags);
+    }
+}
+
+__optimize(3) void
+pte_fill_run_from_list(pte_t *const pte,
+                       const uint64_t *const phys_list,
+                       const uint64_t count,
+                       const uint64_t flags)
+{
+    for (uint64_t i = 0; i != count; i++) {
+        pte_write(&pte[i], phys_create_pte(phys_list[i]) | flags);
+    }
+}
+
+__optimize(3) void pte_clear_run(pte_t *const pte, const uint64_t count) {
+    for (uint64_t i = 0; i != count; i++) {
+        pte_write(&pte[i], /*value=*/0);
+    }
+}
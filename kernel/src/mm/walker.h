@@ -140,3 +140,51 @@ uint64_t ptwalker_get_virt_addr(const struct pt_walker *walker);
 
 uint64_t ptwalker_virt_get_phys(struct pagemap *pagemap, uint64_t virt);
 bool ptwalker_points_to_largepage(const struct pt_walker *walker);
+
+// Runs are the ptes from the walker's current index at `level` up to the end of
+// that table. Callers operate on a run as a whole, then move the walker past it
+// with ptwalker_next_run(), so the walker's bookkeeping and the table's
+// refcount are only updated once per table. ptwalker_next_run() takes the same
+// options as ptwalker_next_with_options(), or NULL for ptwalker_next()'s.
+
+pte_t *ptwalker_run_begin(const struct pt_walker *walker, pgt_level_t level);
+uint64_t
+ptwalker_run_count(const struct pt_walker *walker,
+                   pgt_level_t level,
+                   uint64_t max_count);
+
+enum pt_walker_result
+ptwalker_next_run(struct pt_walker *walker,
+                  pgt_level_t level,
+                  uint64_t count,
+                  const struct pt_walker_iterate_options *options);
+
+// Account for `count` ptes being added to or removed from the table holding
+// the walker's run at `level`. Dropping the table's last pte frees it.
+
+void
+ptwalker_ref_run(struct pt_walker *walker, pgt_level_t level, uint64_t count);
+
+void
+ptwalker_deref_run(struct pt_walker *walker,
+                   pgt_level_t level,
+                   uint64_t count,
+                   void *free_pgtable_cb_info);
+
+// Write `count` ptes, with the first mapping `phys` and each following pte
+// mapping the next `stride` bytes.
+
+void
+pte_fill_run(pte_t *pte,
+             uint64_t count,
+             uint64_t phys,
+             uint64_t stride,
+             uint64_t flags);
+
+void
+pte_fill_run_from_list(pte_t *pte,
+                       const uint64_t *phys_list,
+                       uint64_t count,
+                       uint64_t flags);
+
+void pte_clear_run(pte_t *pte, uint64_t count);
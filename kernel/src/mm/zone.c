@@ -3,8 +3,43 @@
  * © suhas pai
  */
 
+#include "cpu/info.h"
+
+#include "numa.h"
 #include "zone.h"
 
+void page_zone_init(struct page_zone *const zone, const char *const name) {
+    zone->lock = SPINLOCK_INIT();
+    zone->name = name;
+
+    list_init(&zone->section_list);
+
+    zone->total_free = 0;
+    zone->local_alloc_count = 0;
+    zone->remote_alloc_count = 0;
+
+    zone->zeroed_lock = SPINLOCK_INIT();
+    list_init(&zone->zeroed_page_list);
+
+    zone->zeroed_page_count = 0;
+    zone->zeroed_hit_count = 0;
+    zone->zeroed_miss_count = 0;
+}
+
 __optimize(3) struct page_zone *page_to_zone(const struct page *const page) {
     return phys_to_zone(page_to_phys(page));
-}
\ No newline at end of file
+}
+
+__optimize(3)
+struct page_zone *page_zone_fallback(const struct page_zone *const zone) {
+    struct page_zone *const *iter =
+        numa_get_node(this_cpu()->numa_node)->zone_list;
+
+    for (; *iter != NULL; iter++) {
+        if (*iter == zone) {
+            return iter[1];
+        }
+    }
+
+    return NULL;
+}
@@ -8,20 +8,45 @@
 
 struct page_zone {
     struct spinlock lock;
-    const char *const name;
+    const char *name;
 
     struct list section_list;
-    struct page_zone *const fallback_zone;
-
     _Atomic uint64_t total_free;
+
+    // Pages allocated from this zone whose memory was, or wasn't, on the
+    // allocating cpu's numa node.
+
+    _Atomic uint64_t local_alloc_count;
+    _Atomic uint64_t remote_alloc_count;
+
+    // Order-0 pages that were zeroed ahead of time while the system was idle.
+    // Pages in this pool aren't counted in total_free.
+
+    struct spinlock zeroed_lock;
+    struct list zeroed_page_list;
+    uint64_t zeroed_page_count;
+
+    _Atomic uint64_t zeroed_hit_count;
+    _Atomic uint64_t zeroed_miss_count;
 };
 
+void page_zone_init(struct page_zone *zone, const char *name);
+
+// Iterate over every zone. To iterate over the zones to allocate from, in order
+// of preference, start at page_zone_default() and call page_zone_fallback().
+
 struct page_zone *page_zone_iterstart();
 struct page_zone *page_zone_iternext(struct page_zone *prev);
 
+// Returns the zone to try after `zone`, in order of distance from the current
+// cpu's numa node, or NULL if `zone` is the last one.
+
+struct page_zone *page_zone_fallback(const struct page_zone *zone);
+
 struct page_zone *page_to_zone(const struct page *page);
 struct page_zone *phys_to_zone(uint64_t phys);
 
+// Returns the zone of the current cpu's numa node.
 struct page_zone *page_zone_default();
 struct page_zone *page_zone_low4g();
 
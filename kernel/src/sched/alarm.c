@@ -3,29 +3,339 @@
  * © suhas pai
  */
 
-#include "mm/kmalloc.h"
+#include "asm/irqs.h"
+#include "asm/pause.h"
+#include "cpu/info.h"
+#include "sched/scheduler.h"
+#include "time/time.h"
+
 #include "alarm.h"
 
-__hidden struct list g_sched_alarm_list = LIST_INIT(g_sched_alarm_list);
+#define SCHED_ALARM_SLOT_MASK (SCHED_ALARM_SLOT_COUNT - 1)
+
+// Level of alarms on the wheel's expired-list.
+#define SCHED_ALARM_LEVEL_EXPIRED SCHED_ALARM_LEVEL_COUNT
 
-struct sched_alarm *
-sched_alarm_post(const struct clock *const clock, const struct timespec spec) {
-    struct sched_alarm *const alarm = kmalloc(sizeof(*alarm));
-    if (alarm == NULL) {
-        return NULL;
+void sched_alarm_wheel_init(struct sched_alarm_wheel *const wheel) {
+    wheel->lock = SPINLOCK_INIT();
+    wheel->current_tick = nsec_since_boot() >> SCHED_ALARM_TICK_SHIFT;
+    wheel->pending_count = 0;
+
+    for (uint8_t level = 0; level != SCHED_ALARM_LEVEL_COUNT; level++) {
+        wheel->pending_slots[level] = 0;
+        for (uint64_t slot = 0; slot != SCHED_ALARM_SLOT_COUNT; slot++) {
+            list_init(&wheel->slot_list[level][slot]);
+        }
     }
 
+    list_init(&wheel->expired_list);
+}
+
+void
+sched_alarm_init(struct sched_alarm *const alarm,
+                 const sched_alarm_callback_t callback,
+                 void *const cb_info)
+{
     list_init(&alarm->list);
 
-    alarm->clock = clock;
-    alarm->time = spec;
+    alarm->expire_tick = 0;
+    alarm->callback = callback;
+    alarm->cb_info = cb_info;
+    alarm->wheel = NULL;
+    alarm->firing_wheel = NULL;
+    alarm->level = 0;
+    alarm->slot = 0;
+}
+
+// Pick the tick in [first, last] with the most trailing zero bits, so alarms
+// whose ranges overlap end up on the same tick.
+
+__optimize(3) static inline uint64_t
+coalesce_tick(const uint64_t first, const uint64_t last) {
+    if (first >= last) {
+        return first;
+    }
+
+    const uint8_t bit = (uint8_t)(63 - __builtin_clzll(first ^ last));
+    return last & ~((1ull << bit) - 1);
+}
+
+// Caller is required to hold wheel->lock.
+
+static void
+wheel_add(struct sched_alarm_wheel *const wheel,
+          struct sched_alarm *const alarm)
+{
+    // Alarms whose tick already passed are fired at the next tick processed.
+    const uint64_t expire_tick = max(alarm->expire_tick, wheel->current_tick);
+    const uint64_t delta =
+        min(expire_tick - wheel->current_tick, SCHED_ALARM_MAX_TICK_DELTA);
+
+    uint8_t level = 0;
+    if (delta >= SCHED_ALARM_SLOT_COUNT) {
+        level =
+            (uint8_t)((63 - __builtin_clzll(delta)) / SCHED_ALARM_SLOT_SHIFT);
+    }
+
+    const uint64_t tick = wheel->current_tick + delta;
+    const uint8_t slot =
+        (tick >> (level * SCHED_ALARM_SLOT_SHIFT)) & SCHED_ALARM_SLOT_MASK;
+
+    list_radd(&wheel->slot_list[level][slot], &alarm->list);
+    wheel->pending_slots[level] |= 1ull << slot;
+    wheel->pending_count++;
+
+    alarm->level = level;
+    alarm->slot = slot;
+
+    atomic_store_explicit(&alarm->wheel, wheel, memory_order_relaxed);
+}
+
+// Caller is required to hold wheel->lock.
+
+static void
+wheel_remove(struct sched_alarm_wheel *const wheel,
+             struct sched_alarm *const alarm)
+{
+    list_remove(&alarm->list);
+    atomic_store_explicit(&alarm->wheel, NULL, memory_order_release);
+
+    if (alarm->level == SCHED_ALARM_LEVEL_EXPIRED) {
+        return;
+    }
+
+    struct list *const slot_list =
+        &wheel->slot_list[alarm->level][alarm->slot];
+
+    if (list_empty(slot_list)) {
+        wheel->pending_slots[alarm->level] &= ~(1ull << alarm->slot);
+    }
+
+    wheel->pending_count--;
+}
+
+void
+sched_alarm_post(struct sched_alarm *const alarm,
+                 const nsec_t deadline,
+                 const nsec_t slack)
+{
+    sched_alarm_cancel(alarm);
+
+    const nsec_t tick_mask = (1ull << SCHED_ALARM_TICK_SHIFT) - 1;
+    nsec_t last = 0;
+
+    if (__builtin_add_overflow(deadline, slack, &last)) {
+        last = UINT64_MAX;
+    }
+
+    const uint64_t first_tick =
+        (deadline >> SCHED_ALARM_TICK_SHIFT) + ((deadline & tick_mask) != 0);
+    const uint64_t last_tick = last >> SCHED_ALARM_TICK_SHIFT;
+
+    alarm->expire_tick = coalesce_tick(first_tick, max(first_tick, last_tick));
+
+    const bool flag = disable_all_irqs_if_not();
+    struct sched_alarm_wheel *const wheel = &this_cpu_mut()->alarm_wheel;
+
+    spin_acquire(&wheel->lock);
+    wheel_add(wheel, alarm);
+    spin_release(&wheel->lock);
+
+    // The cpu's timer may be stopped, or armed for after the alarm's tick.
+    // Alarms are only ever posted on the current cpu, so there's no other cpu
+    // to interrupt.
+
+    const uint64_t max_tick = UINT64_MAX >> SCHED_ALARM_TICK_SHIFT;
+    sched_arm_timer_by(alarm->expire_tick <= max_tick ?
+                        alarm->expire_tick << SCHED_ALARM_TICK_SHIFT :
+                        UINT64_MAX);
+
+    enable_all_irqs_if_flag(flag);
+}
+
+bool sched_alarm_cancel(struct sched_alarm *const alarm) {
+    bool result = false;
+    while (true) {
+        // The alarm may fire, or be posted on another cpu, before we take the
+        // wheel's lock, so check again once the lock is held.
+
+        struct sched_alarm_wheel *const wheel = atomic_load(&alarm->wheel);
+        if (wheel != NULL) {
+            const int flag = spin_acquire_with_irq(&wheel->lock);
+            if (atomic_load(&alarm->wheel) == wheel) {
+                wheel_remove(wheel, alarm);
+                result = true;
+            }
+
+            spin_release_with_irq(&wheel->lock, flag);
+            continue;
+        }
+
+        // A callback runs with irqs disabled, so a cancel from the cpu running
+        // the callback can only be from the callback itself. Otherwise, wait
+        // for the callback to return, then check again in case it posted the
+        // alarm again.
+
+        const struct sched_alarm_wheel *const firing_wheel =
+            atomic_load(&alarm->firing_wheel);
+
+        if (firing_wheel == NULL || firing_wheel == &this_cpu()->alarm_wheel) {
+            return result;
+        }
+
+        cpu_pause();
+    }
+}
+
+// Move every alarm in the slot of `level` the wheel just reached to the lower
+// levels. Caller is required to hold wheel->lock.
+
+static void
+cascade(struct sched_alarm_wheel *const wheel, const uint8_t level) {
+    const uint8_t slot =
+        (wheel->current_tick >> (level * SCHED_ALARM_SLOT_SHIFT)) &
+        SCHED_ALARM_SLOT_MASK;
+
+    if ((wheel->pending_slots[level] & (1ull << slot)) == 0) {
+        return;
+    }
+
+    struct list *const slot_list = &wheel->slot_list[level][slot];
+    struct sched_alarm *alarm = NULL;
+    struct sched_alarm *tmp = NULL;
+
+    wheel->pending_slots[level] &= ~(1ull << slot);
+    list_foreach_mut(alarm, tmp, slot_list, list) {
+        list_remove(&alarm->list);
+        wheel->pending_count--;
+
+        wheel_add(wheel, alarm);
+    }
+}
+
+// Move every alarm of the current tick to the wheel's expired-list. Caller is
+// required to hold wheel->lock.
+
+static void expire_current_tick(struct sched_alarm_wheel *const wheel) {
+    const uint8_t slot = wheel->current_tick & SCHED_ALARM_SLOT_MASK;
+    if ((wheel->pending_slots[0] & (1ull << slot)) == 0) {
+        return;
+    }
+
+    struct list *const slot_list = &wheel->slot_list[0][slot];
+    struct sched_alarm *alarm = NULL;
+    struct sched_alarm *tmp = NULL;
+
+    wheel->pending_slots[0] &= ~(1ull << slot);
+    list_foreach_mut(alarm, tmp, slot_list, list) {
+        list_remove(&alarm->list);
+        list_radd(&wheel->expired_list, &alarm->list);
+
+        alarm->level = SCHED_ALARM_LEVEL_EXPIRED;
+        wheel->pending_count--;
+    }
+}
+
+void sched_alarm_run() {
+    struct sched_alarm_wheel *const wheel = &this_cpu_mut()->alarm_wheel;
+    const uint64_t now_tick = nsec_since_boot() >> SCHED_ALARM_TICK_SHIFT;
+    int flag = spin_acquire_with_irq(&wheel->lock);
+    while (wheel->current_tick <= now_tick) {
+        if (wheel->pending_count == 0) {
+            wheel->current_tick = now_tick + 1;
+            break;
+        }
+
+        // Higher levels go first, as their alarms can move into the slot of
+        // the current tick on a lower level.
+
+        for (uint8_t level = SCHED_ALARM_LEVEL_COUNT - 1; level != 0; level--) {
+            const uint64_t mask =
+                (1ull << (level * SCHED_ALARM_SLOT_SHIFT)) - 1;
 
-    struct sched_alarm *iter = NULL;
-    list_foreach(iter, &g_sched_alarm_list, list) {
-        if (timespec_compare(spec, iter->time) > 0) {
-            list_add(&iter->list, &alarm->list);
+            if ((wheel->current_tick & mask) == 0) {
+                cascade(wheel, level);
+            }
         }
+
+        expire_current_tick(wheel);
+
+        // Skip over ticks that can't have anything to do, up to the start of
+        // the next slot of the lowest level that has pending alarms.
+
+        uint64_t next_tick = wheel->current_tick + 1;
+        for (uint8_t level = 0;
+             level != SCHED_ALARM_LEVEL_COUNT &&
+                wheel->pending_slots[level] == 0;
+             level++)
+        {
+            const uint64_t mask =
+                (1ull << ((level + 1) * SCHED_ALARM_SLOT_SHIFT)) - 1;
+
+            next_tick = (wheel->current_tick | mask) + 1;
+        }
+
+        wheel->current_tick = min(next_tick, now_tick + 1);
+    }
+
+    // Take expired alarms off the list one at a time, as the list can change
+    // whenever the lock is dropped to run a callback. The alarm is marked as
+    // firing before it stops being pending, so a cancel always sees either.
+
+    while (!list_empty(&wheel->expired_list)) {
+        struct sched_alarm *const alarm =
+            list_head(&wheel->expired_list, struct sched_alarm, list);
+
+        atomic_store(&alarm->firing_wheel, wheel);
+        wheel_remove(wheel, alarm);
+
+        spin_release_with_irq(&wheel->lock, flag);
+        alarm->callback(alarm);
+
+        // The alarm may be freed as soon as it stops firing.
+        atomic_store(&alarm->firing_wheel, NULL);
+        flag = spin_acquire_with_irq(&wheel->lock);
+    }
+
+    spin_release_with_irq(&wheel->lock, flag);
+}
+
+nsec_t sched_alarm_next_deadline() {
+    struct sched_alarm_wheel *const wheel = &this_cpu_mut()->alarm_wheel;
+    uint64_t result = SCHED_ALARM_TICK_INVALID;
+
+    const int flag = spin_acquire_with_irq(&wheel->lock);
+    for (uint8_t level = 0;
+         level != SCHED_ALARM_LEVEL_COUNT && wheel->pending_count != 0;
+         level++)
+    {
+        const uint64_t pending = wheel->pending_slots[level];
+        if (pending == 0) {
+            continue;
+        }
+
+        // Slots of higher levels are reached at the start of a slot, and the
+        // current slot of a level was already reached unless we're at its
+        // start.
+
+        const uint8_t shift = level * SCHED_ALARM_SLOT_SHIFT;
+        const uint64_t mask = (1ull << shift) - 1;
+        const uint64_t base = (wheel->current_tick + mask) & ~mask;
+        const uint8_t index = (base >> shift) & SCHED_ALARM_SLOT_MASK;
+
+        const uint64_t rotated =
+            index != 0 ?
+                (pending >> index) | (pending << (64 - index)) : pending;
+        const uint64_t tick =
+            base + ((uint64_t)__builtin_ctzll(rotated) << shift);
+
+        result = min(result, tick);
+    }
+
+    spin_release_with_irq(&wheel->lock, flag);
+    if (result == SCHED_ALARM_TICK_INVALID) {
+        return SCHED_ALARM_TICK_INVALID;
     }
 
-    return alarm;
+    return result << SCHED_ALARM_TICK_SHIFT;
 }
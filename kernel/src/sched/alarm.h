@@ -5,15 +5,99 @@
 
 #pragma once
 
+#include "cpu/spinlock.h"
 #include "lib/list.h"
-#include "time/clock.h"
+#include "lib/time.h"
 
+// Alarms are kept on a hierarchical timing wheel, one per cpu. Every level has
+// SCHED_ALARM_SLOT_COUNT slots, each covering SCHED_ALARM_SLOT_COUNT times as
+// many ticks as a slot of the level below it. An alarm is put in a slot of the
+// lowest level that reaches its deadline, and moved down a level whenever the
+// wheel reaches its slot, so posting and cancelling an alarm are O(1).
+
+#define SCHED_ALARM_TICK_SHIFT 20
+#define SCHED_ALARM_SLOT_SHIFT 6
+#define SCHED_ALARM_SLOT_COUNT (1ull << SCHED_ALARM_SLOT_SHIFT)
+#define SCHED_ALARM_LEVEL_COUNT 4
+
+// Alarms past the last level are kept in its farthest slot, and put back into
+// the wheel once it's reached.
+
+#define SCHED_ALARM_MAX_TICK_DELTA \
+    ((1ull << (SCHED_ALARM_SLOT_SHIFT * SCHED_ALARM_LEVEL_COUNT)) - 1)
+
+#define SCHED_ALARM_TICK_INVALID UINT64_MAX
+
+struct sched_alarm;
+typedef void (*sched_alarm_callback_t)(struct sched_alarm *alarm);
+
+struct sched_alarm_wheel;
 struct sched_alarm {
     struct list list;
-    struct timespec time;
 
-    const struct clock *clock;
+    // Tick of the wheel the alarm fires at, somewhere between its deadline and
+    // its deadline plus its slack.
+
+    uint64_t expire_tick;
+
+    sched_alarm_callback_t callback;
+    void *cb_info;
+
+    // The wheel the alarm is pending on, or NULL if the alarm isn't pending.
+    struct sched_alarm_wheel *_Atomic wheel;
+
+    // The wheel whose cpu is running the alarm's callback, or NULL if the
+    // callback isn't running.
+
+    struct sched_alarm_wheel *_Atomic firing_wheel;
+
+    uint8_t level;
+    uint8_t slot;
+};
+
+struct sched_alarm_wheel {
+    struct spinlock lock;
+
+    // The next tick that hasn't been processed yet.
+    uint64_t current_tick;
+    uint32_t pending_count;
+
+    uint64_t pending_slots[SCHED_ALARM_LEVEL_COUNT];
+    struct list slot_list[SCHED_ALARM_LEVEL_COUNT][SCHED_ALARM_SLOT_COUNT];
+
+    // Alarms whose tick was reached, waiting for their callback to be run.
+    struct list expired_list;
 };
 
-struct sched_alarm *
-sched_alarm_post(const struct clock *clock, struct timespec spec);
+void sched_alarm_wheel_init(struct sched_alarm_wheel *wheel);
+
+void
+sched_alarm_init(struct sched_alarm *alarm,
+                 sched_alarm_callback_t callback,
+                 void *cb_info);
+
+// Fire `alarm` on the current cpu once nsec_since_boot() reaches `deadline`,
+// and no later than `deadline + slack`. Alarms whose ranges overlap are
+// rounded to the same tick, so they're fired together. An alarm that's already
+// pending is moved to its new deadline.
+
+void sched_alarm_post(struct sched_alarm *alarm, nsec_t deadline, nsec_t slack);
+
+// Returns true if `alarm` was pending and is now cancelled, and false if it was
+// never posted or has already fired. If the alarm's callback is running on
+// another cpu, waits for it to return, so the alarm can be freed once this
+// returns. Called from the alarm's own callback, doesn't wait, and only returns
+// true if the callback posted the alarm again.
+
+bool sched_alarm_cancel(struct sched_alarm *alarm);
+
+// Called from the scheduler's interrupt. Fires every alarm of the current cpu
+// whose tick has been reached, one at a time, and without the wheel's lock
+// held, so callbacks can post and cancel alarms.
+
+void sched_alarm_run();
+
+// Returns the nsec_since_boot() at which sched_alarm_run() next has work to do,
+// or SCHED_ALARM_TICK_INVALID if no alarm is pending.
+
+nsec_t sched_alarm_next_deadline();
@@ -8,44 +8,33 @@
 
 #include "event.h"
 
-__optimize(3) static inline
-void lock_events(struct event **const events, const uint32_t event_count) {
-    for (uint32_t i = 0; i != event_count; i++) {
-        spin_acquire(&events[i]->lock);
-    }
-}
+// Amount of threads woken up at once, so each cpu they go to only gets a single
+// ipi per batch.
 
-__optimize(3) static inline
-void unlock_events(struct event **const events, const uint32_t event_count) {
-    for (uint32_t i = 0; i != event_count; i++) {
-        spin_release(&events[i]->lock);
-    }
-}
+#define EVENT_WAKE_BATCH_COUNT 32
 
-__optimize(3) static inline
-int64_t find_pending(struct event **const events, const uint32_t event_count) {
-    for (uint32_t i = 0; i != event_count; i++) {
-        if (events[i]->pending_count > 0) {
-            events[i]->pending_count--;
-            return i;
-        }
-    }
+// Wake up `thread` for the event at `index`, unless another event already woke
+// it up. Returns true if the thread was woken up by this call.
 
-    return -1;
+__optimize(3) static inline bool
+claim_waiter(struct thread *const thread, const uint32_t index) {
+    int64_t expected = -1;
+    return atomic_compare_exchange_strong(&thread->wake_event_index,
+                                          &expected,
+                                          (int64_t)index);
 }
 
-__optimize(3) static inline void
-add_listeners_to_events(struct event **const events,
-                        const uint32_t event_count,
-                        struct thread *const thread)
-{
-    for (uint32_t i = 0; i != event_count; i++) {
-        const struct event_listener listener =
-            EVENT_LISTENER_INIT(thread, array_item_count(events[i]->listeners));
-
-        assert(array_append(&events[i]->listeners, &thread));
-        assert(array_append(&thread->events_hearing, &listener));
-    }
+// Switch away from the current thread until it's woken up. The scheduler keeps
+// running a dequeued thread if there's nothing else to run, in which case we
+// wait for an irq instead. Called with irqs disabled.
+
+static void wait_until_woken(struct thread *const thread) {
+    // The ipi sent by sched_yield() ends the first wait right away.
+    sched_yield();
+    do {
+        enable_all_irqs_and_wait();
+        disable_all_irqs();
+    } while (atomic_load(&thread->wake_event_index) == -1);
 }
 
 int64_t
@@ -53,47 +42,147 @@ events_await(struct event **const events,
              const uint32_t event_count,
              const bool block)
 {
+    assert_msg(event_count <= EVENTS_AWAIT_MAX,
+               "sched: can't wait on %" PRIu32 " events at once",
+               event_count);
+
+    struct thread *const thread = current_thread();
+    struct event_listener listener_list[EVENTS_AWAIT_MAX];
+
     const bool flag = disable_all_irqs_if_not();
-    lock_events(events, event_count);
+    atomic_store(&thread->wake_event_index, -1);
 
-    const int64_t index = find_pending(events, event_count);
-    if (index != -1) {
-        unlock_events(events, event_count);
-        enable_all_irqs_if_flag(flag);
+    // Stop the thread before any trigger can see its listeners, so a trigger
+    // that comes before we switch away undoes the stop instead of being lost.
+
+    if (block) {
+        assert_msg(flag, "sched: can't block while irqs are disabled");
+        sched_dequeue_thread(thread);
+    }
+
+    // Only a single event is ever locked at a time. A trigger of an event we
+    // already listen on may wake us up before we get to the rest, and whoever
+    // claims the thread first decides which event woke it up.
+
+    uint32_t listener_count = 0;
+    for (uint32_t i = 0; i != event_count; i++) {
+        struct event *const event = events[i];
+        spin_acquire(&event->lock);
+
+        if (event->pending_count != 0) {
+            if (claim_waiter(thread, i)) {
+                event->pending_count--;
+            }
+
+            spin_release(&event->lock);
+            break;
+        }
+
+        if (block) {
+            struct event_listener *const listener = &listener_list[i];
+
+            list_init(&listener->list);
+            list_radd(&event->listener_list, &listener->list);
+
+            listener->waiter = thread;
+            listener->index = i;
 
-        return index;
+            listener_count++;
+        }
+
+        spin_release(&event->lock);
+        if (atomic_load(&thread->wake_event_index) != -1) {
+            break;
+        }
     }
 
     if (!block) {
-        unlock_events(events, event_count);
         enable_all_irqs_if_flag(flag);
+        return atomic_load(&thread->wake_event_index);
+    }
 
-        return -1;
+    if (atomic_load(&thread->wake_event_index) == -1) {
+        wait_until_woken(thread);
+    } else {
+        // Undo the stop if a pending event, rather than a trigger, woke us.
+        sched_enqueue_thread(thread);
     }
 
-    struct thread *const thread = current_thread();
-    add_listeners_to_events(events, event_count, thread);
+    // Triggers remove the listeners they wake up, so this only removes the
+    // listeners of the events that weren't triggered.
 
-    unlock_events(events, event_count);
-    enable_all_irqs_if_flag(flag);
+    for (uint32_t i = 0; i != listener_count; i++) {
+        struct event *const event = events[i];
+
+        spin_acquire(&event->lock);
+        list_remove(&listener_list[i].list);
+        spin_release(&event->lock);
+    }
 
-    return -1;
+    enable_all_irqs_if_flag(flag);
+    return atomic_load(&thread->wake_event_index);
 }
 
-void event_trigger(struct event *const event, const bool drop_if_no_listeners) {
+// Wake up to `max_count` threads waiting on `event`, in the order they started
+// waiting. Threads are enqueued while the event is locked, so a woken thread
+// can't start waiting again before its wakeup is done with it.
+
+static void
+trigger(struct event *const event,
+        const uint32_t max_count,
+        const bool drop_if_no_listeners)
+{
+    struct thread *batch[EVENT_WAKE_BATCH_COUNT];
+    uint32_t batch_count = 0;
+    uint32_t woken_count = 0;
+
     const bool flag = disable_all_irqs_if_not();
-    if (array_empty(event->listeners)) {
-        if (!drop_if_no_listeners) {
-            event->pending_count++;
+    spin_acquire(&event->lock);
+
+    struct event_listener *listener = NULL;
+    struct event_listener *tmp = NULL;
+
+    list_foreach_mut(listener, tmp, &event->listener_list, list) {
+        if (woken_count == max_count) {
+            break;
         }
 
-        enable_all_irqs_if_flag(flag);
-        return;
+        struct thread *const waiter = listener->waiter;
+        const uint32_t index = listener->index;
+
+        list_remove(&listener->list);
+        if (!claim_waiter(waiter, index)) {
+            continue;
+        }
+
+        batch[batch_count] = waiter;
+        batch_count++;
+        woken_count++;
+
+        if (batch_count == EVENT_WAKE_BATCH_COUNT) {
+            sched_enqueue_thread_list(batch, batch_count);
+            batch_count = 0;
+        }
     }
 
-    array_foreach(&event->listeners, const struct thread, listener) {
+    if (batch_count != 0) {
+        sched_enqueue_thread_list(batch, batch_count);
+    }
 
+    if (woken_count == 0 && !drop_if_no_listeners) {
+        event->pending_count++;
     }
 
+    spin_release(&event->lock);
     enable_all_irqs_if_flag(flag);
 }
+
+void event_trigger(struct event *const event, const bool drop_if_no_listeners) {
+    trigger(event, /*max_count=*/UINT32_MAX, drop_if_no_listeners);
+}
+
+void
+event_trigger_one(struct event *const event, const bool drop_if_no_listeners)
+{
+    trigger(event, /*max_count=*/1, drop_if_no_listeners);
+}
@@ -5,36 +5,55 @@
 
 #pragma once
 
-#include "lib/adt/array.h"
-
 #include "cpu/spinlock.h"
+#include "lib/list.h"
+
 #include "sched/scheduler.h"
 
+// An event is a wait-queue. Threads wait on one or more events at a time, and
+// are woken up by the first of them to be triggered. Triggering an event no
+// thread is waiting on leaves it pending for the next wait, unless the trigger
+// is dropped.
+
 struct event {
     struct spinlock lock;
-    struct array listeners;
+    struct list listener_list;
 
     struct scheduler *sched;
     uint32_t pending_count;
 };
 
-#define EVENT_INIT() \
+#define EVENT_INIT(name) \
     ((struct event){ \
         .lock = SPINLOCK_INIT(), \
-        .listeners = ARRAY_INIT(sizeof(struct thread *)) \
+        .listener_list = LIST_INIT(name.listener_list), \
+        .sched = NULL, \
+        .pending_count = 0 \
     })
 
+// The most events a thread can wait on at once.
+#define EVENTS_AWAIT_MAX 16
+
 struct thread;
+
+// Listeners live on the stack of the waiting thread for as long as it waits,
+// so waiting never allocates.
+
 struct event_listener {
+    struct list list;
     struct thread *waiter;
-    uint32_t listeners_index;
+
+    uint32_t index;
 };
 
-#define EVENT_LISTENER_INIT(thread, index) \
-    ((struct event_listener){ \
-        .waiter = (thread), \
-        .listeners_index = (index) \
-    })
+// Returns the index of the event in `events` that was triggered. If `block` is
+// false, returns -1 instead of waiting when no event is pending. Blocking waits
+// switch away from the current thread until it's woken up.
 
 int64_t events_await(struct event **events, uint32_t event_count, bool block);
-void event_trigger(struct event *events, bool drop_if_no_listeners);
+
+// Wake up every thread waiting on `event`.
+void event_trigger(struct event *event, bool drop_if_no_listeners);
+
+// Wake up only the thread that's been waiting on `event` the longest.
+void event_trigger_one(struct event *event, bool drop_if_no_listeners);
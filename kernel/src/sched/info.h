@@ -5,7 +5,9 @@
 
 #pragma once
 
+#include "lib/list.h"
 #include "lib/time.h"
+
 #include "scheduler.h"
 
 struct sched_process_info {
@@ -15,16 +17,48 @@ struct sched_process_info {
 enum sched_thread_state {
     SCHED_THREAD_STATE_NONE,
     SCHED_THREAD_STATE_RUNNABLE,
-    SCHED_THREAD_STATE_RUNNING
+    SCHED_THREAD_STATE_RUNNING,
+
+    // The thread is running, but was dequeued, so it isn't enqueued again once
+    // it's switched away from.
+
+    SCHED_THREAD_STATE_STOPPING
 };
 
+// Amount of time a thread runs before the cpu switches to the next thread on
+// its run-queue.
+
+#define SCHED_DEFAULT_TIMESLICE_USEC 10000
+
+struct sched_runqueue;
 struct sched_thread_info {
     struct scheduler *scheduler;
     usec_t timeslice;
+
+    _Atomic enum sched_thread_state state;
+
+    // Set while a cpu is running the thread, and until that cpu is done with
+    // the thread's stack after switching away from it, see sched_next(). No
+    // other cpu may run the thread in the meantime.
+
+    _Atomic bool on_cpu;
+
+    // The run-queue the thread is on while runnable, or NULL. Changes when
+    // another cpu steals the thread, so it's only stable while holding the
+    // run-queue's lock. runqueue_list is only valid while this isn't NULL.
+
+    struct sched_runqueue *_Atomic runqueue;
+    struct list runqueue_list;
 };
 
 #define SCHED_PROCESS_INFO_INIT() \
     ((struct sched_process_info){})
 
 #define SCHED_THREAD_INFO_INIT() \
-    ((struct sched_thread_info){ .timeslice = 0 })
+    ((struct sched_thread_info){ \
+        .scheduler = NULL, \
+        .timeslice = SCHED_DEFAULT_TIMESLICE_USEC, \
+        .state = SCHED_THREAD_STATE_NONE, \
+        .on_cpu = false, \
+        .runqueue = NULL \
+    })
@@ -4,23 +4,34 @@
  */
 
 #include "cpu/cpu_info.h"
-#include "mm/kmalloc.h"
 
 #include "irq.h"
 #include "process.h"
 #include "scheduler.h"
 #include "thread.h"
+#include "timer.h"
 
 void sched_init(struct scheduler *const sched) {
     (void)sched;
     assert(array_append(&kernel_process.threads, &kernel_main_thread));
 
-    struct thread *const idle_thread = kmalloc(sizeof(struct thread));
+    thread_cache_init();
+
+    struct thread *const idle_thread = thread_alloc();
     assert(idle_thread != NULL);
 
     idle_thread->cpu = this_cpu_mut();
     idle_thread->process = &kernel_process;
 
     g_base_cpu_info.idle_thread = idle_thread;
+    sched_init_cpu(&g_base_cpu_info);
+
+    // The main thread is already running on the base cpu.
+    struct sched_thread_info *const main_info = &kernel_main_thread.sched_info;
+
+    atomic_store(&main_info->state, SCHED_THREAD_STATE_RUNNING);
+    atomic_store(&main_info->on_cpu, true);
+
     sched_init_irq();
+    sched_timer_oneshot(main_info->timeslice);
 }
\ No newline at end of file
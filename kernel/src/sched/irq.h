@@ -7,3 +7,15 @@
 
 void sched_init_irq();
 void sched_irq_eoi();
+
+// Interrupt the current cpu with the scheduler's vector, so it switches to the
+// next thread as soon as irqs are enabled.
+
+void sched_send_self_ipi();
+
+struct cpu_info;
+
+// Interrupt `cpu` with the scheduler's vector, so it picks up a thread that was
+// just placed on its run-queue.
+
+void sched_send_ipi(struct cpu_info *cpu);
@@ -0,0 +1,54 @@
+/*
+ * kernel/src/sched/runqueue.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+
+#include "cpu/spinlock.h"
+#include "lib/list.h"
+#include "lib/time.h"
+
+#include "topology.h"
+
+// Every cpu has its own run-queue of runnable threads, each with its own lock,
+// so enqueueing, dequeueing and picking the next thread never take a global
+// lock. A cpu with nothing to run steals from the busiest run-queue instead,
+// preferring the run-queues of cpus it shares the most of its caches with.
+
+struct cpu_info;
+struct thread;
+
+struct sched_runqueue {
+    struct spinlock lock;
+    struct list thread_list;
+
+    // Read without the lock by cpus looking for a run-queue to steal from.
+    _Atomic uint32_t count;
+
+    struct cpu_info *cpu;
+    struct sched_topology topology;
+
+    // Set while the cpu has nothing to run, so woken threads can be placed on
+    // it instead of waiting behind other threads.
+
+    _Atomic bool idle;
+
+    // Set while the cpu's timer isn't armed for the end of the timeslice, as
+    // no other thread is waiting to run.
+
+    _Atomic bool tick_stopped;
+
+    // When the cpu's timer next goes off, or UINT64_MAX if it's stopped. Only
+    // accessed by the cpu itself, with irqs disabled.
+
+    nsec_t timer_deadline;
+
+    // The thread the cpu last switched away from. The scheduler's interrupt
+    // frame was on its stack, so it's only done with the thread once the next
+    // interrupt arrives.
+
+    struct thread *switched_from;
+};
@@ -3,18 +3,539 @@
  * © suhas pai
  */
 
+#include "asm/irqs.h"
+#include "asm/pause.h"
+#include "mm/pagemap.h"
+#include "time/time.h"
+
+#include "alarm.h"
+#include "irq.h"
 #include "scheduler.h"
 #include "thread.h"
 #include "timer.h"
+#include "topology.h"
+
+// The most cpus whose run-queues can be stolen from.
+#define SCHED_MAX_CPU_COUNT 256
+
+// The most cpus sched_enqueue_thread_list() keeps track of before sending them
+// their ipis.
+
+#define SCHED_ENQUEUE_KICK_MAX 32
+
+// Run-queues are only ever added, as cpus come up, so cpus looking for a thread
+// to steal read the list without taking its lock.
+
+static struct sched_runqueue *g_runqueue_list[SCHED_MAX_CPU_COUNT];
+static _Atomic uint32_t g_runqueue_count = 0;
+static struct spinlock g_runqueue_list_lock = SPINLOCK_INIT();
+
+void sched_init_cpu(struct cpu_info *const cpu) {
+    struct sched_runqueue *const runqueue = &cpu->runqueue;
+
+    runqueue->lock = SPINLOCK_INIT();
+    list_init(&runqueue->thread_list);
+
+    runqueue->count = 0;
+    runqueue->cpu = cpu;
+    runqueue->idle = false;
+    runqueue->tick_stopped = false;
+    runqueue->timer_deadline = UINT64_MAX;
+    runqueue->switched_from = NULL;
+
+    sched_topology_find_cpu(cpu, &runqueue->topology);
+    sched_alarm_wheel_init(&cpu->alarm_wheel);
+
+    const int flag = spin_acquire_with_irq(&g_runqueue_list_lock);
+    const uint32_t index = atomic_load(&g_runqueue_count);
+
+    assert_msg(index != SCHED_MAX_CPU_COUNT,
+               "sched: too many cpus to add another run-queue");
+
+    g_runqueue_list[index] = runqueue;
+    atomic_store_explicit(&g_runqueue_count, index + 1, memory_order_release);
+
+    spin_release_with_irq(&g_runqueue_list_lock, flag);
+}
+
+// Caller is required to hold runqueue->lock.
+
+__optimize(3) static inline void
+runqueue_add(struct sched_runqueue *const runqueue, struct thread *const thread)
+{
+    list_radd(&runqueue->thread_list, &thread->sched_info.runqueue_list);
+
+    thread->sched_info.runqueue = runqueue;
+    thread->cpu = runqueue->cpu;
+
+    atomic_fetch_add(&runqueue->count, 1);
+}
+
+// Caller is required to hold runqueue->lock.
+
+__optimize(3) static inline void
+runqueue_remove(struct sched_runqueue *const runqueue,
+                struct thread *const thread)
+{
+    list_delete(&thread->sched_info.runqueue_list);
+    thread->sched_info.runqueue = NULL;
+
+    atomic_fetch_sub(&runqueue->count, 1);
+}
+
+// Take the first thread of the run-queue that no other cpu is still using,
+// searching from the front, or from the back if `from_back` is true.
+
+static struct thread *
+runqueue_take(struct sched_runqueue *const runqueue, const bool from_back) {
+    if (atomic_load_explicit(&runqueue->count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+
+    const int flag = spin_acquire_with_irq(&runqueue->lock);
+    struct thread *result = NULL;
+    struct thread *iter = NULL;
+
+    if (from_back) {
+        list_foreach_reverse(iter,
+                             &runqueue->thread_list,
+                             sched_info.runqueue_list)
+        {
+            if (!atomic_load(&iter->sched_info.on_cpu)) {
+                result = iter;
+                break;
+            }
+        }
+    } else {
+        list_foreach(iter, &runqueue->thread_list, sched_info.runqueue_list) {
+            if (!atomic_load(&iter->sched_info.on_cpu)) {
+                result = iter;
+                break;
+            }
+        }
+    }
+
+    if (result != NULL) {
+        runqueue_remove(runqueue, result);
+    }
+
+    spin_release_with_irq(&runqueue->lock, flag);
+    return result;
+}
+
+// Take a thread from another run-queue, from the back of its queue, so we don't
+// contend with its cpu taking from the front. The busiest run-queue of the
+// cpus sharing the closest level of the topology with us is tried first, so
+// the thread keeps as much of its cache as possible. Only a single run-queue's
+// lock is ever held at a time.
+
+static struct thread *steal_thread(struct sched_runqueue *const ours) {
+    const uint32_t count =
+        atomic_load_explicit(&g_runqueue_count, memory_order_acquire);
+
+    struct sched_runqueue *busiest_list[SCHED_TOPOLOGY_LEVEL_COUNT + 1] = {};
+    uint32_t busiest_count_list[SCHED_TOPOLOGY_LEVEL_COUNT + 1] = {};
+
+    for (uint32_t i = 0; i != count; i++) {
+        struct sched_runqueue *const runqueue = g_runqueue_list[i];
+        if (runqueue == ours) {
+            continue;
+        }
+
+        const uint32_t runqueue_count =
+            atomic_load_explicit(&runqueue->count, memory_order_relaxed);
+        const enum sched_topology_level level =
+            sched_topology_shared_level(&ours->topology, &runqueue->topology);
+
+        if (runqueue_count > busiest_count_list[level]) {
+            busiest_list[level] = runqueue;
+            busiest_count_list[level] = runqueue_count;
+        }
+    }
+
+    for (uint32_t level = 0; level != SCHED_TOPOLOGY_LEVEL_COUNT + 1; level++) {
+        if (busiest_list[level] == NULL) {
+            continue;
+        }
+
+        struct thread *const thread =
+            runqueue_take(busiest_list[level], /*from_back=*/true);
+
+        if (thread != NULL) {
+            return thread;
+        }
+    }
+
+    return NULL;
+}
+
+// A woken thread is kept close to the cpu that woke it, whose cache likely has
+// what the thread is about to use. It's queued on our own run-queue, unless
+// another cpu is idle, in which case the idle cpu sharing the closest level of
+// the topology with us runs it instead. Threads only go to another package when
+// every cpu of ours is busy, which spreads load across packages.
+
+static struct sched_runqueue *select_runqueue(struct sched_runqueue *const ours)
+{
+    if (atomic_load_explicit(&ours->idle, memory_order_relaxed)) {
+        return ours;
+    }
+
+    const uint32_t count =
+        atomic_load_explicit(&g_runqueue_count, memory_order_acquire);
+
+    struct sched_runqueue *result = ours;
+    enum sched_topology_level result_level = SCHED_TOPOLOGY_LEVEL_COUNT + 1;
+
+    for (uint32_t i = 0; i != count; i++) {
+        struct sched_runqueue *const runqueue = g_runqueue_list[i];
+        if (runqueue == ours ||
+            !atomic_load_explicit(&runqueue->idle, memory_order_relaxed) ||
+            atomic_load_explicit(&runqueue->count, memory_order_relaxed) != 0)
+        {
+            continue;
+        }
+
+        const enum sched_topology_level level =
+            sched_topology_shared_level(&ours->topology, &runqueue->topology);
+
+        if (level < result_level) {
+            result = runqueue;
+            result_level = level;
+
+            if (level == SCHED_TOPOLOGY_CORE) {
+                break;
+            }
+        }
+    }
+
+    return result;
+}
+
+__optimize(3) static inline usec_t
+usec_until(const nsec_t now, const nsec_t deadline) {
+    if (deadline <= now) {
+        return 1;
+    }
+
+    return div_round_up(deadline - now, (nsec_t)NANO_IN_MICRO);
+}
+
+// Rearm the timer for the end of `timeslice`, or for the next alarm if it's
+// sooner. Without another thread waiting on the run-queue, there's nothing to
+// preempt the current thread for, so an idle cpu, or one running a single
+// thread, only arms its timer for the next alarm, and leaves it off if there's
+// none.
+
+static void
+rearm_timer(struct sched_runqueue *const runqueue, const usec_t timeslice) {
+    // Stop the tick before checking for waiting threads, so a thread enqueued
+    // in between sees the tick as stopped and rearms it.
+
+    atomic_store(&runqueue->tick_stopped, true);
+
+    usec_t usec = UINT64_MAX;
+    if (atomic_load(&runqueue->count) != 0) {
+        atomic_store(&runqueue->tick_stopped, false);
+        usec = timeslice;
+    }
+
+    const nsec_t now = nsec_since_boot();
+    const nsec_t deadline = sched_alarm_next_deadline();
+
+    if (deadline != SCHED_ALARM_TICK_INVALID) {
+        usec = min(usec, usec_until(now, deadline));
+    }
+
+    if (usec == UINT64_MAX) {
+        runqueue->timer_deadline = UINT64_MAX;
+        sched_timer_stop();
+
+        return;
+    }
+
+    nsec_t timer_deadline = 0;
+    if (__builtin_mul_overflow(usec, (nsec_t)NANO_IN_MICRO, &timer_deadline) ||
+        __builtin_add_overflow(timer_deadline, now, &timer_deadline))
+    {
+        timer_deadline = UINT64_MAX;
+    }
+
+    runqueue->timer_deadline = timer_deadline;
+    sched_timer_oneshot(usec);
+}
+
+void sched_arm_timer_by(const nsec_t deadline) {
+    struct sched_runqueue *const runqueue = &this_cpu_mut()->runqueue;
+    if (deadline >= runqueue->timer_deadline) {
+        return;
+    }
+
+    // Only the alarm's deadline is new, so the rest of the timer's state,
+    // including whether the tick is stopped, stays as it is.
+
+    const nsec_t now = nsec_since_boot();
 
-void sched_next(struct scheduler *const sched) {
+    runqueue->timer_deadline = deadline;
+    sched_timer_oneshot(usec_until(now, deadline));
+}
+
+// Returns the cpu that has to be interrupted for `thread` to run, or NULL if
+// none has to be. Called with irqs disabled.
+
+static struct cpu_info *
+enqueue_thread(struct sched_runqueue *const ours, struct thread *const thread) {
+    struct sched_thread_info *const info = &thread->sched_info;
+
+    // Undo a dequeue of a thread that's still running. Its cpu may be waiting
+    // for an interrupt, see events_await().
+
+    enum sched_thread_state state = SCHED_THREAD_STATE_STOPPING;
+    if (atomic_compare_exchange_strong(&info->state,
+                                       &state,
+                                       SCHED_THREAD_STATE_RUNNING))
+    {
+        return thread->cpu;
+    }
+
+    // Claim the thread, so only one cpu ever enqueues it.
+    state = SCHED_THREAD_STATE_NONE;
+    if (!atomic_compare_exchange_strong(&info->state,
+                                        &state,
+                                        SCHED_THREAD_STATE_RUNNABLE))
+    {
+        return NULL;
+    }
+
+    struct sched_runqueue *const runqueue = select_runqueue(ours);
+    spin_acquire(&runqueue->lock);
+
+    runqueue_add(runqueue, thread);
+    spin_release(&runqueue->lock);
+
+    return runqueue->cpu;
+}
+
+void
+sched_enqueue_thread_list(struct thread *const *const thread_list,
+                          const uint32_t count)
+{
+    const bool flag = disable_all_irqs_if_not();
+    struct sched_runqueue *const ours = &this_cpu_mut()->runqueue;
+
+    struct cpu_info *kick_list[SCHED_ENQUEUE_KICK_MAX];
+    uint32_t kick_count = 0;
+    bool restart_tick = false;
+
+    for (uint32_t i = 0; i != count; i++) {
+        struct cpu_info *const cpu = enqueue_thread(ours, thread_list[i]);
+        if (cpu == NULL) {
+            continue;
+        }
+
+        if (cpu == ours->cpu) {
+            restart_tick = true;
+            continue;
+        }
+
+        bool found = false;
+        for (uint32_t j = 0; j != kick_count; j++) {
+            if (kick_list[j] == cpu) {
+                found = true;
+                break;
+            }
+        }
+
+        if (found) {
+            continue;
+        }
+
+        if (kick_count == SCHED_ENQUEUE_KICK_MAX) {
+            for (uint32_t j = 0; j != kick_count; j++) {
+                sched_send_ipi(kick_list[j]);
+            }
+
+            kick_count = 0;
+        }
+
+        kick_list[kick_count] = cpu;
+        kick_count++;
+    }
+
+    // Wake up the other cpus, rather than have the threads wait for their
+    // timers.
+
+    for (uint32_t i = 0; i != kick_count; i++) {
+        sched_send_ipi(kick_list[i]);
+    }
+
+    // The current thread may now have to share our cpu, so bring back the
+    // tick.
+
+    if (restart_tick && atomic_exchange(&ours->tick_stopped, false)) {
+        rearm_timer(ours, current_thread()->sched_info.timeslice);
+    }
+
+    enable_all_irqs_if_flag(flag);
+}
+
+void sched_enqueue_thread(struct thread *const thread) {
+    sched_enqueue_thread_list(&thread, /*count=*/1);
+}
+
+void sched_dequeue_thread(struct thread *const thread) {
+    struct sched_thread_info *const info = &thread->sched_info;
+    while (true) {
+        enum sched_thread_state state = atomic_load(&info->state);
+        switch (state) {
+            case SCHED_THREAD_STATE_NONE:
+            case SCHED_THREAD_STATE_STOPPING:
+                return;
+            case SCHED_THREAD_STATE_RUNNING:
+                if (atomic_compare_exchange_strong(&info->state,
+                                                   &state,
+                                                   SCHED_THREAD_STATE_STOPPING))
+                {
+                    return;
+                }
+
+                continue;
+            case SCHED_THREAD_STATE_RUNNABLE:
+                break;
+        }
+
+        // The thread may be stolen by another cpu before we take its
+        // run-queue's lock, or not be on a run-queue yet if it was only just
+        // claimed, so check again once the lock is held.
+
+        struct sched_runqueue *const runqueue = info->runqueue;
+        if (runqueue == NULL) {
+            cpu_pause();
+            continue;
+        }
+
+        const int flag = spin_acquire_with_irq(&runqueue->lock);
+        if (info->runqueue == runqueue) {
+            runqueue_remove(runqueue, thread);
+            atomic_store(&info->state, SCHED_THREAD_STATE_NONE);
+
+            spin_release_with_irq(&runqueue->lock, flag);
+            return;
+        }
+
+        spin_release_with_irq(&runqueue->lock, flag);
+    }
+}
+
+// Put the thread we're switching away from back on our run-queue, unless it
+// was dequeued while running.
+
+static void
+requeue_prev(struct sched_runqueue *const runqueue, struct thread *const prev) {
+    struct sched_thread_info *const info = &prev->sched_info;
+    enum sched_thread_state state = atomic_load(&info->state);
+    enum sched_thread_state new_state = SCHED_THREAD_STATE_NONE;
+
+    // Retry, as the thread may be enqueued again by another cpu as it stops.
+    do {
+        new_state =
+            state == SCHED_THREAD_STATE_RUNNING ?
+                SCHED_THREAD_STATE_RUNNABLE : SCHED_THREAD_STATE_NONE;
+    } while (!atomic_compare_exchange_weak(&info->state, &state, new_state));
+
+    if (new_state == SCHED_THREAD_STATE_NONE) {
+        return;
+    }
+
+    const int flag = spin_acquire_with_irq(&runqueue->lock);
+
+    runqueue_add(runqueue, prev);
+    spin_release_with_irq(&runqueue->lock, flag);
+}
+
+void sched_next(struct scheduler *const sched, irq_context_t *const frame) {
     (void)sched;
 
-    struct thread *const thread = current_thread();
-    if (thread->premption_disabled) {
+    struct thread *const prev = current_thread();
+    struct cpu_info *const cpu = prev->cpu;
+    struct sched_runqueue *const runqueue = &cpu->runqueue;
+
+    // We're on the current thread's stack now, so the thread we last switched
+    // away from can finally be run by other cpus.
+
+    if (runqueue->switched_from != NULL) {
+        atomic_store(&runqueue->switched_from->sched_info.on_cpu, false);
+        runqueue->switched_from = NULL;
+    }
+
+    // Alarms usually wake threads up, so fire them before picking the next
+    // thread.
+
+    sched_alarm_run();
+
+    if (prev->premption_disabled) {
         sched_irq_eoi();
-        sched_timer_oneshot(thread->sched_info.timeslice);
+        rearm_timer(runqueue, prev->sched_info.timeslice);
 
         return;
     }
-}
\ No newline at end of file
+
+    struct thread *next = runqueue_take(runqueue, /*from_back=*/false);
+    if (next == NULL) {
+        next = steal_thread(runqueue);
+    }
+
+    // With nothing else to run, keep running the current thread, even if it
+    // was dequeued.
+
+    if (next == NULL) {
+        const bool idle =
+            prev == cpu->idle_thread ||
+            atomic_load(&prev->sched_info.state) != SCHED_THREAD_STATE_RUNNING;
+
+        atomic_store_explicit(&runqueue->idle, idle, memory_order_relaxed);
+
+        sched_irq_eoi();
+        rearm_timer(runqueue, prev->sched_info.timeslice);
+
+        return;
+    }
+
+    // Save the current thread's registers before it can be taken by another
+    // cpu, which can't run it until we're off of its stack anyways.
+
+    prev->context = *frame;
+    runqueue->switched_from = prev;
+
+    if (prev != cpu->idle_thread) {
+        requeue_prev(runqueue, prev);
+    }
+
+    atomic_store(&next->sched_info.on_cpu, true);
+    atomic_store(&next->sched_info.state, SCHED_THREAD_STATE_RUNNING);
+    atomic_store_explicit(&runqueue->idle,
+                          next == cpu->idle_thread,
+                          memory_order_relaxed);
+
+    next->cpu = cpu;
+    if (next->process->pagemap != cpu->pagemap) {
+        switch_to_pagemap(next->process->pagemap);
+    }
+
+    set_current_thread(next);
+    *frame = next->context;
+
+    sched_irq_eoi();
+    rearm_timer(runqueue, next->sched_info.timeslice);
+}
+
+void sched_yield() {
+    if (current_thread()->premption_disabled) {
+        return;
+    }
+
+    // The switch happens in the scheduler's interrupt, as it needs the
+    // interrupted thread's frame.
+
+    sched_send_self_ipi();
+}
@@ -4,6 +4,8 @@
  */
 
 #pragma once
+#include "asm/irq_context.h"
+#include "lib/time.h"
 
 enum scheduler_kind {
     SCHED_KIND_SIMPLE
@@ -14,10 +16,39 @@ struct scheduler {
 };
 
 void sched_init(struct scheduler *sched);
-void sched_next(struct scheduler *sched);
+
+struct cpu_info;
+
+// Setup the cpu's run-queue, and let other cpus steal from it. Must be called
+// on every cpu before it schedules.
+
+void sched_init_cpu(struct cpu_info *cpu);
+
+// Called from the scheduler's interrupt with the interrupted thread's `frame`.
+// Switches to the next runnable thread, if any, by swapping `frame` with the
+// next thread's saved context, and rearms the timer for its timeslice.
+
+void sched_next(struct scheduler *sched, irq_context_t *frame);
 void sched_yield();
 
+// Arm the current cpu's timer for `deadline`, if it's stopped or would go off
+// later, so an alarm that was just posted isn't missed. Called with irqs
+// disabled.
+
+void sched_arm_timer_by(nsec_t deadline);
+
 struct thread;
 
+// Threads are enqueued on the current cpu's run-queue, or an idle cpu's close
+// to it. Dequeueing a thread removes it from whichever run-queue it's on, and
+// if it's running, stops it from being enqueued again once it's switched away
+// from.
+
 void sched_enqueue_thread(struct thread *thread);
 void sched_dequeue_thread(struct thread *thread);
+
+// Enqueue every thread of `thread_list`, interrupting every other cpu that has
+// to run one of them only once.
+
+void
+sched_enqueue_thread_list(struct thread *const *thread_list, uint32_t count);
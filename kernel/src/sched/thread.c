@@ -4,12 +4,16 @@
  */
 
 #include "cpu/cpu_info.h"
+#include "mm/kmem_cache.h"
+
 #include "thread.h"
 
+static struct kmem_cache g_thread_cache;
+
 __hidden struct thread kernel_main_thread = {
     .process = &kernel_process,
     .cpu = &g_base_cpu_info,
-    .events_hearing = ARRAY_INIT(sizeof(struct event *)),
+    .wake_event_index = -1,
     .sched_info = SCHED_THREAD_INFO_INIT(),
     .premption_disabled = false
 };
@@ -26,4 +30,32 @@ __optimize(3) void prempt_enable() {
     assert(thread != thread->cpu->idle_thread);
 
     thread->premption_disabled = false;
-}
\ No newline at end of file
+}
+
+static void thread_ctor(void *const object) {
+    struct thread *const thread = (struct thread *)object;
+
+    thread->wake_event_index = -1;
+    thread->sched_info = SCHED_THREAD_INFO_INIT();
+    thread->premption_disabled = false;
+}
+
+void thread_cache_init() {
+    assert(kmem_cache_init(&g_thread_cache,
+                           "thread",
+                           sizeof(struct thread),
+                           _Alignof(struct thread),
+                           thread_ctor,
+                           /*flags=*/0));
+}
+
+__optimize(3) struct thread *thread_alloc() {
+    return kmem_cache_alloc(&g_thread_cache);
+}
+
+__optimize(3) void thread_free(struct thread *const thread) {
+    // Return the thread to its constructed state before freeing.
+    thread_ctor(thread);
+
+    kmem_cache_free(&g_thread_cache, thread);
+}
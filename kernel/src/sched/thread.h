@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "asm/irq_context.h"
 #include "cpu/info.h"
 
 #include "info.h"
@@ -16,12 +17,26 @@ struct thread {
 
     bool premption_disabled : 1;
 
-    struct array events_hearing;
+    // Index of the event that woke the thread up from events_await(), or -1
+    // while it's still waiting.
+
+    _Atomic int64_t wake_event_index;
     struct sched_thread_info sched_info;
+
+    // Registers of the thread as of when it was last switched away from, see
+    // sched_next().
+
+    irq_context_t context;
 };
 
 extern struct thread kernel_main_thread;
 struct thread *current_thread();
+void set_current_thread(struct thread *thread);
+
+void thread_cache_init();
+
+struct thread *thread_alloc();
+void thread_free(struct thread *thread);
 
 void prempt_disable();
 void prempt_enable();
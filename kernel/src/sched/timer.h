@@ -7,4 +7,4 @@
 #include "lib/time.h"
 
 void sched_timer_oneshot(usec_t usec);
-void sched_irq_eoi();
+void sched_timer_stop();
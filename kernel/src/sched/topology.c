@@ -0,0 +1,94 @@
+/*
+ * kernel/src/sched/topology.c
+ * © suhas pai
+ */
+
+#include "cpu/info.h"
+#include "dev/printk.h"
+
+#include "topology.h"
+
+struct sched_topology_cpu {
+    uint32_t acpi_processor_id;
+    struct sched_topology topology;
+};
+
+static struct sched_topology_cpu g_topology_list[SCHED_TOPOLOGY_CPU_MAX];
+static uint16_t g_topology_count = 0;
+
+bool
+sched_topology_add_cpu(const uint32_t acpi_processor_id,
+                       const struct sched_topology *const topology)
+{
+    if (__builtin_expect(g_topology_count == SCHED_TOPOLOGY_CPU_MAX, 0)) {
+        printk(LOGLEVEL_WARN,
+               "sched: too many cpus, ignoring topology of cpu %" PRIu32 "\n",
+               acpi_processor_id);
+        return false;
+    }
+
+    g_topology_list[g_topology_count] = (struct sched_topology_cpu){
+        .acpi_processor_id = acpi_processor_id,
+        .topology = *topology
+    };
+
+    g_topology_count++;
+    return true;
+}
+
+static bool
+get_acpi_processor_id(const struct cpu_info *const cpu, uint32_t *const id_out)
+{
+#if defined(__x86_64__)
+    *id_out = cpu->processor_id;
+    return true;
+#elif defined(__aarch64__)
+    *id_out = cpu->acpi_processor_id;
+    return true;
+#else
+    // RHCT doesn't describe the hierarchy of harts, so riscv64 only gets a
+    // topology from PPTT, and the cpu-info doesn't keep the processor uid yet.
+
+    (void)cpu;
+    (void)id_out;
+
+    return false;
+#endif /* defined(__x86_64__) */
+}
+
+void
+sched_topology_find_cpu(const struct cpu_info *const cpu,
+                        struct sched_topology *const topology_out)
+{
+    uint32_t acpi_processor_id = 0;
+    if (get_acpi_processor_id(cpu, &acpi_processor_id)) {
+        for (uint16_t i = 0; i != g_topology_count; i++) {
+            const struct sched_topology_cpu *const iter = &g_topology_list[i];
+            if (iter->acpi_processor_id == acpi_processor_id) {
+                *topology_out = iter->topology;
+                return;
+            }
+        }
+    }
+
+    topology_out->id_list[SCHED_TOPOLOGY_CORE] = SCHED_TOPOLOGY_ID_NONE;
+    topology_out->id_list[SCHED_TOPOLOGY_CACHE] = SCHED_TOPOLOGY_ID_NONE;
+    topology_out->id_list[SCHED_TOPOLOGY_PACKAGE] = 0;
+}
+
+__optimize(3) enum sched_topology_level
+sched_topology_shared_level(const struct sched_topology *const ours,
+                            const struct sched_topology *const theirs)
+{
+    for (enum sched_topology_level level = SCHED_TOPOLOGY_CORE;
+         level != SCHED_TOPOLOGY_LEVEL_COUNT;
+         level++)
+    {
+        const uint32_t id = ours->id_list[level];
+        if (id != SCHED_TOPOLOGY_ID_NONE && id == theirs->id_list[level]) {
+            return level;
+        }
+    }
+
+    return SCHED_TOPOLOGY_LEVEL_COUNT;
+}
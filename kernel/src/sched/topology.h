@@ -0,0 +1,55 @@
+/*
+ * kernel/src/sched/topology.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCHED_TOPOLOGY_CPU_MAX 256
+#define SCHED_TOPOLOGY_ID_NONE UINT32_MAX
+
+// Levels of the cpu hierarchy, from the closest to the farthest. Moving a
+// thread between cpus that share a closer level keeps more of its cache.
+
+enum sched_topology_level {
+    // Hardware threads of a single core, sharing every cache.
+    SCHED_TOPOLOGY_CORE,
+
+    // Cores sharing a cache above their private ones, e.g. an l2 cluster or an
+    // l3.
+
+    SCHED_TOPOLOGY_CACHE,
+    SCHED_TOPOLOGY_PACKAGE,
+
+    // Returned for cpus that share no level at all.
+    SCHED_TOPOLOGY_LEVEL_COUNT
+};
+
+// Every id is only meaningful when compared with the same level of another
+// cpu's topology. Ids that aren't known are SCHED_TOPOLOGY_ID_NONE, and never
+// match.
+
+struct sched_topology {
+    uint32_t id_list[SCHED_TOPOLOGY_LEVEL_COUNT];
+};
+
+// Called by the PPTT parser from acpi_init(), before any cpu schedules.
+bool
+sched_topology_add_cpu(uint32_t acpi_processor_id,
+                       const struct sched_topology *topology);
+
+struct cpu_info;
+
+// Find the topology of `cpu`. Without PPTT, every cpu is placed in a single
+// package, with no core or cache shared with any other cpu.
+
+void
+sched_topology_find_cpu(const struct cpu_info *cpu,
+                        struct sched_topology *topology_out);
+
+enum sched_topology_level
+sched_topology_shared_level(const struct sched_topology *ours,
+                            const struct sched_topology *theirs);
@@ -25,7 +25,7 @@ struct addrspace_node *addrspace_node_prev(struct addrspace_node *const node) {
 
 __optimize(3)
 struct addrspace_node *addrspace_node_next(struct addrspace_node *const node) {
-    if (node->list.prev == &node->addrspace->list) {
+    if (node->list.next == &node->addrspace->list) {
         return NULL;
     }
 
@@ -322,10 +322,65 @@ addrspace_add_node(struct address_space *const addrspace,
                        /*added_node=*/add_node_cb);
 }
 
+// The next node's gap to its previous node changes whenever the node before it
+// is removed or resized, so update it and every node above it.
+
+__optimize(3) static void update_up_from(struct addrspace_node *const node) {
+    struct avlnode *iter = &node->avlnode;
+    do {
+        avltree_update(iter);
+        iter = iter->parent;
+    } while (iter != NULL);
+}
+
 void addrspace_remove_node(struct addrspace_node *const node) {
+    struct addrspace_node *const next = addrspace_node_next(node);
+
+    list_delete(&node->list);
     avltree_delete_node(&node->addrspace->avltree,
                         &node->avlnode,
                         avltree_update);
+
+    if (next != NULL) {
+        update_up_from(next);
+    }
+}
+
+__optimize(3) struct addrspace_node *
+addrspace_find_node(struct address_space *const addrspace, const uint64_t loc) {
+    struct avlnode *avlnode = addrspace->avltree.root;
+    while (avlnode != NULL) {
+        struct addrspace_node *const node = addrspace_node_of(avlnode);
+        if (loc < node->range.front) {
+            avlnode = avlnode->left;
+        } else if (loc >= range_get_end_assert(node->range)) {
+            avlnode = avlnode->right;
+        } else {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+bool
+addrspace_resize_node(struct addrspace_node *const node, const uint64_t size) {
+    uint64_t end = 0;
+    if (!check_add(node->range.front, size, &end)) {
+        return false;
+    }
+
+    struct addrspace_node *const next = addrspace_node_next(node);
+    if (next != NULL && end > next->range.front) {
+        return false;
+    }
+
+    node->range.size = size;
+    if (next != NULL) {
+        update_up_from(next);
+    }
+
+    return true;
 }
 
 __optimize(3)
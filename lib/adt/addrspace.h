@@ -62,4 +62,14 @@ addrspace_add_node(struct address_space *addrspace,
                    struct addrspace_node *node);
 
 void addrspace_remove_node(struct addrspace_node *node);
+
+// Returns the node whose range contains `loc`, or NULL if there is none.
+
+struct addrspace_node *
+addrspace_find_node(struct address_space *addrspace, uint64_t loc);
+
+// Change the size of the node's range while keeping its front. Fails if the
+// new range would overlap the next node.
+
+bool addrspace_resize_node(struct addrspace_node *node, uint64_t size);
 void addrspace_print(struct address_space *addrspace);
@@ -0,0 +1,711 @@
+/*
+ * lib/adt/range_tree.c
+ * © suhas pai
+ */
+
+#include "lib/align.h"
+#include "lib/alloc.h"
+#include "lib/assert.h"
+#include "lib/overflow.h"
+#include "lib/string.h"
+
+#include "range_tree.h"
+
+// Every node but the root keeps at least this many entries.
+#define MIN_COUNT (RANGE_TREE_SLOT_COUNT / 2)
+
+// Deep enough for far more entries than fit in a 64-bit address space.
+#define MAX_HEIGHT 24
+
+_Static_assert(sizeof(struct range_tree_node) <= 512,
+               "struct range_tree_node should fit in a 512-byte allocation");
+
+__optimize(3) static inline uint64_t range_end(const struct range range) {
+    return range.front + range.size;
+}
+
+__optimize(3) static inline
+struct range_tree_node *child_at(const struct range_tree_node *const node,
+                                 const uint8_t index)
+{
+    return (struct range_tree_node *)node->slots[index];
+}
+
+__optimize(3)
+static struct range node_span(const struct range_tree_node *const node) {
+    const uint64_t front = node->ranges[0].front;
+    const uint64_t end = range_end(node->ranges[node->count - 1]);
+
+    return RANGE_INIT(front, end - front);
+}
+
+__optimize(3)
+static uint64_t node_largest_gap(const struct range_tree_node *const node) {
+    uint64_t gap = node->is_leaf ? 0 : node->gaps[0];
+    for (uint8_t i = 1; i != node->count; i++) {
+        gap = max(gap, node->ranges[i].front - range_end(node->ranges[i - 1]));
+        if (!node->is_leaf) {
+            gap = max(gap, node->gaps[i]);
+        }
+    }
+
+    return gap;
+}
+
+__optimize(3)
+static uint8_t index_in_parent(const struct range_tree_node *const node) {
+    const struct range_tree_node *const parent = node->parent;
+    for (uint8_t i = 0; i != parent->count; i++) {
+        if (parent->slots[i] == node) {
+            return i;
+        }
+    }
+
+    verify_not_reached();
+}
+
+// Store the span and largest gap of `node` in its parent.
+
+__optimize(3) static void update_in_parent(struct range_tree_node *const node) {
+    struct range_tree_node *const parent = node->parent;
+    const uint8_t index = index_in_parent(node);
+
+    parent->ranges[index] = node_span(node);
+    parent->gaps[index] = node_largest_gap(node);
+}
+
+__optimize(3) static void update_up(struct range_tree_node *node) {
+    while (node->parent != NULL) {
+        update_in_parent(node);
+        node = node->parent;
+    }
+}
+
+// Returns the index of the first entry whose front is above `key`.
+
+__optimize(3) static uint8_t
+upper_bound(const struct range_tree_node *const node, const uint64_t key) {
+    uint8_t index = 0;
+    while (index != node->count && node->ranges[index].front <= key) {
+        index++;
+    }
+
+    return index;
+}
+
+// Descend to the leaf whose entries `key` falls between. The leaf's first entry
+// starts at or below `key`, unless the leaf is the leftmost one.
+
+__optimize(3) static struct range_tree_node *
+find_leaf(const struct range_tree *const tree, const uint64_t key) {
+    struct range_tree_node *node = tree->root;
+    while (!node->is_leaf) {
+        const uint8_t index = upper_bound(node, key);
+        node = child_at(node, index != 0 ? index - 1 : 0);
+    }
+
+    return node;
+}
+
+static void
+move_entries(struct range_tree_node *const dst,
+             const uint8_t dst_index,
+             const struct range_tree_node *const src,
+             const uint8_t src_index,
+             const uint8_t count)
+{
+    memcpy(dst->ranges + dst_index,
+           src->ranges + src_index,
+           sizeof(struct range) * count);
+    memcpy(dst->gaps + dst_index,
+           src->gaps + src_index,
+           sizeof(uint64_t) * count);
+    memcpy(dst->slots + dst_index,
+           src->slots + src_index,
+           sizeof(void *) * count);
+
+    if (!dst->is_leaf) {
+        for (uint8_t i = dst_index; i != dst_index + count; i++) {
+            child_at(dst, i)->parent = dst;
+        }
+    }
+}
+
+// Move the entries at and after `index` up by `amount`.
+
+static void
+make_room(struct range_tree_node *const node,
+          const uint8_t index,
+          const uint8_t amount)
+{
+    const uint8_t count = node->count - index;
+
+    memmove(node->ranges + index + amount,
+            node->ranges + index,
+            sizeof(struct range) * count);
+    memmove(node->gaps + index + amount,
+            node->gaps + index,
+            sizeof(uint64_t) * count);
+    memmove(node->slots + index + amount,
+            node->slots + index,
+            sizeof(void *) * count);
+
+    node->count += amount;
+}
+
+// Remove `amount` entries at `index`, moving the entries after them down.
+
+static void
+close_gap(struct range_tree_node *const node,
+          const uint8_t index,
+          const uint8_t amount)
+{
+    const uint8_t count = node->count - index - amount;
+
+    memmove(node->ranges + index,
+            node->ranges + index + amount,
+            sizeof(struct range) * count);
+    memmove(node->gaps + index,
+            node->gaps + index + amount,
+            sizeof(uint64_t) * count);
+    memmove(node->slots + index,
+            node->slots + index + amount,
+            sizeof(void *) * count);
+
+    node->count -= amount;
+}
+
+static void
+insert_entry(struct range_tree_node *const node,
+             const uint8_t index,
+             const struct range range,
+             const uint64_t gap,
+             void *const slot)
+{
+    make_room(node, index, /*amount=*/1);
+
+    node->ranges[index] = range;
+    node->gaps[index] = gap;
+    node->slots[index] = slot;
+
+    if (!node->is_leaf) {
+        ((struct range_tree_node *)slot)->parent = node;
+    }
+}
+
+// Splitting a full node inserts into its parent, which may split in turn. Every
+// node an insert needs is allocated up front, so a failed allocation leaves the
+// tree unchanged.
+
+struct node_pool {
+    struct range_tree_node *nodes[MAX_HEIGHT + 1];
+    uint8_t count;
+};
+
+static bool
+fill_pool(struct node_pool *const pool, const struct range_tree_node *node) {
+    uint8_t needed = 0;
+    while (node->count == RANGE_TREE_SLOT_COUNT) {
+        needed++;
+        if (node->parent == NULL) {
+            // A new root is needed as well.
+            needed++;
+            break;
+        }
+
+        node = node->parent;
+    }
+
+    assert(needed <= countof(pool->nodes));
+    for (pool->count = 0; pool->count != needed; pool->count++) {
+        struct range_tree_node *const new_node =
+            malloc(sizeof(struct range_tree_node));
+
+        if (new_node == NULL) {
+            for (uint8_t i = 0; i != pool->count; i++) {
+                free(pool->nodes[i]);
+            }
+
+            return false;
+        }
+
+        pool->nodes[pool->count] = new_node;
+    }
+
+    return true;
+}
+
+static void
+init_node(struct range_tree_node *const node,
+          struct range_tree_node *const parent,
+          const bool is_leaf)
+{
+    node->parent = parent;
+    node->prev = NULL;
+    node->next = NULL;
+    node->count = 0;
+    node->is_leaf = is_leaf;
+}
+
+static struct range_tree_node *
+take_node(struct node_pool *const pool,
+          struct range_tree_node *const parent,
+          const bool is_leaf)
+{
+    assert(pool->count != 0);
+
+    pool->count--;
+    struct range_tree_node *const node = pool->nodes[pool->count];
+
+    init_node(node, parent, is_leaf);
+    return node;
+}
+
+static void
+insert_at(struct range_tree *const tree,
+          struct range_tree_node *const node,
+          const uint8_t index,
+          const struct range range,
+          const uint64_t gap,
+          void *const slot,
+          struct node_pool *const pool)
+{
+    if (node->count != RANGE_TREE_SLOT_COUNT) {
+        insert_entry(node, index, range, gap, slot);
+        update_up(node);
+
+        return;
+    }
+
+    // Split the node in half, moving its upper half to a new right sibling.
+
+    const uint8_t split = RANGE_TREE_SLOT_COUNT / 2;
+    struct range_tree_node *const right =
+        take_node(pool, node->parent, node->is_leaf);
+
+    move_entries(right,
+                 /*dst_index=*/0,
+                 node,
+                 split,
+                 RANGE_TREE_SLOT_COUNT - split);
+
+    right->count = RANGE_TREE_SLOT_COUNT - split;
+    node->count = split;
+
+    if (node->is_leaf) {
+        right->prev = node;
+        right->next = node->next;
+
+        if (node->next != NULL) {
+            node->next->prev = right;
+        }
+
+        node->next = right;
+    }
+
+    if (index <= split) {
+        insert_entry(node, index, range, gap, slot);
+    } else {
+        insert_entry(right, index - split, range, gap, slot);
+    }
+
+    struct range_tree_node *const parent = node->parent;
+    if (parent == NULL) {
+        struct range_tree_node *const root =
+            take_node(pool, /*parent=*/NULL, /*is_leaf=*/false);
+
+        insert_entry(root, 0, node_span(node), node_largest_gap(node), node);
+        insert_entry(root, 1, node_span(right), node_largest_gap(right), right);
+
+        tree->root = root;
+        return;
+    }
+
+    update_in_parent(node);
+    insert_at(tree,
+              parent,
+              index_in_parent(node) + 1,
+              node_span(right),
+              node_largest_gap(right),
+              right,
+              pool);
+}
+
+bool
+range_tree_insert(struct range_tree *const tree,
+                  const struct range range,
+                  void *const value)
+{
+    assert(value != NULL);
+
+    uint64_t end = 0;
+    if (range.size == 0 || !check_add(range.front, range.size, &end)) {
+        return false;
+    }
+
+    if (tree->root == NULL) {
+        struct range_tree_node *const root = malloc(sizeof(*root));
+        if (root == NULL) {
+            return false;
+        }
+
+        init_node(root, /*parent=*/NULL, /*is_leaf=*/true);
+        insert_entry(root, /*index=*/0, range, /*gap=*/0, value);
+
+        tree->root = root;
+        tree->count = 1;
+
+        return true;
+    }
+
+    struct range_tree_node *const leaf = find_leaf(tree, range.front);
+    const uint8_t index = upper_bound(leaf, range.front);
+
+    if (index != 0 && range_end(leaf->ranges[index - 1]) > range.front) {
+        return false;
+    }
+
+    if (index != leaf->count) {
+        if (leaf->ranges[index].front < end) {
+            return false;
+        }
+    } else if (leaf->next != NULL && leaf->next->ranges[0].front < end) {
+        return false;
+    }
+
+    struct node_pool pool;
+    if (!fill_pool(&pool, leaf)) {
+        return false;
+    }
+
+    insert_at(tree, leaf, index, range, /*gap=*/0, value, &pool);
+    tree->count++;
+
+    assert(pool.count == 0);
+    return true;
+}
+
+struct space_search {
+    struct range in_range;
+    uint64_t in_end;
+
+    uint64_t size;
+    uint64_t align;
+
+    // End of the last entry passed, where the next hole begins.
+    uint64_t prev_end;
+};
+
+enum search_result {
+    SEARCH_FOUND,
+    SEARCH_CONTINUE,
+    SEARCH_FAILED,
+};
+
+// Check the hole between the last entry passed and `next_front`.
+
+__optimize(3) static bool
+check_hole(const struct space_search *const search,
+           const uint64_t next_front,
+           uint64_t *const result_out)
+{
+    const uint64_t front = max(search->prev_end, search->in_range.front);
+    const uint64_t limit = min(next_front, search->in_end);
+
+    uint64_t aligned = 0;
+    if (front >= limit || !align_up(front, search->align, &aligned)) {
+        return false;
+    }
+
+    if (aligned > limit || limit - aligned < search->size) {
+        return false;
+    }
+
+    *result_out = aligned;
+    return true;
+}
+
+static enum search_result
+search_node(const struct range_tree_node *const node,
+            struct space_search *const search,
+            uint64_t *const result_out)
+{
+    for (uint8_t i = 0; i != node->count; i++) {
+        const struct range range = node->ranges[i];
+        if (check_hole(search, range.front, result_out)) {
+            return SEARCH_FOUND;
+        }
+
+        if (range.front >= search->in_end) {
+            return SEARCH_FAILED;
+        }
+
+        // Only descend into children that have a large enough gap between
+        // their entries, and that end inside in_range.
+
+        if (!node->is_leaf &&
+            node->gaps[i] >= search->size &&
+            range_end(range) > search->in_range.front)
+        {
+            const enum search_result result =
+                search_node(child_at(node, i), search, result_out);
+
+            if (result != SEARCH_CONTINUE) {
+                return result;
+            }
+        }
+
+        search->prev_end = range_end(range);
+        if (search->prev_end >= search->in_end) {
+            return SEARCH_FAILED;
+        }
+    }
+
+    return SEARCH_CONTINUE;
+}
+
+uint64_t
+range_tree_find_space(const struct range_tree *const tree,
+                      const struct range in_range,
+                      const uint64_t size,
+                      const uint64_t align)
+{
+    assert((align & (align - 1)) == 0);
+    if (size == 0) {
+        return RANGE_TREE_INVALID_ADDR;
+    }
+
+    struct space_search search = {
+        .in_range = in_range,
+        .in_end = UINT64_MAX,
+        .size = size,
+        .align = align != 0 ? align : 1,
+        .prev_end = 0
+    };
+
+    // An in_range that reaches the end of the address-space is capped at
+    // UINT64_MAX, which is never a valid address anyways.
+
+    if (!check_add(in_range.front, in_range.size, &search.in_end)) {
+        search.in_end = UINT64_MAX;
+    }
+
+    uint64_t result = RANGE_TREE_INVALID_ADDR;
+    if (tree->root != NULL) {
+        switch (search_node(tree->root, &search, &result)) {
+            case SEARCH_FOUND:
+                return result;
+            case SEARCH_FAILED:
+                return RANGE_TREE_INVALID_ADDR;
+            case SEARCH_CONTINUE:
+                break;
+        }
+    }
+
+    // Check the hole after the last entry.
+    if (!check_hole(&search, UINT64_MAX, &result)) {
+        return RANGE_TREE_INVALID_ADDR;
+    }
+
+    return result;
+}
+
+uint64_t
+range_tree_find_space_and_insert(struct range_tree *const tree,
+                                 const struct range in_range,
+                                 const uint64_t size,
+                                 const uint64_t align,
+                                 void *const value)
+{
+    const uint64_t addr = range_tree_find_space(tree, in_range, size, align);
+    if (addr == RANGE_TREE_INVALID_ADDR) {
+        return RANGE_TREE_INVALID_ADDR;
+    }
+
+    if (!range_tree_insert(tree, RANGE_INIT(addr, size), value)) {
+        return RANGE_TREE_INVALID_ADDR;
+    }
+
+    return addr;
+}
+
+__optimize(3) void *
+range_tree_find(const struct range_tree *const tree,
+                const uint64_t loc,
+                struct range *const range_out)
+{
+    if (tree->root == NULL) {
+        return NULL;
+    }
+
+    const struct range_tree_node *const leaf = find_leaf(tree, loc);
+    const uint8_t index = upper_bound(leaf, loc);
+
+    if (index == 0) {
+        return NULL;
+    }
+
+    const struct range range = leaf->ranges[index - 1];
+    if (loc - range.front >= range.size) {
+        return NULL;
+    }
+
+    if (range_out != NULL) {
+        *range_out = range;
+    }
+
+    return leaf->slots[index - 1];
+}
+
+// Merge `right` into `left`, its left sibling, and remove `right` from their
+// parent.
+
+static void
+merge_nodes(struct range_tree_node *const left,
+            struct range_tree_node *const right)
+{
+    move_entries(left, left->count, right, /*src_index=*/0, right->count);
+    left->count += right->count;
+
+    if (left->is_leaf) {
+        left->next = right->next;
+        if (right->next != NULL) {
+            right->next->prev = left;
+        }
+    }
+
+    close_gap(right->parent, index_in_parent(right), /*amount=*/1);
+    free(right);
+}
+
+// Move entries between two siblings so each ends up with about half.
+
+static void
+rebalance_nodes(struct range_tree_node *const left,
+                struct range_tree_node *const right)
+{
+    const uint8_t left_count = (left->count + right->count) / 2;
+    if (left->count > left_count) {
+        const uint8_t amount = left->count - left_count;
+
+        make_room(right, /*index=*/0, amount);
+        move_entries(right, /*dst_index=*/0, left, left_count, amount);
+
+        left->count = left_count;
+    } else {
+        const uint8_t amount = left_count - left->count;
+
+        move_entries(left, left->count, right, /*src_index=*/0, amount);
+        left->count = left_count;
+
+        close_gap(right, /*index=*/0, amount);
+    }
+}
+
+static void
+fix_underflow(struct range_tree *const tree, struct range_tree_node *node) {
+    while (true) {
+        struct range_tree_node *const parent = node->parent;
+        if (parent == NULL) {
+            if (node->count == 0) {
+                free(node);
+                tree->root = NULL;
+            } else if (!node->is_leaf && node->count == 1) {
+                // Drop a root with a single child.
+                tree->root = child_at(node, 0);
+                tree->root->parent = NULL;
+
+                free(node);
+            }
+
+            return;
+        }
+
+        if (node->count >= MIN_COUNT) {
+            update_up(node);
+            return;
+        }
+
+        const uint8_t index = index_in_parent(node);
+
+        struct range_tree_node *const left =
+            index != 0 ? child_at(parent, index - 1) : node;
+        struct range_tree_node *const right =
+            index != 0 ? node : child_at(parent, 1);
+
+        if (left->count + right->count <= RANGE_TREE_SLOT_COUNT) {
+            merge_nodes(left, right);
+            update_in_parent(left);
+
+            node = parent;
+            continue;
+        }
+
+        rebalance_nodes(left, right);
+
+        update_in_parent(left);
+        update_in_parent(right);
+        update_up(parent);
+
+        return;
+    }
+}
+
+void *range_tree_remove(struct range_tree *const tree, const uint64_t front) {
+    if (tree->root == NULL) {
+        return NULL;
+    }
+
+    struct range_tree_node *const leaf = find_leaf(tree, front);
+    const uint8_t index = upper_bound(leaf, front);
+
+    if (index == 0 || leaf->ranges[index - 1].front != front) {
+        return NULL;
+    }
+
+    void *const value = leaf->slots[index - 1];
+
+    close_gap(leaf, index - 1, /*amount=*/1);
+    tree->count--;
+
+    fix_underflow(tree, leaf);
+    return value;
+}
+
+static void destroy_node(struct range_tree_node *const node) {
+    if (!node->is_leaf) {
+        for (uint8_t i = 0; i != node->count; i++) {
+            destroy_node(child_at(node, i));
+        }
+    }
+
+    free(node);
+}
+
+void range_tree_destroy(struct range_tree *const tree) {
+    if (tree->root != NULL) {
+        destroy_node(tree->root);
+    }
+
+    *tree = RANGE_TREE_INIT();
+}
+
+__optimize(3)
+struct range_tree_iter range_tree_begin(const struct range_tree *const tree) {
+    struct range_tree_node *node = tree->root;
+    if (node != NULL) {
+        while (!node->is_leaf) {
+            node = child_at(node, 0);
+        }
+    }
+
+    return (struct range_tree_iter){ .leaf = node, .index = 0 };
+}
+
+__optimize(3) void range_tree_iter_next(struct range_tree_iter *const iter) {
+    iter->index++;
+    if (iter->index == iter->leaf->count) {
+        iter->leaf = iter->leaf->next;
+        iter->index = 0;
+    }
+}
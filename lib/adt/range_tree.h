@@ -0,0 +1,117 @@
+/*
+ * lib/adt/range_tree.h
+ * © suhas pai
+ */
+
+#pragma once
+
+#include "lib/adt/range.h"
+#include "lib/macros.h"
+
+// A range_tree is a B+tree of non-overlapping ranges. Every node holds up to
+// RANGE_TREE_SLOT_COUNT entries inline, so a lookup reads one contiguous node
+// per level, instead of chasing one pointer per entry like an avltree does.
+//
+// Internal nodes store the span and the largest gap of each child, so finding
+// free space skips every subtree that's too full. Leaves are linked in address
+// order, which is used for iteration.
+
+#define RANGE_TREE_SLOT_COUNT 14
+
+struct range_tree_node {
+    struct range_tree_node *parent;
+
+    // Only used by leaves.
+    struct range_tree_node *prev;
+    struct range_tree_node *next;
+
+    uint8_t count;
+    bool is_leaf;
+
+    // For leaves, the range of each entry. For internal nodes, the span from
+    // the front of each child's first entry to the end of its last entry.
+
+    struct range ranges[RANGE_TREE_SLOT_COUNT];
+
+    // Only used by internal nodes, the largest gap between two entries of each
+    // child.
+
+    uint64_t gaps[RANGE_TREE_SLOT_COUNT];
+
+    // For leaves, the value of each entry. For internal nodes, each child.
+    void *slots[RANGE_TREE_SLOT_COUNT];
+};
+
+struct range_tree {
+    struct range_tree_node *root;
+    uint64_t count;
+};
+
+#define RANGE_TREE_INIT() ((struct range_tree){ .root = NULL, .count = 0 })
+#define RANGE_TREE_INVALID_ADDR UINT64_MAX
+
+// Insert `value`, which must not be NULL, at `range`. Fails if `range` is
+// empty, overflows, or overlaps another entry, or if a node couldn't be
+// allocated, in which case the tree is left unchanged.
+
+bool
+range_tree_insert(struct range_tree *tree, struct range range, void *value);
+
+// Returns the lowest address in `in_range` that's aligned to `align`, which
+// must be a power of two, and is followed by `size` free bytes, or
+// RANGE_TREE_INVALID_ADDR if there is none.
+
+uint64_t
+range_tree_find_space(const struct range_tree *tree,
+                      struct range in_range,
+                      uint64_t size,
+                      uint64_t align);
+
+uint64_t
+range_tree_find_space_and_insert(struct range_tree *tree,
+                                 struct range in_range,
+                                 uint64_t size,
+                                 uint64_t align,
+                                 void *value);
+
+// Returns the value of the entry whose range contains `loc`, or NULL if there
+// is none. The entry's range is written to `range_out` if it isn't NULL.
+
+void *
+range_tree_find(const struct range_tree *tree,
+                uint64_t loc,
+                struct range *range_out);
+
+// Remove the entry whose range starts at `front`, returning its value, or NULL
+// if there is none.
+
+void *range_tree_remove(struct range_tree *tree, uint64_t front);
+
+// Free every node of the tree. Values are left alone.
+void range_tree_destroy(struct range_tree *tree);
+
+struct range_tree_iter {
+    struct range_tree_node *leaf;
+    uint8_t index;
+};
+
+struct range_tree_iter range_tree_begin(const struct range_tree *tree);
+void range_tree_iter_next(struct range_tree_iter *iter);
+
+__optimize(3) static inline
+struct range range_tree_iter_range(const struct range_tree_iter iter) {
+    return iter.leaf->ranges[iter.index];
+}
+
+__optimize(3)
+static inline void *range_tree_iter_value(const struct range_tree_iter iter) {
+    return iter.leaf->slots[iter.index];
+}
+
+// Visits every entry in address order. The tree must not be changed during
+// iteration.
+
+#define range_tree_foreach(iter, tree) \
+    for (struct range_tree_iter iter = range_tree_begin(tree); \
+         iter.leaf != NULL;                                   \
+         range_tree_iter_next(&iter))
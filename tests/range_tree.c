@@ -0,0 +1,269 @@
+/*
+ * tests/range_tree.c
+ * © suhas pai
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lib/adt/avltree.h"
+#include "lib/adt/range_tree.h"
+
+#define TEST_ENTRY_COUNT 4096
+#define BENCH_ENTRY_COUNT 65536
+#define BENCH_LOOKUP_COUNT 4000000
+
+static uint64_t g_values[TEST_ENTRY_COUNT];
+
+static void check_tree(const struct range_tree *const tree) {
+    uint64_t count = 0;
+    uint64_t prev_end = 0;
+
+    range_tree_foreach(iter, tree) {
+        const struct range range = range_tree_iter_range(iter);
+
+        assert(range.front >= prev_end);
+        assert(range_tree_find(tree, range.front, NULL) ==
+               range_tree_iter_value(iter));
+
+        prev_end = range.front + range.size;
+        count++;
+    }
+
+    assert(count == tree->count);
+}
+
+static void test_insert_and_find() {
+    struct range_tree tree = RANGE_TREE_INIT();
+
+    // Insert every other page, in a shuffled order, so that inserts split
+    // nodes all over the tree.
+
+    for (uint64_t i = 0; i != TEST_ENTRY_COUNT; i++) {
+        const uint64_t index = (i * 2654435761ull) % TEST_ENTRY_COUNT;
+        const struct range range = RANGE_INIT(index * 0x2000, 0x1000);
+
+        g_values[index] = index;
+        assert(range_tree_insert(&tree, range, &g_values[index]));
+    }
+
+    check_tree(&tree);
+
+    assert(!range_tree_insert(&tree, RANGE_INIT(0x800, 0x1000), &g_values[0]));
+    assert(!range_tree_insert(&tree, RANGE_INIT(0x1800, 0x1000), &g_values[0]));
+    assert(!range_tree_insert(&tree, RANGE_INIT(0x1000, 0), &g_values[0]));
+
+    for (uint64_t i = 0; i != TEST_ENTRY_COUNT; i++) {
+        struct range range = RANGE_EMPTY();
+
+        assert(range_tree_find(&tree, i * 0x2000 + 0xfff, &range) ==
+               &g_values[i]);
+        assert(range.front == i * 0x2000);
+        assert(range_tree_find(&tree, i * 0x2000 + 0x1000, NULL) == NULL);
+    }
+
+    // Remove every entry in a different order than they were inserted, so
+    // nodes are both merged and rebalanced.
+
+    for (uint64_t i = 0; i != TEST_ENTRY_COUNT; i++) {
+        const uint64_t index = (i * 40503ull) % TEST_ENTRY_COUNT;
+
+        assert(range_tree_remove(&tree, index * 0x2000) == &g_values[index]);
+        assert(range_tree_remove(&tree, index * 0x2000) == NULL);
+
+        if (i % 512 == 0) {
+            check_tree(&tree);
+        }
+    }
+
+    assert(tree.root == NULL);
+    assert(tree.count == 0);
+}
+
+static void test_find_space() {
+    struct range_tree tree = RANGE_TREE_INIT();
+
+    assert(range_tree_find_space(&tree, RANGE_MAX(), 0x1000, 0x1000) == 0);
+    for (uint64_t i = 0; i != TEST_ENTRY_COUNT; i++) {
+        const uint64_t addr =
+            range_tree_find_space_and_insert(&tree,
+                                             RANGE_INIT(0x1000, UINT32_MAX),
+                                             0x1000,
+                                             0x1000,
+                                             &g_values[0]);
+
+        assert(addr == 0x1000 + i * 0x1000);
+    }
+
+    // Open up holes of increasing size, and check that each request lands in
+    // the lowest hole that fits it.
+
+    assert(range_tree_remove(&tree, 0x5000) != NULL);
+    assert(range_tree_remove(&tree, 0x100000) != NULL);
+    assert(range_tree_remove(&tree, 0x101000) != NULL);
+    assert(range_tree_remove(&tree, 0x801000) != NULL);
+    assert(range_tree_remove(&tree, 0x802000) != NULL);
+    assert(range_tree_remove(&tree, 0x803000) != NULL);
+    assert(range_tree_remove(&tree, 0x804000) != NULL);
+
+    check_tree(&tree);
+
+    const struct range in_range = RANGE_INIT(0x1000, UINT32_MAX);
+    const uint64_t end = 0x1000 + TEST_ENTRY_COUNT * 0x1000;
+
+    assert(range_tree_find_space(&tree, in_range, 0x1000, 0x1000) == 0x5000);
+    assert(range_tree_find_space(&tree, in_range, 0x2000, 0x1000) == 0x100000);
+    assert(range_tree_find_space(&tree, in_range, 0x3000, 0x1000) == 0x801000);
+    assert(range_tree_find_space(&tree, in_range, 0x4000, 0x1000) == 0x801000);
+    assert(range_tree_find_space(&tree, in_range, 0x2000, 0x2000) == 0x100000);
+    assert(range_tree_find_space(&tree, in_range, 0x3000, 0x2000) == 0x802000);
+
+    // Aligning the front of the last hole leaves too little space.
+    assert(range_tree_find_space(&tree, in_range, 0x4000, 0x4000) ==
+           end + 0x3000);
+    assert(range_tree_find_space(&tree, in_range, 0x5000, 0x1000) == end);
+
+    // Holes outside in_range must be skipped.
+    assert(range_tree_find_space(&tree,
+                                 RANGE_INIT(0x6000, UINT32_MAX),
+                                 0x1000,
+                                 0x1000) == 0x100000);
+    assert(range_tree_find_space(&tree,
+                                 RANGE_INIT(0x1000, 0x100000),
+                                 0x2000,
+                                 0x1000) == RANGE_TREE_INVALID_ADDR);
+
+    range_tree_destroy(&tree);
+    assert(tree.root == NULL);
+}
+
+// The avltree that struct address_space is currently built on, for comparison.
+
+struct bench_avlnode {
+    struct avlnode avlnode;
+    struct range range;
+};
+
+static int
+compare_bench_nodes(struct avlnode *const ours, struct avlnode *const theirs) {
+    const struct bench_avlnode *const our_node =
+        container_of(ours, struct bench_avlnode, avlnode);
+    const struct bench_avlnode *const their_node =
+        container_of(theirs, struct bench_avlnode, avlnode);
+
+    if (our_node->range.front == their_node->range.front) {
+        return 0;
+    }
+
+    return our_node->range.front < their_node->range.front ? -1 : 1;
+}
+
+static struct bench_avlnode *
+avltree_find_loc(const struct avltree *const tree, const uint64_t loc) {
+    struct avlnode *avlnode = tree->root;
+    while (avlnode != NULL) {
+        struct bench_avlnode *const node =
+            container_of(avlnode, struct bench_avlnode, avlnode);
+
+        if (loc < node->range.front) {
+            avlnode = avlnode->left;
+        } else if (loc - node->range.front >= node->range.size) {
+            avlnode = avlnode->right;
+        } else {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static double seconds_since(const struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)(now.tv_sec - start.tv_sec) +
+           (double)(now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void bench_lookups() {
+    struct avltree avltree = AVLTREE_INIT();
+    struct range_tree range_tree = RANGE_TREE_INIT();
+
+    // Allocate the avltree's nodes separately, like vm_areas are, with other
+    // allocations in between.
+
+    struct bench_avlnode **const nodes =
+        malloc(sizeof(struct bench_avlnode *) * BENCH_ENTRY_COUNT);
+    void **const padding = malloc(sizeof(void *) * BENCH_ENTRY_COUNT);
+
+    for (uint64_t i = 0; i != BENCH_ENTRY_COUNT; i++) {
+        const uint64_t index = (i * 2654435761ull) % BENCH_ENTRY_COUNT;
+        const struct range range = RANGE_INIT(index * 0x3000, 0x2000);
+
+        nodes[i] = malloc(sizeof(struct bench_avlnode));
+        nodes[i]->avlnode = AVLNODE_INIT();
+        nodes[i]->range = range;
+        padding[i] = malloc(128);
+
+        assert(avltree_insert(&avltree,
+                              &nodes[i]->avlnode,
+                              compare_bench_nodes,
+                              /*update=*/NULL,
+                              /*added_node=*/NULL));
+        assert(range_tree_insert(&range_tree, range, nodes[i]));
+    }
+
+    uint64_t seed = 1;
+    uint64_t found = 0;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint64_t i = 0; i != BENCH_LOOKUP_COUNT; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        found += avltree_find_loc(&avltree,
+                                  (seed >> 16) % (BENCH_ENTRY_COUNT * 0x3000))
+                    != NULL;
+    }
+
+    const double avltree_seconds = seconds_since(start);
+
+    seed = 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint64_t i = 0; i != BENCH_LOOKUP_COUNT; i++) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        found -= range_tree_find(&range_tree,
+                                 (seed >> 16) % (BENCH_ENTRY_COUNT * 0x3000),
+                                 /*range_out=*/NULL) != NULL;
+    }
+
+    const double range_tree_seconds = seconds_since(start);
+
+    // Both trees must have found the same entries.
+    assert(found == 0);
+
+    printf("range_tree: %d lookups in %d entries, avltree: %.3fs, "
+           "range_tree: %.3fs\n",
+           BENCH_LOOKUP_COUNT,
+           BENCH_ENTRY_COUNT,
+           avltree_seconds,
+           range_tree_seconds);
+
+    range_tree_destroy(&range_tree);
+    for (uint64_t i = 0; i != BENCH_ENTRY_COUNT; i++) {
+        free(nodes[i]);
+        free(padding[i]);
+    }
+
+    free(nodes);
+    free(padding);
+}
+
+void test_range_tree() {
+    test_insert_and_find();
+    test_find_space();
+    bench_lookups();
+}